@@ -0,0 +1,231 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2021 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "mdown.h"
+#include "extern.h"
+
+/*
+ * Alignment of all allocations.
+ * This is enough for any of the structures we put in here.
+ */
+#define	ARENA_ALIGN	16
+
+/*
+ * Size of the first chunk, which doubles with each new chunk until it
+ * reaches ARENA_CHUNK_MAX.
+ */
+#define	ARENA_CHUNK_MIN	(8 * 1024)
+#define	ARENA_CHUNK_MAX	(1024 * 1024)
+
+#define	ARENA_ROUND(_sz) \
+	(((_sz) + ARENA_ALIGN - 1) & ~((size_t)ARENA_ALIGN - 1))
+
+/*
+ * A contiguous chunk of zeroed memory.
+ * The usable region begins at ARENA_ROUND(sizeof(struct arena_chunk)).
+ */
+struct	arena_chunk {
+	struct arena_chunk	*next; /* previously-filled chunk */
+	size_t			 size; /* total size of chunk */
+	size_t			 used; /* bytes used (from chunk start) */
+};
+
+/*
+ * Memory allocated elsewhere (with malloc(3)) whose lifetime has been
+ * handed over to the arena.
+ */
+struct	arena_ext {
+	struct arena_ext	*next;
+	void			*p;
+};
+
+/*
+ * A bump allocator over a list of chunks.
+ * Individual allocations are never freed: all memory is released at
+ * once with arena_free().
+ */
+struct	mdown_arena {
+	struct arena_chunk	*head; /* current chunk */
+	size_t			 next; /* size of next regular chunk */
+	struct arena_ext	*ext; /* adopted memory */
+};
+
+struct mdown_arena *
+arena_new(void)
+{
+	struct mdown_arena	*a;
+
+	if ((a = calloc(1, sizeof(struct mdown_arena))) == NULL)
+		return NULL;
+	a->next = ARENA_CHUNK_MIN;
+	return a;
+}
+
+void
+arena_free(struct mdown_arena *a)
+{
+	struct arena_chunk	*c;
+	struct arena_ext	*e;
+
+	if (a == NULL)
+		return;
+	for (e = a->ext; e != NULL; e = e->next)
+		free(e->p);
+	while ((c = a->head) != NULL) {
+		a->head = c->next;
+		free(c);
+	}
+	free(a);
+}
+
+/*
+ * Allocate a new chunk able to hold at least "sz" bytes.
+ * Small requests get a regular chunk, which becomes the current one.
+ * Large requests get a chunk of their own, which is tucked behind the
+ * current chunk so that we keep filling the latter.
+ * Returns NULL on memory exhaustion.
+ */
+static struct arena_chunk *
+arena_chunk(struct mdown_arena *a, size_t sz)
+{
+	struct arena_chunk	*c;
+	size_t			 hdr, csz;
+
+	hdr = ARENA_ROUND(sizeof(struct arena_chunk));
+
+	if (sz > a->next / 4) {
+		if (sz > SIZE_MAX - hdr)
+			return NULL;
+		if ((c = calloc(1, hdr + sz)) == NULL)
+			return NULL;
+		c->size = c->used = hdr + sz;
+		if (a->head == NULL) {
+			a->head = c;
+		} else {
+			c->next = a->head->next;
+			a->head->next = c;
+		}
+		return c;
+	}
+
+	csz = a->next;
+	if (a->next < ARENA_CHUNK_MAX)
+		a->next *= 2;
+	if ((c = calloc(1, csz)) == NULL)
+		return NULL;
+	c->size = csz;
+	c->used = hdr + sz;
+	c->next = a->head;
+	a->head = c;
+	return c;
+}
+
+/*
+ * Allocate "nmemb" objects of "size" bytes, zeroed, from the arena.
+ * If the arena is NULL, this simply calls calloc(3) and the caller
+ * must free the result.
+ * Returns NULL on memory exhaustion.
+ */
+void *
+arena_calloc(struct mdown_arena *a, size_t nmemb, size_t size)
+{
+	struct arena_chunk	*c;
+	size_t			 sz, off;
+
+	if (a == NULL)
+		return calloc(nmemb, size);
+
+	if (size && nmemb > SIZE_MAX / size)
+		return NULL;
+	if ((sz = nmemb * size) > SIZE_MAX - ARENA_ALIGN)
+		return NULL;
+	sz = ARENA_ROUND(sz);
+
+	c = a->head;
+	if (c != NULL && c->size - c->used >= sz) {
+		off = c->used;
+		c->used += sz;
+		return (char *)c + off;
+	}
+
+	if ((c = arena_chunk(a, sz)) == NULL)
+		return NULL;
+	return (char *)c + (c->used - sz);
+}
+
+/*
+ * Hand over "p", allocated with malloc(3), to the arena: it will be
+ * freed along with the arena.
+ * On failure, "p" is not touched.
+ * Returns zero on failure (memory), non-zero on success.
+ */
+int
+arena_adopt(struct mdown_arena *a, void *p)
+{
+	struct arena_ext	*e;
+
+	if ((e = arena_calloc(a, 1, sizeof(struct arena_ext))) == NULL)
+		return 0;
+	e->p = p;
+	e->next = a->ext;
+	a->ext = e;
+	return 1;
+}
+
+/*
+ * Hand over all memory of "b" to "a", then free "b": what was allocated
+ * from "b" is freed along with "a".
+ * Allocation continues from the current chunk of "a".
+ */
+void
+arena_merge(struct mdown_arena *a, struct mdown_arena *b)
+{
+	struct arena_chunk	*c;
+	struct arena_ext	*e;
+
+	if (b == NULL)
+		return;
+
+	if ((c = b->head) != NULL) {
+		while (c->next != NULL)
+			c = c->next;
+		if (a->head == NULL) {
+			a->head = b->head;
+		} else {
+			c->next = a->head->next;
+			a->head->next = b->head;
+		}
+	}
+
+	if ((e = b->ext) != NULL) {
+		while (e->next != NULL)
+			e = e->next;
+		e->next = a->ext;
+		a->ext = b->ext;
+	}
+
+	free(b);
+}
@@ -0,0 +1,737 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2021 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdown.h"
+#include "extern.h"
+
+/*
+ * Serialised parse trees.
+ * The encoding consists of the following parts, in order:
+ *
+ *   header: magic (4 bytes), version (4), number of nodes (8), next
+ *     free node identifier (8), number of metadata pairs (8), and size
+ *     of the string table (8), all little-endian;
+ *   nodes in pre-order, each its type (low six bits) and change (high
+ *     two bits) in one byte, the distance back to its parent, the
+ *     difference of its identifier from that of the previous node plus
+ *     one (zig-zag encoded), then its attributes as laid out by
+ *     ast_attr_put();
+ *   metadata, each the length of its key and value;
+ *   string table.
+ *
+ * Except for the header, integers are unsigned LEB128 "varints".
+ * Strings are given only by their length: they're laid out in the
+ * string table in the order they're encountered.
+ * Loading copies the strings and rebuilds each node in an arena.
+ */
+#define	AST_MAGIC	"\177MDA"
+#define	AST_VERSION	1
+#define	AST_HEADSZ	40
+
+/*
+ * A tree being serialised.
+ */
+struct	ast_out {
+	struct mdown_buf	*ob; /* nodes and metadata */
+	struct mdown_buf	*strs; /* string table */
+	size_t			 nodesz; /* number of nodes */
+	size_t			 maxn; /* next free identifier */
+	size_t			 next; /* previous identifier plus one */
+};
+
+/*
+ * A serialised tree being loaded.
+ */
+struct	ast_in {
+	const unsigned char	*p; /* current position */
+	const unsigned char	*end; /* end of nodes and metadata */
+	char			*strs; /* copy of string table */
+	size_t			 strsz; /* size of string table */
+	size_t			 stroff; /* next string in table */
+	struct mdown_arena	*arena; /* allocator */
+};
+
+static int
+ast_put64(struct mdown_buf *ob, uint64_t v)
+{
+	char	 b[8];
+	size_t	 i;
+
+	for (i = 0; i < sizeof(b); i++, v >>= 8)
+		b[i] = v & 0xff;
+	return hbuf_put(ob, b, sizeof(b));
+}
+
+static uint64_t
+ast_get64(const unsigned char *p)
+{
+	uint64_t	 v = 0;
+	size_t		 i;
+
+	for (i = 8; i > 0; i--)
+		v = v << 8 | p[i - 1];
+	return v;
+}
+
+static int
+ast_putv(struct mdown_buf *ob, uint64_t v)
+{
+	char	 b[10];
+	size_t	 i = 0;
+
+	while (v >= 0x80) {
+		b[i++] = (v & 0x7f) | 0x80;
+		v >>= 7;
+	}
+	b[i++] = v;
+	return hbuf_put(ob, b, i);
+}
+
+/*
+ * Append the length of "b" to the output and its data to the string
+ * table.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+ast_putbuf(struct ast_out *o, const struct mdown_buf *b)
+{
+
+	return ast_putv(o->ob, b->size) &&
+		hbuf_put(o->strs, b->data, b->size);
+}
+
+/*
+ * Append the type-specific data of "n".
+ * Out-of-line attributes that weren't allocated are written as empty,
+ * as are missing table header flags.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+ast_attr_put(struct ast_out *o, const struct mdown_node *n)
+{
+	static const struct rndr_link		 link;
+	static const struct rndr_blockcode	 blockcode;
+	static const struct rndr_footnote_ref	 footnote_ref;
+	static const struct rndr_image		 image;
+	const struct rndr_link			*rl;
+	const struct rndr_blockcode		*rb;
+	const struct rndr_footnote_ref		*rf;
+	const struct rndr_image			*ri;
+	struct mdown_buf			*ob = o->ob;
+	size_t					 i;
+
+	switch (n->type) {
+	case MDOWN_LIST:
+		return ast_putv(ob, n->rndr_list.flags) &&
+			ast_putv(ob, n->rndr_list.start);
+	case MDOWN_LISTITEM:
+		return ast_putv(ob, n->rndr_listitem.flags) &&
+			ast_putv(ob, n->rndr_listitem.num);
+	case MDOWN_PARAGRAPH:
+		return ast_putv(ob, n->rndr_paragraph.lines) &&
+			ast_putv(ob, n->rndr_paragraph.beoln != 0);
+	case MDOWN_HEADER:
+		return ast_putv(ob, n->rndr_header.level);
+	case MDOWN_DEFINITION:
+		return ast_putv(ob, n->rndr_definition.flags);
+	case MDOWN_TABLE_BLOCK:
+		return ast_putv(ob, n->rndr_table.columns);
+	case MDOWN_TABLE_HEADER:
+		if (!ast_putv(ob, n->rndr_table_header.columns))
+			return 0;
+		for (i = 0; i < n->rndr_table_header.columns; i++)
+			if (!ast_putv(ob, n->rndr_table_header.flags == NULL ?
+			    0 : n->rndr_table_header.flags[i]))
+				return 0;
+		return 1;
+	case MDOWN_TABLE_CELL:
+		return ast_putv(ob, n->rndr_table_cell.flags) &&
+			ast_putv(ob, n->rndr_table_cell.col) &&
+			ast_putv(ob, n->rndr_table_cell.columns);
+	case MDOWN_FOOTNOTE_DEF:
+		return ast_putv(ob, n->rndr_footnote_def.num) &&
+			ast_putbuf(o, &n->rndr_footnote_def.key);
+	case MDOWN_MATH_BLOCK:
+		return ast_putv(ob, n->rndr_math.blockmode != 0) &&
+			ast_putbuf(o, &n->rndr_math.text);
+	case MDOWN_LINK_AUTO:
+		return ast_putv(ob, n->rndr_autolink.type) &&
+			ast_putbuf(o, &n->rndr_autolink.link);
+	case MDOWN_META:
+		return ast_putbuf(o, &n->rndr_meta.key);
+	case MDOWN_NORMAL_TEXT:
+		return ast_putbuf(o, &n->rndr_normal_text.text);
+	case MDOWN_ENTITY:
+		return ast_putbuf(o, &n->rndr_entity.text);
+	case MDOWN_RAW_HTML:
+		return ast_putbuf(o, &n->rndr_raw_html.text);
+	case MDOWN_CODESPAN:
+		return ast_putbuf(o, &n->rndr_codespan.text);
+	case MDOWN_BLOCKHTML:
+		return ast_putbuf(o, &n->rndr_blockhtml.text);
+	case MDOWN_FOOTNOTE_REF:
+		rf = n->rndr_footnote_ref != NULL ?
+			n->rndr_footnote_ref : &footnote_ref;
+		return ast_putv(ob, rf->num) &&
+			ast_putbuf(o, &rf->def) &&
+			ast_putbuf(o, &rf->key);
+	case MDOWN_BLOCKCODE:
+		rb = n->rndr_blockcode != NULL ?
+			n->rndr_blockcode : &blockcode;
+		return ast_putbuf(o, &rb->text) &&
+			ast_putbuf(o, &rb->lang);
+	case MDOWN_LINK:
+		rl = n->rndr_link != NULL ? n->rndr_link : &link;
+		return ast_putbuf(o, &rl->link) &&
+			ast_putbuf(o, &rl->title) &&
+			ast_putbuf(o, &rl->attr_cls) &&
+			ast_putbuf(o, &rl->attr_id);
+	case MDOWN_IMAGE:
+		ri = n->rndr_image != NULL ? n->rndr_image : &image;
+		return ast_putbuf(o, &ri->link) &&
+			ast_putbuf(o, &ri->title) &&
+			ast_putbuf(o, &ri->dims) &&
+			ast_putbuf(o, &ri->alt) &&
+			ast_putbuf(o, &ri->attr_width) &&
+			ast_putbuf(o, &ri->attr_height) &&
+			ast_putbuf(o, &ri->attr_cls) &&
+			ast_putbuf(o, &ri->attr_id);
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Serialise "n", whose parent is at index "parent", and its children.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+ast_node_put(struct ast_out *o, const struct mdown_node *n,
+	size_t parent)
+{
+	const struct mdown_node	*nn;
+	uint64_t		 delta;
+	size_t			 i;
+
+	i = o->nodesz++;
+	if (n->id >= o->maxn)
+		o->maxn = n->id + 1;
+
+	/* Zig-zag encoding of the signed difference. */
+
+	delta = n->id >= o->next ?
+		(uint64_t)(n->id - o->next) << 1 :
+		((uint64_t)(o->next - n->id) << 1) - 1;
+	o->next = n->id + 1;
+
+	if (!hbuf_putc(o->ob, n->type | n->chng << 6) ||
+	    !ast_putv(o->ob, i - parent) ||
+	    !ast_putv(o->ob, delta) ||
+	    !ast_attr_put(o, n))
+		return 0;
+
+	TAILQ_FOREACH(nn, &n->children, entries)
+		if (!ast_node_put(o, nn, i))
+			return 0;
+	return 1;
+}
+
+int
+mdown_ast_rndr(struct mdown_buf *ob, const struct mdown_node *root,
+	const struct mdown_metaq *mq)
+{
+	struct ast_out		 o;
+	struct mdown_buf	 b;
+	const struct mdown_meta	*m;
+	size_t			 metasz = 0;
+	int			 rc = 0;
+
+	memset(&o, 0, sizeof(struct ast_out));
+	if ((o.ob = hbuf_new(4096)) == NULL ||
+	    (o.strs = hbuf_new(4096)) == NULL)
+		goto out;
+
+	if (!ast_node_put(&o, root, 0))
+		goto out;
+
+	memset(&b, 0, sizeof(struct mdown_buf));
+	if (mq != NULL)
+		TAILQ_FOREACH(m, mq, entries) {
+			b.data = m->key;
+			b.size = strlen(m->key);
+			if (!ast_putbuf(&o, &b))
+				goto out;
+			b.data = m->value;
+			b.size = strlen(m->value);
+			if (!ast_putbuf(&o, &b))
+				goto out;
+			metasz++;
+		}
+
+	if (!hbuf_put(ob, AST_MAGIC, 4) ||
+	    !hbuf_put(ob, "\001\0\0\0", 4) ||
+	    !ast_put64(ob, o.nodesz) ||
+	    !ast_put64(ob, o.maxn) ||
+	    !ast_put64(ob, metasz) ||
+	    !ast_put64(ob, o.strs->size) ||
+	    !hbuf_putb(ob, o.ob) ||
+	    !hbuf_putb(ob, o.strs))
+		goto out;
+	rc = 1;
+out:
+	hbuf_free(o.ob);
+	hbuf_free(o.strs);
+	return rc;
+}
+
+/*
+ * Read a varint into "v".
+ * Return zero on failure (truncated or too large), non-zero on success.
+ */
+static int
+ast_getv(struct ast_in *in, size_t *v)
+{
+	uint64_t	 w = 0;
+	unsigned int	 shift = 0;
+	unsigned char	 c;
+
+	do {
+		if (in->p == in->end || shift > 63)
+			return 0;
+		c = *in->p++;
+		if (shift == 63 && (c & 0x7e))
+			return 0;
+		w |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+
+	if (w > SIZE_MAX)
+		return 0;
+	*v = w;
+	return 1;
+}
+
+/*
+ * Point "b" to the next string in the table, whose length is read from
+ * the input.
+ * The buffer is read-only, as with buffers from the parser.
+ * Return zero on failure (bad data), non-zero on success.
+ */
+static int
+ast_getstr(struct ast_in *in, struct mdown_buf *b)
+{
+	size_t	 sz;
+
+	if (!ast_getv(in, &sz) || sz > in->strsz - in->stroff)
+		return 0;
+	memset(b, 0, sizeof(struct mdown_buf));
+	if (sz > 0) {
+		b->data = in->strs + in->stroff;
+		b->size = sz;
+		in->stroff += sz;
+	}
+	return 1;
+}
+
+/*
+ * Read the type-specific data of "n", which has its type set.
+ * This mirrors ast_attr_put().
+ * Return zero on failure (memory or bad data), non-zero on success.
+ */
+static int
+ast_attr_get(struct ast_in *in, struct mdown_node *n)
+{
+	size_t	 i, v;
+
+	switch (n->type) {
+	case MDOWN_LIST:
+		if (!ast_getv(in, &v) ||
+		    !ast_getv(in, &n->rndr_list.start))
+			return 0;
+		n->rndr_list.flags = v;
+		return 1;
+	case MDOWN_LISTITEM:
+		if (!ast_getv(in, &v) ||
+		    !ast_getv(in, &n->rndr_listitem.num))
+			return 0;
+		n->rndr_listitem.flags = v;
+		return 1;
+	case MDOWN_PARAGRAPH:
+		if (!ast_getv(in, &n->rndr_paragraph.lines) ||
+		    !ast_getv(in, &v))
+			return 0;
+		n->rndr_paragraph.beoln = v != 0;
+		return 1;
+	case MDOWN_HEADER:
+		return ast_getv(in, &n->rndr_header.level);
+	case MDOWN_DEFINITION:
+		if (!ast_getv(in, &v))
+			return 0;
+		n->rndr_definition.flags = v;
+		return 1;
+	case MDOWN_TABLE_BLOCK:
+		return ast_getv(in, &n->rndr_table.columns);
+	case MDOWN_TABLE_HEADER:
+		if (!ast_getv(in, &n->rndr_table_header.columns))
+			return 0;
+		v = n->rndr_table_header.columns;
+		if (v > (size_t)(in->end - in->p))
+			return 0;
+		n->rndr_table_header.flags = arena_calloc(in->arena,
+			v, sizeof(enum htbl_flags));
+		if (n->rndr_table_header.flags == NULL)
+			return 0;
+		for (i = 0; i < n->rndr_table_header.columns; i++) {
+			if (!ast_getv(in, &v))
+				return 0;
+			n->rndr_table_header.flags[i] = v;
+		}
+		return 1;
+	case MDOWN_TABLE_CELL:
+		if (!ast_getv(in, &v) ||
+		    !ast_getv(in, &n->rndr_table_cell.col) ||
+		    !ast_getv(in, &n->rndr_table_cell.columns))
+			return 0;
+		n->rndr_table_cell.flags = v;
+		return 1;
+	case MDOWN_FOOTNOTE_DEF:
+		return ast_getv(in, &n->rndr_footnote_def.num) &&
+			ast_getstr(in, &n->rndr_footnote_def.key);
+	case MDOWN_MATH_BLOCK:
+		if (!ast_getv(in, &v))
+			return 0;
+		n->rndr_math.blockmode = v != 0;
+		return ast_getstr(in, &n->rndr_math.text);
+	case MDOWN_LINK_AUTO:
+		if (!ast_getv(in, &v) || v > HALINK_EMAIL)
+			return 0;
+		n->rndr_autolink.type = v;
+		return ast_getstr(in, &n->rndr_autolink.link);
+	case MDOWN_META:
+		return ast_getstr(in, &n->rndr_meta.key);
+	case MDOWN_NORMAL_TEXT:
+		return ast_getstr(in, &n->rndr_normal_text.text);
+	case MDOWN_ENTITY:
+		return ast_getstr(in, &n->rndr_entity.text);
+	case MDOWN_RAW_HTML:
+		return ast_getstr(in, &n->rndr_raw_html.text);
+	case MDOWN_CODESPAN:
+		return ast_getstr(in, &n->rndr_codespan.text);
+	case MDOWN_BLOCKHTML:
+		return ast_getstr(in, &n->rndr_blockhtml.text);
+	case MDOWN_FOOTNOTE_REF:
+		n->rndr_footnote_ref = arena_calloc(in->arena, 1,
+			sizeof(struct rndr_footnote_ref));
+		return n->rndr_footnote_ref != NULL &&
+			ast_getv(in, &n->rndr_footnote_ref->num) &&
+			ast_getstr(in, &n->rndr_footnote_ref->def) &&
+			ast_getstr(in, &n->rndr_footnote_ref->key);
+	case MDOWN_BLOCKCODE:
+		n->rndr_blockcode = arena_calloc(in->arena, 1,
+			sizeof(struct rndr_blockcode));
+		return n->rndr_blockcode != NULL &&
+			ast_getstr(in, &n->rndr_blockcode->text) &&
+			ast_getstr(in, &n->rndr_blockcode->lang);
+	case MDOWN_LINK:
+		n->rndr_link = arena_calloc(in->arena, 1,
+			sizeof(struct rndr_link));
+		return n->rndr_link != NULL &&
+			ast_getstr(in, &n->rndr_link->link) &&
+			ast_getstr(in, &n->rndr_link->title) &&
+			ast_getstr(in, &n->rndr_link->attr_cls) &&
+			ast_getstr(in, &n->rndr_link->attr_id);
+	case MDOWN_IMAGE:
+		n->rndr_image = arena_calloc(in->arena, 1,
+			sizeof(struct rndr_image));
+		return n->rndr_image != NULL &&
+			ast_getstr(in, &n->rndr_image->link) &&
+			ast_getstr(in, &n->rndr_image->title) &&
+			ast_getstr(in, &n->rndr_image->dims) &&
+			ast_getstr(in, &n->rndr_image->alt) &&
+			ast_getstr(in, &n->rndr_image->attr_width) &&
+			ast_getstr(in, &n->rndr_image->attr_height) &&
+			ast_getstr(in, &n->rndr_image->attr_cls) &&
+			ast_getstr(in, &n->rndr_image->attr_id);
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Whether "n", with its attributes read, may be a child of "p".
+ * Renderers walk tables by hand, reading whatever is below a table row
+ * as a cell in a column of the table, so tables must be nested exactly
+ * and have consistent columns.  The other pairs are those the parser
+ * always produces.
+ * Return zero if not, non-zero if so.
+ */
+static int
+ast_child_ok(const struct mdown_node *p, const struct mdown_node *n)
+{
+	const struct mdown_node	*t;
+
+	switch (p->type) {
+	case MDOWN_TABLE_BLOCK:
+		if (n->type != MDOWN_TABLE_HEADER &&
+		    n->type != MDOWN_TABLE_BODY)
+			return 0;
+		break;
+	case MDOWN_TABLE_HEADER:
+	case MDOWN_TABLE_BODY:
+		if (n->type != MDOWN_TABLE_ROW)
+			return 0;
+		break;
+	case MDOWN_TABLE_ROW:
+		if (n->type != MDOWN_TABLE_CELL)
+			return 0;
+		break;
+	case MDOWN_LIST:
+		if (n->type != MDOWN_LISTITEM)
+			return 0;
+		break;
+	case MDOWN_DEFINITION:
+		if (n->type != MDOWN_DEFINITION_TITLE &&
+		    n->type != MDOWN_DEFINITION_DATA)
+			return 0;
+		break;
+	case MDOWN_DOC_HEADER:
+		if (n->type != MDOWN_META)
+			return 0;
+		break;
+	default:
+		break;
+	}
+
+	switch (n->type) {
+	case MDOWN_ROOT:
+		return 0;
+	case MDOWN_TABLE_BLOCK:
+		return n->rndr_table.columns > 0;
+	case MDOWN_TABLE_HEADER:
+		return p->type == MDOWN_TABLE_BLOCK &&
+		    n->rndr_table_header.columns == p->rndr_table.columns;
+	case MDOWN_TABLE_BODY:
+		return p->type == MDOWN_TABLE_BLOCK;
+	case MDOWN_TABLE_ROW:
+		return p->type == MDOWN_TABLE_HEADER ||
+		    p->type == MDOWN_TABLE_BODY;
+	case MDOWN_TABLE_CELL:
+		if (p->type != MDOWN_TABLE_ROW)
+			return 0;
+		t = p->parent->parent;
+		return n->rndr_table_cell.columns == t->rndr_table.columns &&
+		    n->rndr_table_cell.col < t->rndr_table.columns;
+	case MDOWN_LISTITEM:
+		return p->type == MDOWN_LIST ||
+		    p->type == MDOWN_DEFINITION_DATA;
+	case MDOWN_DEFINITION_TITLE:
+	case MDOWN_DEFINITION_DATA:
+		return p->type == MDOWN_DEFINITION;
+	case MDOWN_META:
+		return p->type == MDOWN_DOC_HEADER;
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Read "metasz" metadata pairs into "mq".
+ * Return zero on failure (memory or bad data), non-zero on success.
+ */
+static int
+ast_meta_get(struct ast_in *in, size_t metasz, struct mdown_metaq *mq)
+{
+	struct mdown_meta	*m;
+	struct mdown_buf	 key, val;
+	size_t			 i;
+
+	for (i = 0; i < metasz; i++) {
+		if (!ast_getstr(in, &key) || !ast_getstr(in, &val))
+			return 0;
+		if (mq == NULL)
+			continue;
+		if ((m = calloc(1, sizeof(struct mdown_meta))) == NULL)
+			return 0;
+		TAILQ_INSERT_TAIL(mq, m, entries);
+		if ((m->key = strndup(key.data == NULL ?
+		    "" : key.data, key.size)) == NULL ||
+		    (m->value = strndup(val.data == NULL ?
+		    "" : val.data, val.size)) == NULL)
+			return 0;
+	}
+	return 1;
+}
+
+static int
+ast_id_cmp(const void *p1, const void *p2)
+{
+	size_t	 id1 = *(const size_t *)p1, id2 = *(const size_t *)p2;
+
+	return id1 < id2 ? -1 : id1 > id2;
+}
+
+struct mdown_node *
+mdown_ast_load(const struct mdown_opts *opts, const char *data,
+	size_t sz, size_t *maxn, struct mdown_metaq *mq)
+{
+	const unsigned char	*p = (const unsigned char *)data;
+	struct ast_in		 in;
+	struct mdown_node	*nodes = NULL, *n;
+	size_t			*ids = NULL, *depth = NULL;
+	uint64_t		 hdr[4];
+	size_t			 i, v, nodesz, metasz, next, id = 0,
+				 maxdepth;
+	int			 rc = 0;
+
+	memset(&in, 0, sizeof(struct ast_in));
+	maxdepth = opts == NULL ? 128 : opts->maxdepth;
+	if (mq != NULL)
+		TAILQ_INIT(mq);
+
+	/*
+	 * The string table is at the end.
+	 * Each node takes at least three bytes, which bounds the number
+	 * of nodes we allocate up front.
+	 */
+
+	if (sz < AST_HEADSZ || memcmp(p, AST_MAGIC, 4) ||
+	    memcmp(p + 4, "\001\0\0\0", 4))
+		return NULL;
+	for (i = 0; i < 4; i++)
+		hdr[i] = ast_get64(p + 8 + i * 8);
+	if (hdr[3] > sz - AST_HEADSZ || hdr[1] > SIZE_MAX)
+		return NULL;
+	in.p = p + AST_HEADSZ;
+	in.end = p + sz - hdr[3];
+	in.strsz = hdr[3];
+	if (hdr[0] == 0 || hdr[0] > (size_t)(in.end - in.p) / 3 ||
+	    hdr[2] > (size_t)(in.end - in.p))
+		return NULL;
+	nodesz = hdr[0];
+	next = hdr[1];
+	metasz = hdr[2];
+
+	/*
+	 * Like parsed trees, all nodes and data live in an arena owned by
+	 * the root, which also gets its own copy of the strings.
+	 * The identifiers are collected so that we reject duplicates.
+	 * They may be sparse, so "next" (which isn't bounded by anything
+	 * in the file) mustn't size any allocation.
+	 */
+
+	if ((in.arena = arena_new()) == NULL)
+		return NULL;
+	if ((nodes = arena_calloc
+	    (in.arena, nodesz, sizeof(struct mdown_node))) == NULL)
+		goto out;
+	if (in.strsz > 0) {
+		if ((in.strs = arena_calloc(in.arena, 1, in.strsz)) == NULL)
+			goto out;
+		memcpy(in.strs, in.end, in.strsz);
+	}
+	if ((ids = calloc(nodesz, sizeof(size_t))) == NULL)
+		goto out;
+	if ((depth = calloc(nodesz, sizeof(size_t))) == NULL)
+		goto out;
+
+	for (i = 0; i < nodesz; i++) {
+		n = &nodes[i];
+		n->arena = in.arena;
+		TAILQ_INIT(&n->children);
+
+		if (in.p == in.end)
+			goto out;
+		if ((*in.p & 0x3f) >= MDOWN__MAX ||
+		    (*in.p >> 6) > MDOWN_CHNG_DELETE)
+			goto out;
+		n->type = *in.p & 0x3f;
+		n->chng = *in.p >> 6;
+		in.p++;
+
+		/* Only the root is its own parent. */
+
+		if (!ast_getv(&in, &v))
+			goto out;
+		if (i == 0 ? (v != 0 || n->type != MDOWN_ROOT) :
+		    (v == 0 || v > i))
+			goto out;
+		if (i > 0) {
+			depth[i] = depth[i - v] + 1;
+			if (maxdepth && depth[i] > maxdepth)
+				goto out;
+			n->parent = &nodes[i - v];
+			TAILQ_INSERT_TAIL(&n->parent->children, n, entries);
+		}
+
+		/* Undo the zig-zag encoding. */
+
+		if (!ast_getv(&in, &v))
+			goto out;
+		if (v & 1) {
+			if (v / 2 + 1 > id)
+				goto out;
+			id -= v / 2 + 1;
+		} else {
+			if (v / 2 > SIZE_MAX - id)
+				goto out;
+			id += v / 2;
+		}
+		if (id >= next)
+			goto out;
+		ids[i] = n->id = id++;
+
+		if (!ast_attr_get(&in, n))
+			goto out;
+		if (i > 0 && !ast_child_ok(n->parent, n))
+			goto out;
+	}
+
+	if (!ast_meta_get(&in, metasz, mq))
+		goto out;
+	if (in.p != in.end || in.stroff != in.strsz)
+		goto out;
+
+	qsort(ids, nodesz, sizeof(size_t), ast_id_cmp);
+	for (i = 1; i < nodesz; i++)
+		if (ids[i] == ids[i - 1])
+			goto out;
+
+	if (maxn != NULL)
+		*maxn = next;
+	rc = 1;
+out:
+	free(ids);
+	free(depth);
+	if (!rc) {
+		arena_free(in.arena);
+		return NULL;
+	}
+	return &nodes[0];
+}
@@ -0,0 +1,219 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2021 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#if HAVE_ERR
+# include <err.h>
+#endif
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdown.h"
+
+/*
+ * Parse benchmark: reads all files given on the command line into
+ * memory, then parses each of them "count" times with the same parser
+ * features as mdown(1) by default.
+ * With -a, each is instead loaded from its serialised tree, which is
+ * created once beforehand; with -r, each is also rendered as HTML.
+ * Prints the input size, elapsed time, and throughput in MB/s.
+ */
+
+struct	bench {
+	char			*buf;
+	size_t			 bufsz;
+	struct mdown_buf	*ast; /* serialised tree (-a) */
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-amrx] [-n count] file ...\n",
+		getprogname());
+	exit(EXIT_FAILURE);
+}
+
+static double
+now(void)
+{
+	struct timespec	 ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(EXIT_FAILURE, "clock_gettime");
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+bench_read(struct bench *b, const char *fn)
+{
+	FILE	*f;
+	size_t	 rsz, maxsz = 0;
+
+	if ((f = fopen(fn, "r")) == NULL)
+		err(EXIT_FAILURE, "%s", fn);
+	b->buf = NULL;
+	b->bufsz = 0;
+	for (;;) {
+		if (b->bufsz == maxsz) {
+			maxsz = maxsz == 0 ? BUFSIZ : maxsz * 2;
+			if ((b->buf = realloc(b->buf, maxsz)) == NULL)
+				err(EXIT_FAILURE, NULL);
+		}
+		rsz = fread(b->buf + b->bufsz, 1, maxsz - b->bufsz, f);
+		if (rsz == 0)
+			break;
+		b->bufsz += rsz;
+	}
+	if (ferror(f))
+		err(EXIT_FAILURE, "%s", fn);
+	fclose(f);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct mdown_opts	 opts;
+	struct mdown_doc	*doc;
+	struct mdown_node	*n;
+	struct mdown_buf	*ob = NULL;
+	struct bench		*files;
+	const char		*er;
+	void			*rndr = NULL;
+	size_t			 i, count = 100, total = 0;
+	int			 c, nfiles, aflag = 0, rflag = 0;
+	double			 start, elapsed;
+
+	memset(&opts, 0, sizeof(struct mdown_opts));
+	opts.maxdepth = 128;
+	opts.feat =
+		MDOWN_ATTRS |
+		MDOWN_AUTOLINK |
+		MDOWN_COMMONMARK |
+		MDOWN_DEFLIST |
+		MDOWN_FENCED |
+		MDOWN_FOOTNOTES |
+		MDOWN_METADATA |
+		MDOWN_SMARTY_PARSE |
+		MDOWN_STRIKE |
+		MDOWN_SUPER |
+		MDOWN_TABLES |
+		MDOWN_TASKLIST;
+
+	while ((c = getopt(argc, argv, "amn:rx")) != -1)
+		switch (c) {
+		case 'a':
+			aflag = 1;
+			break;
+		case 'm':
+			opts.feat |= MDOWN_MATH | MDOWN_HILITE;
+			break;
+		case 'n':
+			count = strtonum(optarg, 1, 1000000, &er);
+			if (er != NULL)
+				errx(EXIT_FAILURE, "-n: %s", er);
+			break;
+		case 'r':
+			rflag = 1;
+			break;
+		case 'x':
+			opts.feat &= ~(MDOWN_AUTOLINK |
+				MDOWN_STRIKE | MDOWN_SUPER);
+			break;
+		default:
+			usage();
+		}
+
+	argc -= optind;
+	argv += optind;
+	if ((nfiles = argc) == 0)
+		usage();
+
+	if ((files = calloc(nfiles, sizeof(struct bench))) == NULL)
+		err(EXIT_FAILURE, NULL);
+	for (c = 0; c < nfiles; c++) {
+		bench_read(&files[c], argv[c]);
+		total += files[c].bufsz;
+	}
+
+	if ((doc = mdown_doc_new(&opts)) == NULL)
+		err(EXIT_FAILURE, NULL);
+	if (rflag) {
+		if ((rndr = mdown_html_new(&opts)) == NULL)
+			err(EXIT_FAILURE, NULL);
+		if ((ob = mdown_buf_new(BUFSIZ)) == NULL)
+			err(EXIT_FAILURE, NULL);
+	}
+
+	if (aflag)
+		for (c = 0; c < nfiles; c++) {
+			n = mdown_doc_parse(doc, NULL,
+				files[c].buf, files[c].bufsz, NULL);
+			if (n == NULL)
+				errx(EXIT_FAILURE, "%s: parse", argv[c]);
+			if ((files[c].ast = mdown_buf_new(BUFSIZ)) == NULL)
+				err(EXIT_FAILURE, NULL);
+			if (!mdown_ast_rndr(files[c].ast, n, NULL))
+				err(EXIT_FAILURE, NULL);
+			mdown_node_free(n);
+		}
+
+	start = now();
+	for (i = 0; i < count; i++)
+		for (c = 0; c < nfiles; c++) {
+			if (aflag)
+				n = mdown_ast_load(&opts, files[c].ast->data,
+					files[c].ast->size, NULL, NULL);
+			else
+				n = mdown_doc_parse(doc, NULL,
+					files[c].buf, files[c].bufsz, NULL);
+			if (n == NULL)
+				errx(EXIT_FAILURE, "%s: %s", argv[c],
+					aflag ? "load" : "parse");
+			if (rflag) {
+				ob->size = 0;
+				if (!mdown_html_rndr(ob, rndr, n))
+					errx(EXIT_FAILURE,
+						"%s: render", argv[c]);
+			}
+			mdown_node_free(n);
+		}
+	elapsed = now() - start;
+
+	printf("%s%s: %zu bytes x %zu in %.3f s: %.1f MB/s\n",
+		aflag ? "load" : "parse", rflag ? "+render" : "",
+		total, count, elapsed, elapsed > 0.0 ?
+		(double)total * count / elapsed / 1e6 : 0.0);
+
+	mdown_html_free(rndr);
+	mdown_buf_free(ob);
+	mdown_doc_free(doc);
+	for (c = 0; c < nfiles; c++) {
+		free(files[c].buf);
+		mdown_buf_free(files[c].ast);
+	}
+	free(files);
+	return EXIT_SUCCESS;
+}
@@ -132,22 +132,74 @@ mdown_buf_free(struct mdown_buf *buf)
 	hbuf_free(buf);
 }
 
+/*
+ * Set the allocated size of "buf" to at least "asz", rounded up to a
+ * multiple of its unit.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+hbuf_alloc(struct mdown_buf *buf, size_t asz)
+{
+	size_t	 rem;
+	void	*pp;
+
+	assert(buf->unit);
+	if ((rem = asz % buf->unit) > 0) {
+		if (asz > SIZE_MAX - (buf->unit - rem))
+			return 0;
+		asz += buf->unit - rem;
+	}
+	if ((pp = realloc(buf->data, asz)) == NULL)
+		return 0;
+	buf->data = pp;
+	buf->maxsize = asz;
+	return 1;
+}
+
+/*
+ * Make sure that "buf" can hold "neosz" bytes.
+ * The allocation at least doubles each time, so appending to a buffer
+ * takes amortised constant time no matter its unit, which is only the
+ * granularity of allocations.
+ * Return zero on failure (memory), non-zero on success.
+ */
 int
 hbuf_grow(struct mdown_buf *buf, size_t neosz)
 {
 	size_t	 neoasz;
-	void	*pp;
 
 	if (buf->maxsize >= neosz)
 		return 1;
 
-	neoasz = (neosz/buf->unit + (neosz%buf->unit > 0)) * buf->unit;
+	neoasz = buf->maxsize > SIZE_MAX / 2 ?
+		SIZE_MAX : buf->maxsize * 2;
+	if (neoasz < neosz)
+		neoasz = neosz;
+	return hbuf_alloc(buf, neoasz);
+}
+
+/*
+ * Make sure that "buf" can take another "sz" bytes without growing.
+ * Unlike hbuf_grow(), this allocates no more than needed, so it should
+ * be used when the (approximate) final size is known.
+ * Return zero on failure (memory), non-zero on success.
+ */
+int
+hbuf_reserve(struct mdown_buf *buf, size_t sz)
+{
 
-	if ((pp = realloc(buf->data, neoasz)) == NULL)
+	if (sz > SIZE_MAX - buf->size)
 		return 0;
-	buf->data = pp;
-	buf->maxsize = neoasz;
-	return 1;
+	if (buf->maxsize >= buf->size + sz)
+		return 1;
+	return hbuf_alloc(buf, buf->size + sz);
+}
+
+int
+mdown_buf_reserve(struct mdown_buf *buf, size_t sz)
+{
+
+	return hbuf_reserve(buf, sz);
 }
 
 int
@@ -206,7 +258,7 @@ hbuf_putf(struct mdown_buf *buf, FILE *file)
 		if (!hbuf_grow(buf, buf->size + buf->unit))
 			return 0;
 		buf->size += fread(buf->data + buf->size, 
-			1, buf->unit, file);
+			1, buf->maxsize - buf->size, file);
 	}
 
 	return ferror(file) == 0;
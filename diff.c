@@ -44,12 +44,13 @@
  * which ends up being "match".
  */
 struct	xnode {
-	char		 		 sig[MD5_DIGEST_STRING_LENGTH];
+	unsigned char	 		 sig[MD5_DIGEST_LENGTH];
 	double		 		 weight; /* queue weight */
 	const struct mdown_node 	*node; /* basis node */
 	const struct mdown_node 	*match; /* matching node */
 	size_t		 		 opt; /* match optimality */
 	const struct mdown_node 	*optmatch; /* current optimal */
+	struct xnode			*signext; /* next with same sig */
 };
 
 /*
@@ -63,15 +64,38 @@ struct	xmap {
 	size_t		 maxid; /* max node id */
 	size_t		 maxnodes; /* non-NULL count */
 	double		 maxweight; /* node weight */
+	struct htab	 sigtab; /* signature index */
 };
 
 /*
- * Queue of nodes.  This is used in creating the priority queue of next
- * nodes to parse.
+ * Priority queue of nodes.  This is used in ordering the next nodes to
+ * parse.  A node is queued before the first node of lesser or equal
+ * weight; if equal, it instead goes before the first node from there
+ * on with a greater identifier.  This ordering is part of the diff
+ * output, so it must be kept as-is.
+ * The queue is a treap ordered by queue position, each subtree knowing
+ * its least weight and greatest identifier, so finding where a node
+ * goes doesn't walk the queue.
  */
-struct	pnode {
-	const struct mdown_node	*node; /* priority node */
-	TAILQ_ENTRY(pnode) 	 	 entries;
+struct	pqnode {
+	const struct mdown_node	*node; /* queued node */
+	double			 weight; /* weight of node */
+	double			 minweight; /* least weight in subtree */
+	size_t			 maxid; /* greatest id in subtree */
+	size_t			 count; /* nodes in subtree */
+	uint32_t		 prio; /* treap priority */
+	size_t			 left; /* left subtree or PQ_NIL */
+	size_t			 right; /* right subtree or PQ_NIL */
+};
+
+#define	PQ_NIL	SIZE_MAX
+
+struct	pqueue {
+	struct pqnode		*nodes; /* all nodes ever queued */
+	size_t			 nodesz; /* elements in "nodes" */
+	size_t			 maxsize; /* allocated size */
+	size_t			 root; /* treap root or PQ_NIL */
+	uint32_t		 seed; /* priority generator */
 };
 
 /*
@@ -102,8 +126,6 @@ struct	merger {
 	size_t		  refnum; /* next ref num to assign */
 };
 
-TAILQ_HEAD(pnodeq, pnode);
-
 /*
  * A node used in computing the shortest edit script.
  */
@@ -145,80 +167,19 @@ is_opaque(const struct mdown_node *n)
 }
 
 /*
- * Assign signatures and weights.
- * This is defined by "Phase 2" in sec. 5.2., along with the specific
- * heuristics given in the "Tuning" section.
- * We use the MD5 algorithm for computing hashes.
- * Returns the weight of the node rooted at "n".
- * If "parent" is not NULL, its hash is updated with the hash computed
- * for the current "n" and its children.
- * Return <0 on failure.
+ * The weight of "n" given "v", the sum of its children's weights.
+ * The weight is either the log of the contained text length for leaf
+ * nodes or the accumulated sub-element weight for non-terminal nodes
+ * plus one.
  */
 static double
-assign_sigs(MD5_CTX *parent, struct xmap *map, 
-	const struct mdown_node *n, int ign)
+sig_weight(const struct mdown_node *n, double v)
 {
-	const struct mdown_node	*nn;
-	ssize_t				 weight = -1;
-	MD5_CTX				 ctx;
-	double				 v = 0.0, vv;
-	struct xnode			*xn;
-	struct xnode			 xntmp;
-	void				*pp;
-	int				 ign_chld = ign;
-
-	/* 
-	 * Get our node slot unless we're ignoring the node.
-	 * Ignoring comes when a parent in our chain is opaque.
-	 */
-
-	if (!ign) {
-		if (n->id >= map->maxsize) {
-			pp = recallocarray(map->nodes, map->maxsize, 
-				n->id + 64, sizeof(struct xnode));
-			if (pp == NULL)
-				return -1.0;
-			map->nodes = pp;
-			map->maxsize = n->id + 64;
-		}
-		xn = &map->nodes[n->id];
-		assert(xn->node == NULL);
-		assert(xn->weight == 0.0);
-		xn->node = n;
-		if (n->id > map->maxid)
-			map->maxid = n->id;
-		assert(map->maxid < map->maxsize);
-		map->maxnodes++;
-		ign_chld = is_opaque(n);
-	}
-
-	/* Recursive step. */
-
-	MD5Init(&ctx);
-	MD5Updatev(&ctx, &n->type, sizeof(enum mdown_rndrt));
-
-	TAILQ_FOREACH(nn, &n->children, entries) {
-		if ((vv = assign_sigs(&ctx, map, nn, ign_chld)) < 0.0)
-			return vv;
-		v += vv;
-	}
-
-	/* Re-assign "xn": child might have reallocated. */
-
-	memset(&xntmp, 0, sizeof(struct xnode));
-	xn = ign ? &xntmp : &map->nodes[n->id];
-	xn->weight = v;
-
-	/*
-	 * Compute our weight.
-	 * The weight is either the log of the contained text length for
-	 * leaf nodes or the accumulated sub-element weight for
-	 * non-terminal nodes plus one.
-	 */
+	ssize_t		 weight = -1;
 
 	switch (n->type) {
 	case MDOWN_BLOCKCODE:
-		weight = n->rndr_blockcode.text.size;
+		weight = n->rndr_blockcode->text.size;
 		break;
 	case MDOWN_BLOCKHTML:
 		weight = n->rndr_blockhtml.text.size;
@@ -233,10 +194,10 @@ assign_sigs(MD5_CTX *parent, struct xmap *map,
 		weight = n->rndr_meta.key.size;
 		break;
 	case MDOWN_IMAGE:
-		weight = n->rndr_image.link.size +
-			n->rndr_image.title.size +
-			n->rndr_image.dims.size +
-			n->rndr_image.alt.size;
+		weight = n->rndr_image->link.size +
+			n->rndr_image->title.size +
+			n->rndr_image->dims.size +
+			n->rndr_image->alt.size;
 		break;
 	case MDOWN_RAW_HTML:
 		weight = n->rndr_raw_html.text.size;
@@ -254,159 +215,457 @@ assign_sigs(MD5_CTX *parent, struct xmap *map,
 	/* Weight can be zero if text size is zero. */
 
 	if (weight >= 0)
-		xn->weight = 1.0 + (weight == 0 ? 0.0 : log(weight));
-	else
-		xn->weight += 1.0;
+		return 1.0 + (weight == 0 ? 0.0 : log(weight));
+	return v + 1.0;
+}
 
-	/*
-	 * Augment our signature from our attributes.
-	 * This depends upon the node.
-	 * Avoid using attributes that are "mutable" relative to the
-	 * generated output, e.g., list display numbers.
-	 */
+/*
+ * Augment the signature "ctx" of "n" from its attributes.
+ * Avoid using attributes that are "mutable" relative to the generated
+ * output, e.g., list display numbers.
+ */
+static void
+sig_attrs(MD5_CTX *ctx, const struct mdown_node *n)
+{
 
 	switch (n->type) {
 	case MDOWN_LIST:
-		MD5Updatev(&ctx, &n->rndr_list.flags, 
+		MD5Updatev(ctx, &n->rndr_list.flags, 
 			sizeof(enum hlist_fl));
 		break;
 	case MDOWN_LISTITEM:
-		MD5Updatev(&ctx, &n->rndr_listitem.flags, 
+		MD5Updatev(ctx, &n->rndr_listitem.flags, 
 			sizeof(enum hlist_fl));
-		MD5Updatev(&ctx, &n->rndr_listitem.num, 
+		MD5Updatev(ctx, &n->rndr_listitem.num, 
 			sizeof(size_t));
 		break;
 	case MDOWN_HEADER:
-		MD5Updatev(&ctx, &n->rndr_header.level, 
+		MD5Updatev(ctx, &n->rndr_header.level, 
 			sizeof(size_t));
 		break;
 	case MDOWN_NORMAL_TEXT:
-		MD5Updatebuf(&ctx, &n->rndr_normal_text.text);
+		MD5Updatebuf(ctx, &n->rndr_normal_text.text);
 		break;
 	case MDOWN_META:
-		MD5Updatebuf(&ctx, &n->rndr_meta.key);
+		MD5Updatebuf(ctx, &n->rndr_meta.key);
 		break;
 	case MDOWN_ENTITY:
-		MD5Updatebuf(&ctx, &n->rndr_entity.text);
+		MD5Updatebuf(ctx, &n->rndr_entity.text);
 		break;
 	case MDOWN_LINK_AUTO:
-		MD5Updatebuf(&ctx, &n->rndr_autolink.link);
-		MD5Updatev(&ctx, &n->rndr_autolink.type, 
+		MD5Updatebuf(ctx, &n->rndr_autolink.link);
+		MD5Updatev(ctx, &n->rndr_autolink.type, 
 			sizeof(enum halink_type));
 		break;
 	case MDOWN_RAW_HTML:
-		MD5Updatebuf(&ctx, &n->rndr_raw_html.text);
+		MD5Updatebuf(ctx, &n->rndr_raw_html.text);
 		break;
 	case MDOWN_LINK:
-		MD5Updatebuf(&ctx, &n->rndr_link.link);
-		MD5Updatebuf(&ctx, &n->rndr_link.title);
+		MD5Updatebuf(ctx, &n->rndr_link->link);
+		MD5Updatebuf(ctx, &n->rndr_link->title);
 		break;
 	case MDOWN_BLOCKCODE:
-		MD5Updatebuf(&ctx, &n->rndr_blockcode.text);
-		MD5Updatebuf(&ctx, &n->rndr_blockcode.lang);
+		MD5Updatebuf(ctx, &n->rndr_blockcode->text);
+		MD5Updatebuf(ctx, &n->rndr_blockcode->lang);
 		break;
 	case MDOWN_CODESPAN:
-		MD5Updatebuf(&ctx, &n->rndr_codespan.text);
+		MD5Updatebuf(ctx, &n->rndr_codespan.text);
 		break;
 	case MDOWN_TABLE_HEADER:
-		MD5Updatev(&ctx, &n->rndr_table_header.columns,
+		MD5Updatev(ctx, &n->rndr_table_header.columns,
 			sizeof(size_t));
 		break;
 	case MDOWN_TABLE_CELL:
-		MD5Updatev(&ctx, &n->rndr_table_cell.flags,
+		MD5Updatev(ctx, &n->rndr_table_cell.flags,
 			sizeof(enum htbl_flags));
-		MD5Updatev(&ctx, &n->rndr_table_cell.col,
+		MD5Updatev(ctx, &n->rndr_table_cell.col,
 			sizeof(size_t));
 		break;
 	case MDOWN_IMAGE:
-		MD5Updatebuf(&ctx, &n->rndr_image.link);
-		MD5Updatebuf(&ctx, &n->rndr_image.title);
-		MD5Updatebuf(&ctx, &n->rndr_image.dims);
-		MD5Updatebuf(&ctx, &n->rndr_image.alt);
+		MD5Updatebuf(ctx, &n->rndr_image->link);
+		MD5Updatebuf(ctx, &n->rndr_image->title);
+		MD5Updatebuf(ctx, &n->rndr_image->dims);
+		MD5Updatebuf(ctx, &n->rndr_image->alt);
 		break;
 	case MDOWN_MATH_BLOCK:
-		MD5Updatev(&ctx, &n->rndr_math.blockmode, 
+		MD5Updatev(ctx, &n->rndr_math.blockmode, 
 			sizeof(int));
 		break;
 	case MDOWN_BLOCKHTML:
-		MD5Updatebuf(&ctx, &n->rndr_blockhtml.text);
+		MD5Updatebuf(ctx, &n->rndr_blockhtml.text);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		MD5Updatebuf(&ctx, &n->rndr_footnote_ref.key);
-		MD5Updatebuf(&ctx, &n->rndr_footnote_ref.def);
+		MD5Updatebuf(ctx, &n->rndr_footnote_ref->key);
+		MD5Updatebuf(ctx, &n->rndr_footnote_ref->def);
 		break;
 	case MDOWN_FOOTNOTE_DEF:
-		MD5Updatebuf(&ctx, &n->rndr_footnote_def.key);
+		MD5Updatebuf(ctx, &n->rndr_footnote_def.key);
 		break;
 	default:
 		break;
 	}
+}
+
+/*
+ * Assign signatures and weights to the nodes of the tree indexed by
+ * "f".
+ * This is defined by "Phase 2" in sec. 5.2., along with the specific
+ * heuristics given in the "Tuning" section.
+ * We use the MD5 algorithm for computing hashes.
+ * A node's signature covers its type, the signatures of its children in
+ * order, then its attributes.
+ * Nodes within an opaque node are hashed and weighed, but not entered
+ * into "map".
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+assign_sigs(struct xmap *map, const struct flat *f)
+{
+	const struct flat_node	*fn;
+	const struct mdown_node	*n;
+	struct xsig {
+		unsigned char	 sig[MD5_DIGEST_LENGTH];
+		double		 weight;
+		int		 ign; /* within opaque node */
+	}			*sigs;
+	struct xnode		*xn;
+	MD5_CTX			 ctx;
+	double			 v;
+	size_t			 i, c, maxsize = 0;
+
+	if ((sigs = calloc(f->nodesz, sizeof(struct xsig))) == NULL)
+		return 0;
+
+	/*
+	 * Get node slots, in pre-order, unless ignoring the node.
+	 * Ignoring comes when a parent in our chain is opaque.
+	 */
+
+	for (i = 0; i < f->nodesz; i++)
+		if (f->nodes[i].n->id >= maxsize)
+			maxsize = f->nodes[i].n->id + 1;
+	map->nodes = calloc(maxsize, sizeof(struct xnode));
+	if (map->nodes == NULL) {
+		free(sigs);
+		return 0;
+	}
+	map->maxsize = maxsize;
+
+	for (i = 0; i < f->nodesz; i++) {
+		fn = &f->nodes[i];
+		if (fn->parent != FLAT_NONE)
+			sigs[i].ign = sigs[fn->parent].ign ||
+				is_opaque(f->nodes[fn->parent].n);
+		if (sigs[i].ign)
+			continue;
+		xn = &map->nodes[fn->n->id];
+		assert(xn->node == NULL);
+		xn->node = fn->n;
+		if (fn->n->id > map->maxid)
+			map->maxid = fn->n->id;
+		map->maxnodes++;
+	}
+
+	/* Children come after their parents: sweep bottom-up. */
+
+	for (i = f->nodesz; i > 0; i--) {
+		fn = &f->nodes[i - 1];
+		n = fn->n;
+		MD5Init(&ctx);
+		MD5Updatev(&ctx, &n->type, sizeof(enum mdown_rndrt));
+		v = 0.0;
+		for (c = fn->child; c != FLAT_NONE; c = f->nodes[c].next) {
+			MD5Update(&ctx, sigs[c].sig, MD5_DIGEST_LENGTH);
+			v += sigs[c].weight;
+		}
+		sig_attrs(&ctx, n);
+		MD5Final(sigs[i - 1].sig, &ctx);
+		sigs[i - 1].weight = sig_weight(n, v);
+
+		if (sigs[i - 1].weight > map->maxweight)
+			map->maxweight = sigs[i - 1].weight;
+		assert(isfinite(sigs[i - 1].weight));
+		assert(isnormal(sigs[i - 1].weight));
+		assert(sigs[i - 1].weight > 0.0);
+
+		if (sigs[i - 1].ign)
+			continue;
+		xn = &map->nodes[n->id];
+		memcpy(xn->sig, sigs[i - 1].sig, MD5_DIGEST_LENGTH);
+		xn->weight = sigs[i - 1].weight;
+	}
+
+	free(sigs);
+	return 1;
+}
+
+/*
+ * The signature of the node "p" for the signature index: see
+ * htab_slot().
+ */
+static const char *
+sigtab_key(const void *p, size_t *sz)
+{
+	const struct xnode	*xn = p;
+
+	*sz = MD5_DIGEST_LENGTH;
+	return (const char *)xn->sig;
+}
+
+/*
+ * Index all nodes of "map" by signature into a table whose entries are
+ * the heads of a list of nodes sharing the same signature, linked by
+ * "signext" in ascending order of identifier.
+ * This must be run after assign_sigs(), as the latter may reallocate
+ * the nodes.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+sigtab_build(struct xmap *map)
+{
+	struct xnode	*xn;
+	void		**slot;
+	size_t		 i;
+
+	map->sigtab.key = sigtab_key;
+
+	/* Walk backward so we can prepend and keep id order. */
+
+	for (i = map->maxid + 1; i > 0; i--) {
+		xn = &map->nodes[i - 1];
+		if (xn->node == NULL)
+			continue;
+		slot = htab_slot(&map->sigtab,
+			(const char *)xn->sig, MD5_DIGEST_LENGTH);
+		if (slot == NULL)
+			return 0;
+		xn->signext = *slot;
+		*slot = xn;
+	}
+
+	return 1;
+}
+
+/*
+ * Look up the nodes in "map" having signature "sig".
+ * Returns the first in the list (following "signext") or NULL.
+ */
+static struct xnode *
+sigtab_get(const struct xmap *map, const unsigned char *sig)
+{
+
+	return htab_find(&map->sigtab,
+		(const char *)sig, MD5_DIGEST_LENGTH);
+}
+
+/*
+ * Number of queued nodes in the subtree "t".
+ */
+static size_t
+pq_count(const struct pqueue *pq, size_t t)
+{
+
+	return t == PQ_NIL ? 0 : pq->nodes[t].count;
+}
+
+/*
+ * Recompute the subtree totals of "t" from its children.
+ */
+static void
+pq_update(struct pqueue *pq, size_t t)
+{
+	struct pqnode		*p = &pq->nodes[t];
+	const struct pqnode	*c;
+
+	p->count = 1;
+	p->minweight = p->weight;
+	p->maxid = p->node->id;
+
+	if (p->left != PQ_NIL) {
+		c = &pq->nodes[p->left];
+		p->count += c->count;
+		if (c->minweight < p->minweight)
+			p->minweight = c->minweight;
+		if (c->maxid > p->maxid)
+			p->maxid = c->maxid;
+	}
+	if (p->right != PQ_NIL) {
+		c = &pq->nodes[p->right];
+		p->count += c->count;
+		if (c->minweight < p->minweight)
+			p->minweight = c->minweight;
+		if (c->maxid > p->maxid)
+			p->maxid = c->maxid;
+	}
+}
+
+/*
+ * Join the subtrees "a" and "b", with all of "a" queued before "b".
+ * Returns the new subtree.
+ */
+static size_t
+pq_merge(struct pqueue *pq, size_t a, size_t b)
+{
 
-	MD5End(&ctx, xn->sig);
+	if (a == PQ_NIL)
+		return b;
+	if (b == PQ_NIL)
+		return a;
 
-	if (parent != NULL)
-		MD5Update(parent, (uint8_t *)xn->sig, 
-			MD5_DIGEST_STRING_LENGTH - 1);
+	if (pq->nodes[a].prio > pq->nodes[b].prio) {
+		pq->nodes[a].right = pq_merge(pq, pq->nodes[a].right, b);
+		pq_update(pq, a);
+		return a;
+	}
 
-	if (xn->weight > map->maxweight)
-		map->maxweight = xn->weight;
+	pq->nodes[b].left = pq_merge(pq, a, pq->nodes[b].left);
+	pq_update(pq, b);
+	return b;
+}
 
-	assert(isfinite(xn->weight));
-	assert(isnormal(xn->weight));
-	assert(xn->weight > 0.0);
-	return xn->weight;
+/*
+ * Split the subtree "t" into its first "k" nodes, "a", and the rest,
+ * "b".
+ */
+static void
+pq_split(struct pqueue *pq, size_t t, size_t k, size_t *a, size_t *b)
+{
+	size_t	 lc;
+
+	if (t == PQ_NIL) {
+		*a = *b = PQ_NIL;
+		return;
+	}
+
+	lc = pq_count(pq, pq->nodes[t].left);
+	if (k <= lc) {
+		pq_split(pq, pq->nodes[t].left, k, a, &pq->nodes[t].left);
+		*b = t;
+	} else {
+		pq_split(pq, pq->nodes[t].right, 
+			k - lc - 1, &pq->nodes[t].right, b);
+		*a = t;
+	}
+	pq_update(pq, t);
+}
+
+/*
+ * Find the position of the first queued node with a weight less than
+ * or equal to "weight", setting "at" to it.
+ * If there is none, returns the queue size and sets "at" to PQ_NIL.
+ */
+static size_t
+pq_lighter(const struct pqueue *pq, double weight, size_t *at)
+{
+	size_t	 t = pq->root, l, pos = 0;
+
+	while (t != PQ_NIL) {
+		l = pq->nodes[t].left;
+		if (l != PQ_NIL && pq->nodes[l].minweight <= weight) {
+			t = l;
+			continue;
+		}
+		pos += pq_count(pq, l);
+		if (pq->nodes[t].weight <= weight) {
+			*at = t;
+			return pos;
+		}
+		pos++;
+		t = pq->nodes[t].right;
+	}
+
+	*at = PQ_NIL;
+	return pos;
+}
+
+/*
+ * Find the position, at or after "from", of the first node in the
+ * subtree "t" (itself at position "base") with an identifier greater
+ * than "id".
+ * Returns PQ_NIL if there is none.
+ */
+static size_t
+pq_later(const struct pqueue *pq, size_t t, 
+	size_t base, size_t from, size_t id)
+{
+	size_t	 pos, rc;
+
+	if (t == PQ_NIL || pq->nodes[t].maxid <= id)
+		return PQ_NIL;
+
+	pos = base + pq_count(pq, pq->nodes[t].left);
+	if (from < pos && (rc = pq_later(pq,
+	    pq->nodes[t].left, base, from, id)) != PQ_NIL)
+		return rc;
+	if (from <= pos && pq->nodes[t].node->id > id)
+		return pos;
+	return pq_later(pq, pq->nodes[t].right, pos + 1, from, id);
 }
 
 /*
  * Enqueue "n" into a priority queue "pq".
  * Priority is given to weights; and if weights are equal, then
  * proximity to the parse root given by a pre-order identity.
- * FIXME: use a priority heap.
  * Return zero on failure, non-zero on success.
  */
 static int
 pqueue(const struct mdown_node *n, 
-	struct xmap *map, struct pnodeq *pq)
+	const struct xmap *map, struct pqueue *pq)
 {
-	struct pnode	*p, *pp;
-	struct xnode	*xnew, *xold;
-
-	if ((p = malloc(sizeof(struct pnode))) == NULL)
-		return 0;
-	p->node = n;
-
-	xnew = &map->nodes[n->id];
-	assert(xnew != NULL);
-	assert(xnew->node != NULL);
+	void		*pp;
+	struct pqnode	*p;
+	size_t		 t, at, pos, nsz, a, b;
 
-	TAILQ_FOREACH(pp, pq, entries) {
-		xold = &map->nodes[pp->node->id];
-		assert(xold->node != NULL);
-		if (xnew->weight >= xold->weight)
-			break;
-	}
+	assert(map->nodes[n->id].node != NULL);
 
-	if (pp == NULL) {
-		TAILQ_INSERT_TAIL(pq, p, entries);
-		return 1;
-	} else if (xnew->weight > xold->weight) {
-		TAILQ_INSERT_BEFORE(pp, p, entries);
-		return 1;
+	if (pq->nodesz == pq->maxsize) {
+		nsz = pq->maxsize == 0 ? 64 : pq->maxsize * 2;
+		pp = reallocarray(pq->nodes, nsz, sizeof(struct pqnode));
+		if (pp == NULL)
+			return 0;
+		pq->nodes = pp;
+		pq->maxsize = nsz;
 	}
 
-	for (; pp != NULL; pp = TAILQ_NEXT(pp, entries)) {
-		assert(p->node->id != pp->node->id);
-		if (p->node->id < pp->node->id)
-			break;
+	t = pq->nodesz++;
+	p = &pq->nodes[t];
+	p->node = n;
+	p->weight = map->nodes[n->id].weight;
+	p->left = p->right = PQ_NIL;
+	pq->seed = pq->seed * 1103515245 + 12345;
+	p->prio = pq->seed;
+	pq_update(pq, t);
+
+	pos = pq_lighter(pq, p->weight, &at);
+	if (at != PQ_NIL && !(pq->nodes[at].weight < p->weight)) {
+		assert(pq->nodes[at].weight == p->weight);
+		pos = pq_later(pq, pq->root, 0, pos, n->id);
+		if (pos == PQ_NIL)
+			pos = pq_count(pq, pq->root);
 	}
 
-	if (pp == NULL) 
-		TAILQ_INSERT_TAIL(pq, p, entries);
-	else
-		TAILQ_INSERT_BEFORE(pp, p, entries);
+	pq_split(pq, pq->root, pos, &a, &b);
+	pq->root = pq_merge(pq, pq_merge(pq, a, t), b);
 	return 1;
 }
 
+/*
+ * Dequeue the highest-priority node from "pq".
+ * Returns NULL if the queue is empty.
+ */
+static const struct mdown_node *
+pqueue_pop(struct pqueue *pq)
+{
+	size_t	 first;
+
+	if (pq->root == PQ_NIL)
+		return NULL;
+
+	pq_split(pq, pq->root, 1, &first, &pq->root);
+	assert(first != PQ_NIL);
+	return pq->nodes[first].node;
+}
+
 /*
  * Candidate optimality between "xnew" and "xold" as described in "Phase
  * 3" of sec. 5.2.
@@ -504,10 +763,10 @@ match_eq(const struct mdown_node *n1,
 	switch (n1->type) {
 	case MDOWN_LINK:
 		if (!hbuf_eq
-		    (&n1->rndr_link.link, &n2->rndr_link.link))
+		    (&n1->rndr_link->link, &n2->rndr_link->link))
 			return 0;
 		if (!hbuf_eq
-		    (&n1->rndr_link.title, &n2->rndr_link.title))
+		    (&n1->rndr_link->title, &n2->rndr_link->title))
 			return 0;
 		break;
 	case MDOWN_HEADER:
@@ -677,6 +936,36 @@ node_clone(const struct mdown_node *v, size_t id)
 	n->type = v->type;
 	n->id = id;
 
+	/* See struct mdown_node for what's allocated separately. */
+
+	switch (n->type) {
+	case MDOWN_BLOCKCODE:
+		n->rndr_blockcode =
+			calloc(1, sizeof(struct rndr_blockcode));
+		rc = n->rndr_blockcode != NULL;
+		break;
+	case MDOWN_FOOTNOTE_REF:
+		n->rndr_footnote_ref =
+			calloc(1, sizeof(struct rndr_footnote_ref));
+		rc = n->rndr_footnote_ref != NULL;
+		break;
+	case MDOWN_IMAGE:
+		n->rndr_image = calloc(1, sizeof(struct rndr_image));
+		rc = n->rndr_image != NULL;
+		break;
+	case MDOWN_LINK:
+		n->rndr_link = calloc(1, sizeof(struct rndr_link));
+		rc = n->rndr_link != NULL;
+		break;
+	default:
+		break;
+	}
+
+	if (!rc) {
+		free(n);
+		return NULL;
+	}
+
 	switch (n->type) {
 	case MDOWN_DEFINITION:
 		n->rndr_definition.flags =
@@ -714,16 +1003,16 @@ node_clone(const struct mdown_node *v, size_t id)
 			&n->rndr_raw_html.text);
 		break;
 	case MDOWN_LINK:
-		rc = hbuf_clone(&v->rndr_link.link,
-			&n->rndr_link.link) &&
-		     hbuf_clone(&v->rndr_link.title,
-			&n->rndr_link.title);
+		rc = hbuf_clone(&v->rndr_link->link,
+			&n->rndr_link->link) &&
+		     hbuf_clone(&v->rndr_link->title,
+			&n->rndr_link->title);
 		break;
 	case MDOWN_BLOCKCODE:
-		rc = hbuf_clone(&v->rndr_blockcode.text,
-			&n->rndr_blockcode.text) &&
-		     hbuf_clone(&v->rndr_blockcode.lang,
-			&n->rndr_blockcode.lang);
+		rc = hbuf_clone(&v->rndr_blockcode->text,
+			&n->rndr_blockcode->text) &&
+		     hbuf_clone(&v->rndr_blockcode->lang,
+			&n->rndr_blockcode->lang);
 		break;
 	case MDOWN_CODESPAN:
 		rc = hbuf_clone(&v->rndr_codespan.text,
@@ -753,14 +1042,14 @@ node_clone(const struct mdown_node *v, size_t id)
 			v->rndr_table_cell.columns;
 		break;
 	case MDOWN_IMAGE:
-		rc = hbuf_clone(&v->rndr_image.link,
-			&n->rndr_image.link) &&
-		     hbuf_clone(&v->rndr_image.title,
-			&n->rndr_image.title) &&
-		     hbuf_clone(&v->rndr_image.dims,
-			&n->rndr_image.dims) &&
-		     hbuf_clone(&v->rndr_image.alt,
-			&n->rndr_image.alt);
+		rc = hbuf_clone(&v->rndr_image->link,
+			&n->rndr_image->link) &&
+		     hbuf_clone(&v->rndr_image->title,
+			&n->rndr_image->title) &&
+		     hbuf_clone(&v->rndr_image->dims,
+			&n->rndr_image->dims) &&
+		     hbuf_clone(&v->rndr_image->alt,
+			&n->rndr_image->alt);
 		break;
 	case MDOWN_MATH_BLOCK:
 		n->rndr_math.blockmode = 
@@ -793,7 +1082,7 @@ node_clonetree(const struct mdown_node *v, size_t *id)
 	struct mdown_node *n, *nn;
 	const struct mdown_node *vv;
 
-	if ((n = node_clone(v, *id++)) == NULL)
+	if ((n = node_clone(v, (*id)++)) == NULL)
 		return NULL;
 
 	TAILQ_FOREACH(vv, &v->children, entries) {
@@ -1032,9 +1321,9 @@ ref_insert(struct mdown_node *nn,
 		return 0;
 	assert(nf->type == MDOWN_FOOTNOTE_REF);
 	TAILQ_INSERT_TAIL(&parms->refq, ref, entries);
-	ref->oldnum = nf->rndr_footnote_ref.num;
-	nn->rndr_footnote_ref.num = parms->refnum++;
-	ref->newnum = nn->rndr_footnote_ref.num;
+	ref->oldnum = nf->rndr_footnote_ref->num;
+	nn->rndr_footnote_ref->num = parms->refnum++;
+	ref->newnum = nn->rndr_footnote_ref->num;
 	ref->chng = nn->chng;
 	return 1;
 }
@@ -1531,26 +1820,32 @@ mdown_diff(const struct mdown_node *nold,
 {
 	struct xmap			 xoldmap, xnewmap;
 	struct xnode			*xnew, *xold;
-	struct pnodeq			 pq;
-	struct pnode			*p;
+	struct pqueue			 pq;
 	const struct mdown_node	*n, *nn;
 	struct mdown_node		*comp = NULL;
-	size_t				 i;
 	struct merger			 parms;
+	struct flat			 fold, fnew;
 
 	memset(&xoldmap, 0, sizeof(struct xmap));
 	memset(&xnewmap, 0, sizeof(struct xmap));
+	memset(&fold, 0, sizeof(struct flat));
+	memset(&fnew, 0, sizeof(struct flat));
 
-	TAILQ_INIT(&pq);
+	memset(&pq, 0, sizeof(struct pqueue));
+	pq.root = PQ_NIL;
 
 	/* 
 	 * First, assign signatures and weights.
 	 * See "Phase 2", sec 5.2.
 	 */
 
-	if (assign_sigs(NULL, &xoldmap, nold, 0) < 0.0)
+	if (!flat_new(&fold, nold) || !flat_new(&fnew, nnew))
+		goto out;
+	if (!assign_sigs(&xoldmap, &fold))
+		goto out;
+	if (!assign_sigs(&xnewmap, &fnew))
 		goto out;
-	if (assign_sigs(NULL, &xnewmap, nnew, 0) < 0.0)
+	if (!sigtab_build(&xoldmap))
 		goto out;
 
 	/* Prime the priority queue with the root. */
@@ -1564,11 +1859,7 @@ mdown_diff(const struct mdown_node *nold,
 	 * See "Phase 3", sec 5.2.
 	 */
 
-	while ((p = TAILQ_FIRST(&pq)) != NULL) {
-		TAILQ_REMOVE(&pq, p, entries);
-		n = p->node;
-		free(p);
-
+	while ((n = pqueue_pop(&pq)) != NULL) {
 		xnew = &xnewmap.nodes[n->id];
 		assert(xnew->match == NULL);
 		assert(xnew->optmatch == NULL);
@@ -1578,19 +1869,15 @@ mdown_diff(const struct mdown_node *nold,
 		 * Look for candidates: if we have a matching signature,
 		 * test for optimality.
 		 * Highest optimality gets to be matched.
+		 * Candidates are visited in order of identifier, as
+		 * candidate() breaks ties by the first-seen.
 		 * See "Phase 3", sec. 5.2.
 		 */
 
-		for (i = 0; i < xoldmap.maxid + 1; i++) {
-			xold = &xoldmap.nodes[i];
-			if (xold->node == NULL)
-				continue;
+		xold = sigtab_get(&xoldmap, xnew->sig);
+		for ( ; xold != NULL; xold = xold->signext) {
 			if (xold->match != NULL)
 				continue;
-			if (strcmp(xnew->sig, xold->sig))
-				continue;
-
-			assert(xold->match == NULL);
 			candidate(xnew, &xnewmap, xold, &xoldmap);
 		}
 
@@ -1646,16 +1933,15 @@ mdown_diff(const struct mdown_node *nold,
 	comp = node_merge(nold, nnew, &parms);
 	ref_free(&parms);
 
-	*maxn = xnewmap.maxid > xoldmap.maxid ?
-		xnewmap.maxid + 1 :
-		xoldmap.maxid + 1;
+	if (maxn != NULL)
+		*maxn = parms.id;
 
 out:
 	assert(comp != NULL);
-	while ((p = TAILQ_FIRST(&pq)) != NULL) {
-		TAILQ_REMOVE(&pq, p, entries);
-		free(p);
-	}
+	free(pq.nodes);
+	htab_free(&xoldmap.sigtab);
+	flat_free(&fold);
+	flat_free(&fnew);
 	free(xoldmap.nodes);
 	free(xnewmap.nodes);
 	return comp;
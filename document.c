@@ -25,11 +25,17 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+# define ACTIVE_SIMD 1
+# include <immintrin.h>
+#endif
 
 #include "mdown.h"
 #include "extern.h"
@@ -46,6 +52,16 @@
 			 HLIST_FL_ORDERED | \
 			 HLIST_FL_UNORDERED)
 
+/*
+ * Starting size for streamed input buffers.
+ */
+#define	HBUF_START_STREAM 4096
+
+/*
+ * Smallest chunk of text parsed on its own thread by parse_chunks().
+ */
+#define	CHUNK_MIN	(64 * 1024)
+
 /*
  * Reference to a link.
  */
@@ -66,6 +82,7 @@ TAILQ_HEAD(link_refq, link_ref);
 struct	foot_ref {
 	int			 is_used; /* if referenced */
 	size_t			 num; /* if is_used, the order */
+	size_t			 idx; /* order in foottab */
 	struct mdown_buf	 name; /* identifier */
 	struct mdown_buf	 contents; /* definition */
 	TAILQ_ENTRY(foot_ref)	 entries;
@@ -73,15 +90,137 @@ struct	foot_ref {
 
 TAILQ_HEAD(foot_refq, foot_ref);
 
+/*
+ * The last search for a closing character in an inline span: there's
+ * none between "from" and "at", which is either the character or the
+ * end of the span.
+ */
+struct	span_close {
+	const char		 *from; /* searched from (or NULL) */
+	const char		 *at; /* found at (or span end) */
+};
+
+/*
+ * Inline span being parsed by parse_inline().
+ * Each emphasis delimiter searches forward for its closer, skipping
+ * over links; without remembering where brackets close, each would
+ * search to the end of the span for an unclosed link.
+ */
+struct	emph_span {
+	const char		 *end; /* end of span */
+	struct span_close	  brack; /* next ']' */
+	struct span_close	  paren; /* next ')' */
+};
+
+/*
+ * Vector scan used by find_active_byte(), chosen for the CPU when the
+ * parser is created.
+ */
+enum	simd {
+	SIMD_NONE = 0, /* byte-wise only */
+	SIMD_SSSE3, /* 16 bytes at a time */
+	SIMD_AVX2 /* 32 bytes at a time */
+};
+
+/*
+ * A line in the line index built by line_init().
+ * Its length is up to the start of the next line; the index ends with
+ * a marker at the end of the text.
+ */
+struct	line {
+	size_t			  beg; /* offset in text */
+	unsigned short		  indent; /* leading spaces */
+	unsigned short		  probe; /* BLOCK_xxx of first byte */
+};
+
+/*
+ * State of a document being streamed in with mdown_doc_feed().
+ */
+struct	stream {
+	int			(*cb)(const struct mdown_node *,
+					void *); /* block callback */
+	void			 *arg; /* callback argument */
+	struct mdown_metaq	  mq; /* metadata if not given */
+	struct mdown_arena	 *keep; /* footnote definitions */
+	struct mdown_buf	 *raw; /* unprocessed input */
+	size_t			  scan; /* raw already scanned */
+	struct mdown_buf	 *text; /* preprocessed input */
+	struct mdown_buf	 *work; /* copy of text being parsed */
+	size_t			  next; /* text size to flush at */
+	int			  header; /* header has been parsed */
+	int			  unresolved; /* unknown reference seen */
+};
+
+/*
+ * A footnote first referenced from a chunk: see chunk_use_foot_ref().
+ */
+struct	chunk_foot {
+	struct foot_ref		 *ref; /* footnote definition */
+	struct mdown_node	 *n; /* MDOWN_FOOTNOTE_REF */
+	struct mdown_buf	  text; /* source of the reference */
+};
+
+/*
+ * Text overwritten by a chunk's parser: see chunk_save().
+ */
+struct	chunk_save {
+	char			 *at; /* start in document text */
+	size_t			  size; /* bytes overwritten */
+};
+
+/*
+ * A run of top-level blocks parsed on its own by parse_chunks().
+ * Its parser is a copy of the document's, sharing the text, line
+ * index and reference tables, but with its own nodes and footnote
+ * numbering, which are fitted into the document's afterward.
+ */
+struct	chunk {
+	struct mdown_doc	 *doc; /* parser (or NULL) */
+	char			 *data; /* start in document text */
+	size_t			  size; /* size of text */
+	struct mdown_node	 *root; /* parsed blocks (or NULL) */
+	struct chunk_save	 *saves; /* text overwritten, in order */
+	size_t			  savesz; /* entries in saves */
+	size_t			  savemax; /* allocated saves */
+	struct mdown_buf	 *saved; /* bytes overwritten (or NULL) */
+	struct chunk_foot	 *foots; /* footnotes used, in order */
+	size_t			  footsz; /* entries in foots */
+	size_t			  footmax; /* allocated foots */
+	unsigned char		 *footused; /* used by foot_ref idx */
+	int			  unsettled; /* may run past its end */
+	int			  rc; /* parsed successfully */
+};
+
+/*
+ * Chunks shared by the threads of parse_chunks().
+ */
+struct	chunkq {
+	pthread_mutex_t		  mutex; /* protects "next" */
+	const struct mdown_doc	 *doc; /* document being parsed */
+	struct chunk		 *chunks; /* chunks in text order */
+	size_t			  chunksz; /* number of chunks */
+	size_t			  next; /* next chunk to parse */
+};
+
 struct 	mdown_doc {
 	struct link_refq	  refq; /* all internal references */
+	struct htab		  reftab; /* refq by name */
 	struct foot_refq	  footq; /* all footnotes */
+	struct htab		  foottab; /* footq by name */
+	struct foot_ref		**footv; /* used footnotes by number */
+	size_t			  footvmax; /* allocated footv */
 	size_t			  foots; /* # of used footnotes */
 	int			  active_char[256]; /* jump table */
+	unsigned char		  active_lo[16]; /* low nibble classes */
+	unsigned char		  active_hi[16]; /* high nibble classes */
+	enum simd		  simd; /* vector scan to use */
 	unsigned int		  ext_flags; /* options */
 	size_t			  cur_par; /* XXX: not used */
 	int			  in_link_body; /* parsing link body */
 	size_t			  nodes; /* number of nodes */
+	struct mdown_arena	 *arena; /* node allocator */
+	const char		 *src; /* text owned by arena (or NULL) */
+	size_t			  srcsz; /* size of src */
 	struct mdown_node	 *current; /* current node */
 	struct mdown_metaq	 *metaq; /* raw metadata key/values */
 	size_t			  depth; /* current parse tree depth */
@@ -90,6 +229,16 @@ struct 	mdown_doc {
 	size_t			  metasz; /* size of meta */
 	char			**metaovr; /* override metadata */
 	size_t			  metaovrsz; /* size of metaovr */
+	struct stream		 *stream; /* streaming (or NULL) */
+	struct emph_span	 *emph; /* current inline span */
+	struct mdown_node	 *smarty; /* last top-level smartied */
+	struct line		 *lines; /* line index of src */
+	size_t			  linesz; /* lines in index */
+	size_t			  linemax; /* allocated lines */
+	size_t			  linecur; /* last line looked up */
+	const char		 *lineok; /* index valid from here */
+	size_t			  jobs; /* parser threads (if >1) */
+	struct chunk		 *chunk; /* chunk being parsed (or NULL) */
 };
 
 /*
@@ -153,6 +302,9 @@ static const char_trigger markdown_char_ptrs[] = {
 static int
 parse_block(struct mdown_doc *, char *, size_t);
 
+static void
+stream_free(struct mdown_doc *);
+
 static ssize_t
 parse_listitem(struct mdown_buf *, struct mdown_doc *,
 	char *, size_t, enum hlist_fl *, size_t);
@@ -170,10 +322,43 @@ pushnode(struct mdown_doc *doc, enum mdown_rndrt t)
 
 	if ((doc->depth++ > doc->maxdepth) && doc->maxdepth)
 		return NULL;
-	if ((n = calloc(1, sizeof(struct mdown_node))) == NULL)
+	n = arena_calloc(doc->arena, 1, sizeof(struct mdown_node));
+	if (n == NULL)
 		return NULL;
 
+	/* See struct mdown_node for what's allocated separately. */
+
+	switch (t) {
+	case MDOWN_BLOCKCODE:
+		n->rndr_blockcode = arena_calloc(doc->arena, 1,
+			sizeof(struct rndr_blockcode));
+		if (n->rndr_blockcode == NULL)
+			return NULL;
+		break;
+	case MDOWN_FOOTNOTE_REF:
+		n->rndr_footnote_ref = arena_calloc(doc->arena, 1,
+			sizeof(struct rndr_footnote_ref));
+		if (n->rndr_footnote_ref == NULL)
+			return NULL;
+		break;
+	case MDOWN_IMAGE:
+		n->rndr_image = arena_calloc(doc->arena, 1,
+			sizeof(struct rndr_image));
+		if (n->rndr_image == NULL)
+			return NULL;
+		break;
+	case MDOWN_LINK:
+		n->rndr_link = arena_calloc(doc->arena, 1,
+			sizeof(struct rndr_link));
+		if (n->rndr_link == NULL)
+			return NULL;
+		break;
+	default:
+		break;
+	}
+
 	n->id = doc->nodes++;
+	n->arena = doc->arena;
 	n->type = t;
 	n->parent = doc->current;
 	TAILQ_INIT(&n->children);
@@ -186,30 +371,59 @@ pushnode(struct mdown_doc *doc, enum mdown_rndrt t)
 /*
  * Pushes the contents of "data" of size "datasz" into the buffer.
  * Any existing data in the buffer is lost.
+ * If "data" lies within the preprocessed document text, which lives as
+ * long as the tree, the buffer simply references it; otherwise, the
+ * data is copied into the parse arena.
+ * Either way, the buffer is marked read-only (zero unit) and must not
+ * be grown or freed.
  * Return zero on failure (memory), non-zero on success.
  */
 static int
-pushbuf(struct mdown_buf *buf, const char *data, size_t datasz)
+pushbuf(struct mdown_doc *doc, struct mdown_buf *buf,
+	const char *data, size_t datasz)
 {
 
 	assert(buf->size == 0);
 	assert(buf->data == NULL);
 	memset(buf, 0, sizeof(struct mdown_buf));
-	if (datasz) {
-		if ((buf->data = malloc(datasz)) == NULL)
+	if (datasz && doc->src != NULL && data >= doc->src &&
+	    data + datasz <= doc->src + doc->srcsz) {
+		buf->data = (char *)data;
+		buf->size = datasz;
+	} else if (datasz) {
+		buf->data = arena_calloc(doc->arena, 1, datasz);
+		if (buf->data == NULL)
 			return 0;
-		buf->unit = 1;
-		buf->size = buf->maxsize = datasz;
+		buf->size = datasz;
 		memcpy(buf->data, data, datasz);
 	}
 	return 1;
 }
 
 static int
-pushlbuf(struct mdown_buf *buf, const struct mdown_buf *nbuf)
+pushlbuf(struct mdown_doc *doc, struct mdown_buf *buf,
+	const struct mdown_buf *nbuf)
+{
+
+	return pushbuf(doc, buf, nbuf->data, nbuf->size);
+}
+
+/*
+ * Finish the text node "n" (if not NULL) from parse_inline(), whose text
+ * has so far referenced the input so that it could be extended.
+ * See pushbuf().
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+pushtext(struct mdown_doc *doc, struct mdown_node *n)
 {
+	struct mdown_buf	 b;
 
-	return pushbuf(buf, nbuf->data, nbuf->size);
+	if (n == NULL)
+		return 1;
+	b = n->rndr_normal_text.text;
+	memset(&n->rndr_normal_text.text, 0, sizeof(struct mdown_buf));
+	return pushbuf(doc, &n->rndr_normal_text.text, b.data, b.size);
 }
 
 /*
@@ -251,47 +465,247 @@ unscape_text(struct mdown_buf *ob, struct mdown_buf *src)
 	return 1;
 }
 
+/*
+ * The name of the link reference "p" (empty if it has none) for its
+ * table: see htab_slot().
+ */
+static const char *
+link_ref_key(const void *p, size_t *sz)
+{
+	const struct link_ref	*ref = p;
+
+	if (ref->name == NULL) {
+		*sz = 0;
+		return NULL;
+	}
+	*sz = ref->name->size;
+	return ref->name->data;
+}
+
+/*
+ * Look up the link reference by name, which is case sensitive.
+ * Returns NULL if not found.
+ */
 static struct link_ref *
-find_link_ref(struct link_refq *q, char *name, size_t length)
+find_link_ref(const struct mdown_doc *doc, const char *name,
+	size_t length)
 {
-	struct link_ref	*ref;
 
-	TAILQ_FOREACH(ref, q, entries)
-		if ((ref->name == NULL && length == 0) ||
-		    (ref->name != NULL &&
-		     ref->name->size == length &&
-		     memcmp(ref->name->data, name, length) == 0))
-			return ref;
+	return htab_find(&doc->reftab, name, length);
+}
 
-	return NULL;
+/*
+ * Index the link reference, which must already be on the queue, by
+ * name in the link reference table.
+ * If there's already a reference by that name, it's kept: the first
+ * definition wins.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+add_link_ref(struct mdown_doc *doc, struct link_ref *ref)
+{
+	void		**slot;
+	const char	 *name;
+	size_t		  length;
+
+	name = link_ref_key(ref, &length);
+	if ((slot = htab_slot(&doc->reftab, name, length)) == NULL)
+		return 0;
+	if (*slot == NULL)
+		*slot = ref;
+	return 1;
 }
 
 static void
-free_link_refs(struct link_refq *q)
+free_link_refs(struct mdown_doc *doc)
 {
 	struct link_ref	*r;
 
-	while ((r = TAILQ_FIRST(q)) != NULL) {
-		TAILQ_REMOVE(q, r, entries);
+	while ((r = TAILQ_FIRST(&doc->refq)) != NULL) {
+		TAILQ_REMOVE(&doc->refq, r, entries);
 		hbuf_free(r->link);
 		hbuf_free(r->name);
 		hbuf_free(r->title);
 		hbuf_free(r->attrs);
 		free(r);
 	}
+
+	htab_free(&doc->reftab);
+}
+
+/*
+ * The name of the footnote definition "p" for its table: see
+ * htab_slot().
+ */
+static const char *
+foot_ref_key(const void *p, size_t *sz)
+{
+	const struct foot_ref	*ref = p;
+
+	*sz = ref->name.size;
+	return ref->name.data;
+}
+
+/*
+ * Look up the footnote definition by name, which is case sensitive.
+ * Returns NULL if not found.
+ */
+static struct foot_ref *
+find_foot_ref(const struct mdown_doc *doc, const char *name,
+	size_t length)
+{
+
+	return htab_find(&doc->foottab, name, length);
+}
+
+/*
+ * Index the footnote definition, which must already be on the queue,
+ * by name in the footnote table.
+ * If there's already a definition by that name, it's kept: only the
+ * first definition is ever used.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+add_foot_ref(struct mdown_doc *doc, struct foot_ref *ref)
+{
+	void	**slot;
+
+	slot = htab_slot(&doc->foottab, ref->name.data, ref->name.size);
+	if (slot == NULL)
+		return 0;
+	if (*slot == NULL) {
+		ref->idx = doc->foottab.count - 1;
+		*slot = ref;
+	}
+	return 1;
+}
+
+/*
+ * Mark the footnote definition as used, giving it the next number.
+ * Used footnotes are kept in order of their numbers in "footv".
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+use_foot_ref(struct mdown_doc *doc, struct foot_ref *ref)
+{
+	void	*pp;
+	size_t	 max;
+
+	assert(!ref->is_used);
+	if (doc->foots == doc->footvmax) {
+		max = doc->footvmax == 0 ? 32 : doc->footvmax * 2;
+		pp = reallocarray(doc->footv, max,
+			sizeof(struct foot_ref *));
+		if (pp == NULL)
+			return 0;
+		doc->footv = pp;
+		doc->footvmax = max;
+	}
+
+	doc->footv[doc->foots] = ref;
+	ref->num = ++doc->foots;
+	ref->is_used = 1;
+	return 1;
+}
+
+/*
+ * Like use_foot_ref(), but within a chunk being parsed on its own (see
+ * parse_chunks()): the footnote is only marked used in the chunk.
+ * It's numbered when the chunk is fitted into the document, so the
+ * reference "n" and its source "data" of size "size" are kept.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+chunk_use_foot_ref(struct mdown_doc *doc, struct foot_ref *ref,
+	struct mdown_node *n, const char *data, size_t size)
+{
+	struct chunk		*c = doc->chunk;
+	struct chunk_foot	*f;
+	void			*pp;
+	size_t			 max;
+
+	assert(!c->footused[ref->idx]);
+	if (c->footsz == c->footmax) {
+		max = c->footmax == 0 ? 32 : c->footmax * 2;
+		pp = reallocarray(c->foots, max,
+			sizeof(struct chunk_foot));
+		if (pp == NULL)
+			return 0;
+		c->foots = pp;
+		c->footmax = max;
+	}
+
+	f = &c->foots[c->footsz];
+	memset(f, 0, sizeof(struct chunk_foot));
+	if (!pushbuf(doc, &f->text, data, size))
+		return 0;
+	f->ref = ref;
+	f->n = n;
+	c->footsz++;
+	c->footused[ref->idx] = 1;
+	return 1;
+}
+
+/*
+ * Within a chunk being parsed on its own (see parse_chunks()), keep the
+ * "size" bytes at "at" before the parser overwrites them, so that the
+ * text can be restored if it must be parsed again: see chunk_restore().
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+chunk_save(struct mdown_doc *doc, char *at, size_t size)
+{
+	struct chunk		*c = doc->chunk;
+	void			*pp;
+	size_t			 max;
+
+	if (c->saved == NULL && (c->saved = hbuf_new(1024)) == NULL)
+		return 0;
+	if (c->savesz == c->savemax) {
+		max = c->savemax == 0 ? 32 : c->savemax * 2;
+		pp = reallocarray(c->saves, max,
+			sizeof(struct chunk_save));
+		if (pp == NULL)
+			return 0;
+		c->saves = pp;
+		c->savemax = max;
+	}
+	if (!hbuf_put(c->saved, at, size))
+		return 0;
+	c->saves[c->savesz].at = at;
+	c->saves[c->savesz].size = size;
+	c->savesz++;
+	return 1;
+}
+
+/*
+ * Whether the footnote definition has been referenced.
+ */
+static int
+foot_ref_used(const struct mdown_doc *doc, const struct foot_ref *ref)
+{
+
+	if (doc->chunk != NULL)
+		return doc->chunk->footused[ref->idx];
+	return ref->is_used;
 }
 
 static void
-free_foot_refq(struct foot_refq *q)
+free_foot_refq(struct mdown_doc *doc)
 {
 	struct foot_ref	*ref;
 
-	while ((ref = TAILQ_FIRST(q)) != NULL) {
-		TAILQ_REMOVE(q, ref, entries);
-		hbuf_free(&ref->contents);
-		hbuf_free(&ref->name);
+	/* Names and contents are in the parse arena. */
+
+	while ((ref = TAILQ_FIRST(&doc->footq)) != NULL) {
+		TAILQ_REMOVE(&doc->footq, ref, entries);
 		free(ref);
 	}
+
+	htab_free(&doc->foottab);
+	free(doc->footv);
+	doc->footv = NULL;
+	doc->footvmax = 0;
 }
 
 /*
@@ -491,6 +905,205 @@ tag_length(const char *data, size_t size, enum halink_type *ltype)
 	return i + 1;
 }
 
+#if ACTIVE_SIMD
+/*
+ * The vector scans of find_active_byte().
+ * Plain text makes up most of any document, so we check 16 or 32
+ * bytes at a time by looking up each byte's low and high nibbles in
+ * the tables built by active_init(): the byte is active if the two
+ * have a bit in common.
+ * The autolink bytes 'w' and ':' are common in prose and aren't in
+ * those tables: instead, we look for "www." and "://" by comparing
+ * against the vector shifted by one, two, and three bytes.
+ * These are compiled for their instruction sets whatever the build
+ * flags, and only called if the CPU has them (see mdown_doc_new()).
+ * Each returns the offset of the first active byte or where it left
+ * off, which is within the last vector's width of "size".
+ */
+__attribute__((target("avx2")))
+static size_t
+find_active_avx2(const struct mdown_doc *doc, const char *data,
+	size_t size)
+{
+	size_t		 i = 0;
+	int		 al = doc->ext_flags & MDOWN_AUTOLINK;
+	__m256i		 lo, hi, nib, v, v1, v2, v3, m;
+	unsigned int	 mask;
+
+	if (size < sizeof(__m256i) + 3)
+		return 0;
+
+	lo = _mm256_broadcastsi128_si256(_mm_loadu_si128
+		((const __m128i *)doc->active_lo));
+	hi = _mm256_broadcastsi128_si256(_mm_loadu_si128
+		((const __m128i *)doc->active_hi));
+	nib = _mm256_set1_epi8(0x0f);
+	for ( ; i + sizeof(__m256i) + 3 <= size; i += sizeof(__m256i)) {
+		v = _mm256_loadu_si256((const __m256i *)(data + i));
+		m = _mm256_and_si256
+			(_mm256_shuffle_epi8(lo,
+			  _mm256_and_si256(v, nib)),
+			 _mm256_shuffle_epi8(hi,
+			  _mm256_and_si256
+			  (_mm256_srli_epi16(v, 4), nib)));
+		if (al) {
+			v1 = _mm256_loadu_si256
+				((const __m256i *)(data + i + 1));
+			v2 = _mm256_loadu_si256
+				((const __m256i *)(data + i + 2));
+			v3 = _mm256_loadu_si256
+				((const __m256i *)(data + i + 3));
+			m = _mm256_or_si256(m, _mm256_and_si256
+			    (_mm256_and_si256
+			     (_mm256_cmpeq_epi8(v,
+			       _mm256_set1_epi8('w')),
+			      _mm256_cmpeq_epi8(v1,
+			       _mm256_set1_epi8('w'))),
+			     _mm256_and_si256
+			     (_mm256_cmpeq_epi8(v2,
+			       _mm256_set1_epi8('w')),
+			      _mm256_cmpeq_epi8(v3,
+			       _mm256_set1_epi8('.')))));
+			m = _mm256_or_si256(m, _mm256_and_si256
+			    (_mm256_cmpeq_epi8(v,
+			      _mm256_set1_epi8(':')),
+			     _mm256_and_si256
+			     (_mm256_cmpeq_epi8(v1,
+			       _mm256_set1_epi8('/')),
+			      _mm256_cmpeq_epi8(v2,
+			       _mm256_set1_epi8('/')))));
+		}
+		mask = ~(unsigned int)_mm256_movemask_epi8
+			(_mm256_cmpeq_epi8(m, _mm256_setzero_si256()));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+
+__attribute__((target("ssse3")))
+static size_t
+find_active_ssse3(const struct mdown_doc *doc, const char *data,
+	size_t size)
+{
+	size_t		 i = 0;
+	int		 al = doc->ext_flags & MDOWN_AUTOLINK;
+	__m128i		 lo, hi, nib, v, v1, v2, v3, m;
+	unsigned int	 mask;
+
+	if (size < sizeof(__m128i) + 3)
+		return 0;
+
+	lo = _mm_loadu_si128((const __m128i *)doc->active_lo);
+	hi = _mm_loadu_si128((const __m128i *)doc->active_hi);
+	nib = _mm_set1_epi8(0x0f);
+	for ( ; i + sizeof(__m128i) + 3 <= size; i += sizeof(__m128i)) {
+		v = _mm_loadu_si128((const __m128i *)(data + i));
+		m = _mm_and_si128
+			(_mm_shuffle_epi8(lo, _mm_and_si128(v, nib)),
+			 _mm_shuffle_epi8(hi, _mm_and_si128
+			  (_mm_srli_epi16(v, 4), nib)));
+		if (al) {
+			v1 = _mm_loadu_si128
+				((const __m128i *)(data + i + 1));
+			v2 = _mm_loadu_si128
+				((const __m128i *)(data + i + 2));
+			v3 = _mm_loadu_si128
+				((const __m128i *)(data + i + 3));
+			m = _mm_or_si128(m, _mm_and_si128
+			    (_mm_and_si128
+			     (_mm_cmpeq_epi8(v, _mm_set1_epi8('w')),
+			      _mm_cmpeq_epi8(v1, _mm_set1_epi8('w'))),
+			     _mm_and_si128
+			     (_mm_cmpeq_epi8(v2, _mm_set1_epi8('w')),
+			      _mm_cmpeq_epi8(v3, _mm_set1_epi8('.')))));
+			m = _mm_or_si128(m, _mm_and_si128
+			    (_mm_cmpeq_epi8(v, _mm_set1_epi8(':')),
+			     _mm_and_si128
+			     (_mm_cmpeq_epi8(v1, _mm_set1_epi8('/')),
+			      _mm_cmpeq_epi8(v2, _mm_set1_epi8('/')))));
+		}
+		mask = 0xffff & ~(unsigned int)_mm_movemask_epi8
+			(_mm_cmpeq_epi8(m, _mm_setzero_si128()));
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+	return i;
+}
+#endif
+
+/*
+ * Returns the offset of the first byte in "data" that's in the
+ * document's active_char table, or "size" if there are none.
+ * This uses the vector scans if the CPU has them, with the byte-wise
+ * loop finishing up.
+ * (Plain SSE2 has no byte shuffle, and comparing against each active
+ * byte in turn is no faster than the byte-wise loop.)
+ */
+static size_t
+find_active_byte(const struct mdown_doc *doc, const char *data,
+	size_t size)
+{
+	size_t		 i = 0;
+
+#if ACTIVE_SIMD
+	if (doc->simd == SIMD_AVX2)
+		i = find_active_avx2(doc, data, size);
+	else if (doc->simd == SIMD_SSSE3)
+		i = find_active_ssse3(doc, data, size);
+#endif
+	while (i < size &&
+	       doc->active_char[(unsigned char)data[i]] == 0)
+		i++;
+	return i;
+}
+
+/*
+ * Like find_active_byte(), but passing over the autolink bytes 'w',
+ * ':', and '@' where the checks at the start of halink_www(),
+ * halink_url(), and halink_email() would fail anyway: these mostly
+ * occur in ordinary words, and calling into the autolink parsers
+ * allocates.
+ * Skipping is the same as the callback doing nothing.
+ * The byte before "data" isn't ours to look at, so the word boundary
+ * test is only made from the second byte on.
+ */
+static size_t
+find_active_char(const struct mdown_doc *doc, const char *data,
+	size_t size)
+{
+	size_t		 i = 0;
+	unsigned char	 c;
+
+	for ( ; (i += find_active_byte(doc,
+	     data + i, size - i)) < size; i++) {
+		c = i > 0 ? data[i - 1] : '\0';
+		switch (doc->active_char[(unsigned char)data[i]]) {
+		case MD_CHAR_AUTOLINK_WWW:
+			if (size - i < 4 ||
+			    memcmp(data + i, "www.", 4) != 0)
+				continue;
+			if (i > 0 && !ispunct(c) && !isspace(c))
+				continue;
+			break;
+		case MD_CHAR_AUTOLINK_URL:
+			if (size - i < 4 ||
+			    data[i + 1] != '/' || data[i + 2] != '/')
+				continue;
+			break;
+		case MD_CHAR_AUTOLINK_EMAIL:
+			if (i > 0 && !isalnum(c) &&
+			    strchr(".+-_", c) == NULL)
+				continue;
+			break;
+		default:
+			break;
+		}
+		break;
+	}
+	return i;
+}
+
 /*
  * Parses inline markdown elements.
  * This function is important because it handles raw input that we pass
@@ -504,27 +1117,40 @@ parse_inline(struct mdown_doc *doc, char *data, size_t size)
 	ssize_t			 rc;
 	struct mdown_buf	 work;
 	const int		*active_char = doc->active_char;
-	struct mdown_node 	*n;
+	struct mdown_node 	*text = NULL;
+	struct emph_span	 emph, *oemph = doc->emph;
+	int			 ret = 0;
 
 	memset(&work, 0, sizeof(struct mdown_buf));
+	memset(&emph, 0, sizeof(struct emph_span));
+	emph.end = data + size;
+	doc->emph = &emph;
 	
 	while (i < size) {
 		/* Copying non-macro chars into the output. */
 
-		while (end < size &&
-		       active_char[(unsigned char)data[end]] == 0)
-			end++;
+		end += find_active_char(doc, data + end, size - end);
 
-		/* Only allocate if non-empty... */
+		/*
+		 * Only allocate if non-empty, and extend the last text
+		 * node instead if it runs up to here, which is the case
+		 * if the active character did nothing.
+		 */
 
-		if (end - i > 0) {
-			n = pushnode(doc, MDOWN_NORMAL_TEXT);
-			if (n == NULL)
-				return 0;
-			if (!pushbuf(&n->rndr_normal_text.text,
-			    data + i, end - i))
-				return 0;
-			popnode(doc, n);
+		if (end - i > 0 && text != NULL &&
+		    text == TAILQ_LAST(&doc->current->children,
+		     mdown_nodeq) &&
+		    text->rndr_normal_text.text.data +
+		    text->rndr_normal_text.text.size == data + i) {
+			text->rndr_normal_text.text.size += end - i;
+		} else if (end - i > 0) {
+			if (!pushtext(doc, text))
+				goto out;
+			if ((text = pushnode(doc, MDOWN_NORMAL_TEXT)) == NULL)
+				goto out;
+			text->rndr_normal_text.text.data = data + i;
+			text->rndr_normal_text.text.size = end - i;
+			popnode(doc, text);
 		}
 
 		/* End of file? */
@@ -537,7 +1163,7 @@ parse_inline(struct mdown_doc *doc, char *data, size_t size)
 			active_char[(unsigned char)data[end]]]
 			(doc, data + i, i - consumed, size - i);
 		if (rc < 0)
-			return 0;
+			goto out;
 		end = rc;
 
 		/* Check if no action from the callback. */
@@ -551,7 +1177,10 @@ parse_inline(struct mdown_doc *doc, char *data, size_t size)
 		end = consumed = i;
 	}
 
-	return 1;
+	ret = pushtext(doc, text);
+out:
+	doc->emph = oemph;
+	return ret;
 }
 
 /*
@@ -570,14 +1199,44 @@ is_escaped(const char *data, size_t loc)
 	return (loc - i) % 2;
 }
 
+/*
+ * Returns the offset of the first "c" (']' or ')') in "data", or "size"
+ * if there's none.
+ * If "sp" is not NULL and "data" ends with its span, this uses and
+ * updates the last search for "c" in the span.
+ */
+static size_t
+find_close(struct emph_span *sp, const char *data, size_t size, char c)
+{
+	struct span_close	*cl;
+	const char		*p;
+
+	if (sp == NULL || data + size != sp->end) {
+		p = memchr(data, c, size);
+		return p == NULL ? size : (size_t)(p - data);
+	}
+
+	cl = c == ']' ? &sp->brack : &sp->paren;
+	if (cl->from != NULL && data >= cl->from && data <= cl->at)
+		return cl->at - data;
+
+	p = memchr(data, c, size);
+	cl->from = data;
+	cl->at = p == NULL ? data + size : p;
+	return cl->at - data;
+}
+
 /*
  * Looks for the next emph char, skipping other constructs.
+ * If "sp" is not NULL, it's used to find where skipped links close.
  */
 static size_t
-find_emph_char(const char *data, size_t size, char c)
+find_emph_char(const char *data, size_t size, char c,
+	struct emph_span *sp)
 {
-	size_t 	 i = 0, span_nb, bt, tmp_i;
-	char 	 cc;
+	size_t 		 i = 0, span_nb, bt, tmp_i, end;
+	char 		 cc;
+	const char	*p;
 
 	while (i < size) {
 		while (i < size && data[i] != c &&
@@ -639,13 +1298,10 @@ find_emph_char(const char *data, size_t size, char c)
 			/* Skipping a link. */
 
 			i++;
-			while (i < size && data[i] != ']') {
-				if (!tmp_i && data[i] == c)
-					tmp_i = i;
-				i++;
-			}
-
-			i++;
+			end = i + find_close(sp, data + i, size - i, ']');
+			if ((p = memchr(data + i, c, end - i)) != NULL)
+				tmp_i = p - data;
+			i = end + 1;
 			while (i < size && xisspace(data[i]))
 				i++;
 
@@ -667,11 +1323,11 @@ find_emph_char(const char *data, size_t size, char c)
 			}
 
 			i++;
-			while (i < size && data[i] != cc) {
-				if (!tmp_i && data[i] == c)
-					tmp_i = i;
-				i++;
-			}
+			end = i + find_close(sp, data + i, size - i, cc);
+			if (!tmp_i &&
+			    (p = memchr(data + i, c, end - i)) != NULL)
+				tmp_i = p - data;
+			i = end;
 
 			if (i >= size)
 				return tmp_i;
@@ -701,7 +1357,8 @@ parse_emph1(struct mdown_doc *doc, char *data, size_t size, char c)
 		i = 1;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(data + i, size - i, c,
+			doc->emph);
 		if (!len)
 			return 0;
 		i += len;
@@ -739,7 +1396,8 @@ parse_emph2(struct mdown_doc *doc, char *data, size_t size, char c)
 	enum mdown_rndrt	 t;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(data + i, size - i, c,
+			doc->emph);
 		if (len == 0)
 			return 0;
 		i += len;
@@ -780,7 +1438,8 @@ parse_emph3(struct mdown_doc *doc, char *data, size_t size, char c)
 	struct mdown_node	*n;
 
 	while (i < size) {
-		len = find_emph_char(data + i, size - i, c);
+		len = find_emph_char(data + i, size - i, c,
+			doc->emph);
 		if (len == 0)
 			return 0;
 		i += len;
@@ -851,7 +1510,7 @@ parse_math(struct mdown_doc *doc, char *data, size_t offset,
 		n = pushnode(doc, MDOWN_NORMAL_TEXT);
 		if (n == NULL)
 			return -1;
-		if (!pushbuf(&n->rndr_normal_text.text, data, i))
+		if (!pushbuf(doc, &n->rndr_normal_text.text, data, i))
 			return -1;
 		popnode(doc, n);
 		return i;
@@ -860,7 +1519,7 @@ parse_math(struct mdown_doc *doc, char *data, size_t offset,
 	n = pushnode(doc, MDOWN_MATH_BLOCK);
 	if (n == NULL)
 		return -1;
-  	if (!pushbuf(&n->rndr_math.text,
+  	if (!pushbuf(doc, &n->rndr_math.text,
 	    data + delimsz, i - 2 * delimsz))
 		return -1;
 	n->rndr_math.blockmode = blockmode;
@@ -1003,7 +1662,7 @@ char_codespan(struct mdown_doc *doc,
 	if (f_begin < f_end) {
 		work.data = data + f_begin;
 		work.size = f_end - f_begin;
-		if (!pushlbuf(&n->rndr_codespan.text, &work))
+		if (!pushlbuf(doc, &n->rndr_codespan.text, &work))
 			return -1;
 	}
 
@@ -1059,13 +1718,13 @@ char_escape(struct mdown_doc *doc,
 			return 0;
 		if ((n = pushnode(doc, MDOWN_NORMAL_TEXT)) == NULL)
 			return -1;
-		if (!pushbuf(&n->rndr_normal_text.text, data + 1, 1))
+		if (!pushbuf(doc, &n->rndr_normal_text.text, data + 1, 1))
 			return -1;
 		popnode(doc, n);
 	} else if (size == 1) {
 		if ((n = pushnode(doc, MDOWN_NORMAL_TEXT)) == NULL)
 			return -1;
-		if (!pushbuf(&n->rndr_normal_text.text, data, 1))
+		if (!pushbuf(doc, &n->rndr_normal_text.text, data, 1))
 			return -1;
 		popnode(doc, n);
 	}
@@ -1097,7 +1756,7 @@ char_entity(struct mdown_doc *doc,
 
 	if ((n = pushnode(doc, MDOWN_ENTITY)) == NULL)
 		return -1;
-	if (!pushbuf(&n->rndr_entity.text, data, end))
+	if (!pushbuf(doc, &n->rndr_entity.text, data, end))
 		return -1;
 	popnode(doc, n);
 	return end;
@@ -1135,14 +1794,14 @@ char_langle_tag(struct mdown_doc *doc,
 			if (n == NULL)
 				goto err;
 			n->rndr_autolink.type = altype;
-			if (!pushlbuf(&n->rndr_autolink.link, u_link))
+			if (!pushlbuf(doc, &n->rndr_autolink.link, u_link))
 				goto err;
 			popnode(doc, n);
 		} else {
 			n = pushnode(doc, MDOWN_RAW_HTML);
 			if (n == NULL)
 				goto err;
-			if (!pushbuf(&n->rndr_raw_html.text, data, end))
+			if (!pushbuf(doc, &n->rndr_raw_html.text, data, end))
 				goto err;
 			popnode(doc, n);
 		}
@@ -1198,7 +1857,7 @@ char_autolink_www(struct mdown_doc *doc,
 		if ((n = pushnode(doc, MDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_NORMAL;
-		if (!pushlbuf(&n->rndr_autolink.link, link_url))
+		if (!pushlbuf(doc, &n->rndr_autolink.link, link_url))
 			goto err;
 		popnode(doc, n);
 	}
@@ -1247,7 +1906,7 @@ char_autolink_email(struct mdown_doc *doc,
 		if ((n = pushnode(doc, MDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_EMAIL;
-		if (!pushlbuf(&n->rndr_autolink.link, link))
+		if (!pushlbuf(doc, &n->rndr_autolink.link, link))
 			goto err;
 		popnode(doc, n);
 	}
@@ -1294,7 +1953,7 @@ char_autolink_url(struct mdown_doc *doc,
 		if ((n = pushnode(doc, MDOWN_LINK_AUTO)) == NULL)
 			goto err;
 		n->rndr_autolink.type = HALINK_NORMAL;
-		if (!pushlbuf(&n->rndr_autolink.link, link))
+		if (!pushlbuf(doc, &n->rndr_autolink.link, link))
 			goto err;
 		popnode(doc, n);
 	}
@@ -1428,7 +2087,7 @@ char_link(struct mdown_doc *doc,
 
 	/* Looking for the matching closing bracket. */
 
-	i += find_emph_char(data + i, size - i, ']');
+	i += find_emph_char(data + i, size - i, ']', NULL);
 	txt_e = i;
 
 	if (i < size && data[i] == ']')
@@ -1445,7 +2104,7 @@ char_link(struct mdown_doc *doc,
 		n = pushnode(doc, MDOWN_NORMAL_TEXT);
 		if (n == NULL)
 			goto err;
-		if (!pushbuf(&n->rndr_normal_text.text, &data[-1], 1))
+		if (!pushbuf(doc, &n->rndr_normal_text.text, &data[-1], 1))
 			goto err;
 		popnode(doc, n);
 	}
@@ -1463,9 +2122,9 @@ char_link(struct mdown_doc *doc,
 		id.data = data + 2;
 		id.size = txt_e - 2;
 
-		TAILQ_FOREACH(fr, &doc->footq, entries)
-			if (hbuf_eq(&fr->name, &id))
-				break;
+		fr = find_foot_ref(doc, id.data, id.size);
+		if (fr == NULL && doc->stream != NULL)
+			doc->stream->unresolved = 1;
 
 		/*
 		 * Mark footnote used.
@@ -1476,31 +2135,37 @@ char_link(struct mdown_doc *doc,
 		 * reference per definition.  This is stupid.
 		 */
 
-		if (fr != NULL && !fr->is_used) {
+		if (fr != NULL && !foot_ref_used(doc, fr)) {
 			n = pushnode(doc, MDOWN_FOOTNOTE_REF);
 			if (n == NULL)
 				goto err;
-			fr->num = ++doc->foots;
-			fr->is_used = 1;
-			n->rndr_footnote_ref.num = fr->num;
+			if (doc->chunk != NULL) {
+				if (!chunk_use_foot_ref(doc,
+				    fr, n, data, txt_e + 1))
+					goto err;
+			} else {
+				if (!use_foot_ref(doc, fr))
+					goto err;
+				n->rndr_footnote_ref->num = fr->num;
+			}
 			if (!pushlbuf
-			    (&n->rndr_footnote_ref.key, &fr->name))
+			    (doc, &n->rndr_footnote_ref->key, &fr->name))
 				goto err;
 			if (!pushlbuf
-			    (&n->rndr_footnote_ref.def, &fr->contents))
+			    (doc, &n->rndr_footnote_ref->def, &fr->contents))
 				goto err;
-		} else if (fr != NULL && fr->is_used) {
+		} else if (fr != NULL && foot_ref_used(doc, fr)) {
 			n = pushnode(doc, MDOWN_NORMAL_TEXT);
 			if (n == NULL)
 				goto err;
-			if (!pushbuf(&n->rndr_normal_text.text,
+			if (!pushbuf(doc, &n->rndr_normal_text.text,
 			    data, txt_e + 1))
 				goto err;
 		} else {
 			n = pushnode(doc, MDOWN_NORMAL_TEXT);
 			if (n == NULL)
 				goto err;
-			if (!pushbuf(&n->rndr_normal_text.text,
+			if (!pushbuf(doc, &n->rndr_normal_text.text,
 			    data, txt_e + 1))
 				goto err;
 		}
@@ -1532,7 +2197,7 @@ char_link(struct mdown_doc *doc,
 			n = pushnode(doc, MDOWN_NORMAL_TEXT);
 			if (n == NULL)
 				goto err;
-			if (!pushbuf(&n->rndr_normal_text.text,
+			if (!pushbuf(doc, &n->rndr_normal_text.text,
 			    m->value, strlen(m->value)))
 				goto err;
 			popnode(doc, n);
@@ -1739,9 +2404,12 @@ again:
 			    data + link_b, link_e - link_b))
 				goto err;
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
-		if (lr == NULL)
+		lr = find_link_ref(doc, idp->data, idp->size);
+		if (lr == NULL) {
+			if (doc->stream != NULL)
+				doc->stream->unresolved = 1;
 			goto cleanup;
+		}
 
 		/* Keeping link and title from link_ref. */
 
@@ -1766,9 +2434,12 @@ again:
 
 		/* Finding the link_ref. */
 
-		lr = find_link_ref(&doc->refq, idp->data, idp->size);
-		if (lr == NULL)
+		lr = find_link_ref(doc, idp->data, idp->size);
+		if (lr == NULL) {
+			if (doc->stream != NULL)
+				doc->stream->unresolved = 1;
 			goto cleanup;
+		}
 
 		/* Keeping link and title from link_ref. */
 
@@ -1841,42 +2512,42 @@ again:
 
 	if (is_img) {
 		if (u_link != NULL &&
-		    !pushlbuf(&n->rndr_image.link, u_link))
+		    !pushlbuf(doc, &n->rndr_image->link, u_link))
 			goto err;
 		if (title != NULL &&
-		    !pushlbuf(&n->rndr_image.title, title))
+		    !pushlbuf(doc, &n->rndr_image->title, title))
 			goto err;
 		if (dims != NULL &&
-		    !pushlbuf(&n->rndr_image.dims, dims))
+		    !pushlbuf(doc, &n->rndr_image->dims, dims))
 			goto err;
 		if (content != NULL &&
-		    !pushlbuf(&n->rndr_image.alt, content))
+		    !pushlbuf(doc, &n->rndr_image->alt, content))
 			goto err;
 		if (attrcls != NULL &&
-		    !pushlbuf(&n->rndr_image.attr_cls, attrcls))
+		    !pushlbuf(doc, &n->rndr_image->attr_cls, attrcls))
 			goto err;
 		if (attrid != NULL &&
-		    !pushlbuf(&n->rndr_image.attr_id, attrid))
+		    !pushlbuf(doc, &n->rndr_image->attr_id, attrid))
 			goto err;
 		if (attrwidth != NULL &&
-		    !pushlbuf(&n->rndr_image.attr_width, attrwidth))
+		    !pushlbuf(doc, &n->rndr_image->attr_width, attrwidth))
 			goto err;
 		if (attrheight != NULL &&
-		    !pushlbuf(&n->rndr_image.attr_height, attrheight))
+		    !pushlbuf(doc, &n->rndr_image->attr_height, attrheight))
 			goto err;
 		ret = 1;
 	} else {
 		if (u_link != NULL &&
-		    !pushlbuf(&n->rndr_link.link, u_link))
+		    !pushlbuf(doc, &n->rndr_link->link, u_link))
 			goto err;
 		if (title != NULL &&
-		    !pushlbuf(&n->rndr_link.title, title))
+		    !pushlbuf(doc, &n->rndr_link->title, title))
 			goto err;
 		if (attrcls != NULL &&
-		    !pushlbuf(&n->rndr_link.attr_cls, attrcls))
+		    !pushlbuf(doc, &n->rndr_link->attr_cls, attrcls))
 			goto err;
 		if (attrid != NULL &&
-		    !pushlbuf(&n->rndr_link.attr_id, attrid))
+		    !pushlbuf(doc, &n->rndr_link->attr_id, attrid))
 			goto err;
 		ret = 1;
 	}
@@ -1911,7 +2582,7 @@ char_superscript(struct mdown_doc *doc,
 
 	if (data[1] == '(') {
 		sup_start = 2;
-		sup_len = find_emph_char(data + 2, size - 2, ')') + 2;
+		sup_len = find_emph_char(data + 2, size - 2, ')', NULL) + 2;
 		if (sup_len == size)
 			return 0;
 	} else {
@@ -1941,6 +2612,182 @@ char_math(struct mdown_doc *doc,
 		parse_math(doc, data, offset, size, "$", 1, 0);
 }
 
+/*
+ * Block types that may start with a given first non-space byte, used
+ * by parse_block_one() so that a block is only tried against the
+ * parsers that could possibly match it, and by the line index.
+ * Tables and paragraphs may start with anything, and indented code
+ * with anything at four or more spaces.
+ */
+#define BLOCK_ATX	0x01 /* #header (no indent) */
+#define BLOCK_HTML	0x02 /* <HTML> (no indent) */
+#define BLOCK_EMPTY	0x04 /* empty line */
+#define BLOCK_HRULE	0x08 /* horizontal rule */
+#define BLOCK_FENCE	0x10 /* fenced code */
+#define BLOCK_QUOTE	0x20 /* > block quote */
+#define BLOCK_ULI	0x40 /* unordered list */
+#define BLOCK_DLI	0x80 /* definition list */
+#define BLOCK_OLI	0x100 /* ordered list */
+#define BLOCK_SETEXT	0x200 /* header underline (no indent) */
+#define BLOCK_PIPE	0x400 /* line has a pipe (not by byte) */
+
+static const unsigned short block_first[256] = {
+	['\n'] = BLOCK_EMPTY,
+	['#'] = BLOCK_ATX,
+	['<'] = BLOCK_HTML,
+	['*'] = BLOCK_HRULE | BLOCK_ULI,
+	['-'] = BLOCK_HRULE | BLOCK_ULI | BLOCK_SETEXT,
+	['='] = BLOCK_SETEXT,
+	['_'] = BLOCK_HRULE,
+	['+'] = BLOCK_ULI,
+	['`'] = BLOCK_FENCE,
+	['~'] = BLOCK_FENCE,
+	['>'] = BLOCK_QUOTE,
+	[':'] = BLOCK_DLI,
+	['0'] = BLOCK_OLI,
+	['1'] = BLOCK_OLI,
+	['2'] = BLOCK_OLI,
+	['3'] = BLOCK_OLI,
+	['4'] = BLOCK_OLI,
+	['5'] = BLOCK_OLI,
+	['6'] = BLOCK_OLI,
+	['7'] = BLOCK_OLI,
+	['8'] = BLOCK_OLI,
+	['9'] = BLOCK_OLI,
+};
+
+/*
+ * Narrow the block types in "probe" to those that may start a line
+ * indented by "indent" spaces.
+ * Headers, header underlines, and HTML must start at the margin, the
+ * others (but for indented code) within three spaces of it.
+ */
+static unsigned int
+probe_indent(unsigned int probe, size_t indent)
+{
+
+	if (indent > 0)
+		probe &= ~(BLOCK_ATX | BLOCK_HTML | BLOCK_SETEXT);
+	if (indent > 3)
+		probe &= BLOCK_EMPTY | BLOCK_PIPE;
+	return probe;
+}
+
+/*
+ * Scan the line at the start of "data" for the line index.
+ * Sets "indent" to the number of leading spaces and "probe" to the
+ * block types of the first non-space byte (BLOCK_EMPTY if there's
+ * none), along with BLOCK_PIPE if the line has a pipe.
+ * Returns the line length, including the newline if there is one.
+ */
+static size_t
+line_scan(const char *data, size_t size,
+	size_t *indent, unsigned int *probe)
+{
+	const char	*cp;
+	size_t		 i, len;
+
+	i = countspaces(data, 0, size, 0);
+	*indent = i;
+	if (i == size) {
+		*probe = BLOCK_EMPTY;
+		return size;
+	}
+	*probe = block_first[(unsigned char)data[i]];
+	cp = memchr(data + i, '\n', size - i);
+	len = cp == NULL ? size : (size_t)(cp - data) + 1;
+	if (memchr(data + i, '|', len - i) != NULL)
+		*probe |= BLOCK_PIPE;
+	return len;
+}
+
+/*
+ * Index the lines of the text to be parsed ("doc->src"), so that the
+ * block parsers needn't rescan them: see line_get().
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+line_init(struct mdown_doc *doc)
+{
+	struct line	*p;
+	size_t		 beg, len, indent, max;
+	unsigned int	 probe;
+
+	doc->linesz = doc->linecur = 0;
+	doc->lineok = doc->src;
+	for (beg = 0; ; beg += len) {
+		if (doc->linesz == doc->linemax) {
+			max = doc->linemax == 0 ? 512 : doc->linemax * 2;
+			p = reallocarray(doc->lines, max,
+				sizeof(struct line));
+			if (p == NULL)
+				return 0;
+			doc->lines = p;
+			doc->linemax = max;
+		}
+		p = &doc->lines[doc->linesz++];
+		p->beg = beg;
+		if (beg == doc->srcsz)
+			break;
+		len = line_scan(doc->src + beg, doc->srcsz - beg,
+			&indent, &probe);
+		p->indent = indent > USHRT_MAX ? USHRT_MAX : indent;
+		p->probe = probe;
+	}
+
+	/* Don't count the end marker. */
+
+	doc->linesz--;
+	return 1;
+}
+
+/*
+ * Like line_scan(), but using the line index if "data" starts a line
+ * in it that's wholly within "size".
+ * Text before "doc->lineok" may have been rewritten (see
+ * parse_blockquote()), so it's always scanned.
+ * The index is usually read in order, so we start where the last
+ * lookup left off.
+ */
+static size_t
+line_get(struct mdown_doc *doc, const char *data, size_t size,
+	size_t *indent, unsigned int *probe)
+{
+	const struct line	*p = NULL;
+	size_t			 off, lo, hi, mid;
+
+	if (doc->linesz == 0 || doc->src == NULL ||
+	    data < doc->src || data >= doc->src + doc->srcsz ||
+	    data < doc->lineok)
+		return line_scan(data, size, indent, probe);
+
+	off = data - doc->src;
+	if (doc->lines[doc->linecur].beg == off)
+		p = &doc->lines[doc->linecur];
+	else if (doc->lines[doc->linecur + 1].beg == off)
+		p = &doc->lines[++doc->linecur];
+	else {
+		lo = 0;
+		hi = doc->linesz;
+		while (hi - lo > 1) {
+			mid = lo + (hi - lo) / 2;
+			if (doc->lines[mid].beg <= off)
+				lo = mid;
+			else
+				hi = mid;
+		}
+		if (doc->lines[lo].beg == off)
+			p = &doc->lines[doc->linecur = lo];
+	}
+
+	if (p == NULL || p[1].beg - p->beg > size)
+		return line_scan(data, size, indent, probe);
+
+	*indent = p->indent;
+	*probe = p->probe;
+	return p[1].beg - p->beg;
+}
+
 /*
  * Returns the line length when it is empty, 0 otherwise.
  */
@@ -2299,39 +3146,66 @@ prefix_uli(const struct mdown_doc *doc,
 static ssize_t
 parse_blockquote(struct mdown_doc *doc, char *data, size_t size)
 {
-	size_t			 beg = 0, end = 0, pre, work_size = 0;
+	size_t			 beg = 0, end = 0, pre, work_size = 0,
+				 ind;
 	char			*work_data = NULL;
 	struct mdown_node	*n;
+	unsigned int		 probe, nprobe;
 
 	while (beg < size) {
-		for (end = beg + 1;
-		     end < size && data[end - 1] != '\n';
-		     end++)
-			continue;
+		end = beg + line_get(doc,
+			data + beg, size - beg, &ind, &probe);
+		probe = probe_indent(probe, ind);
 
-		pre = prefix_quote(data + beg, end - beg);
+		pre = (probe & BLOCK_QUOTE) ?
+			prefix_quote(data + beg, end - beg) : 0;
 
 		/* Skip prefix or empty line followed by non-quote. */
 
 		if (pre)
 			beg += pre;
-		else if (is_empty(data + beg, end - beg) &&
-			 (end >= size ||
-			  (prefix_quote(data + end, size - end) == 0 &&
-			   !is_empty(data + end, size - end))))
-			break;
+		else if (probe & BLOCK_EMPTY) {
+			if (end >= size)
+				break;
+			line_get(doc, data + end, size - end,
+				&ind, &nprobe);
+			nprobe = probe_indent(nprobe, ind);
+			if (!(nprobe & BLOCK_EMPTY) &&
+			    ((nprobe & BLOCK_QUOTE) == 0 ||
+			     prefix_quote(data + end, size - end) == 0))
+				break;
+		}
 
 		if (beg < end) {
 			if (!work_data)
 				work_data = data + beg;
-			else if (data + beg != work_data + work_size)
+			else if (data + beg != work_data + work_size) {
+				/*
+				 * Only the document's own text outlives
+				 * the chunk: quotes within list items
+				 * are rewritten in a temporary buffer.
+				 */
+				if (doc->chunk != NULL &&
+				    work_data + work_size >= doc->src &&
+				    work_data + work_size + (end - beg) <=
+				    doc->src + doc->srcsz &&
+				    !chunk_save(doc,
+				    work_data + work_size, end - beg))
+					return -1;
 				memmove(work_data + work_size,
 					data + beg, end - beg);
+			}
 			work_size += end - beg;
 		}
 		beg = end;
 	}
 
+	/* The line index is stale for the rewritten lines. */
+
+	if (doc->src != NULL && data >= doc->src &&
+	    data < doc->src + doc->srcsz && doc->lineok < data + end)
+		doc->lineok = data + end;
+
 	n = pushnode(doc, MDOWN_BLOCKQUOTE);
 	if (n == NULL)
 		return -1;
@@ -2352,8 +3226,9 @@ parse_paragraph(struct mdown_doc *doc, char *data, size_t size)
 {
 	struct mdown_buf	 work;
 	struct mdown_node 	*n;
-	size_t		 	 i = 0, end = 0, beg, lines = 0;
+	size_t		 	 i = 0, end = 0, beg, lines = 0, ind;
 	int		 	 level = 0, beoln = 0;
+	unsigned int		 probe;
 
 	memset(&work, 0, sizeof(struct mdown_buf));
 	work.data = data;
@@ -2361,9 +3236,8 @@ parse_paragraph(struct mdown_doc *doc, char *data, size_t size)
 	while (i < size) {
 		/* Parse ahead to the next newline. */
 
-		for (end = i + 1;
-		     end < size && data[end - 1] != '\n'; end++)
-			continue;
+		end = i + line_get(doc, data + i, size - i, &ind, &probe);
+		probe = probe_indent(probe, ind);
 
 		/*
 		 * Empty line: end of paragraph.
@@ -2371,23 +3245,27 @@ parse_paragraph(struct mdown_doc *doc, char *data, size_t size)
 		 * that, which means that we're a block-mode dli.
 		 */
 
-		if (is_empty(data + i, size - i)) {
+		if (probe & BLOCK_EMPTY) {
 			beoln = 1;
 			break;
 		}
 
 		/* Header line: end of paragraph. */
 
-		if ((level = is_headerline(data + i, size - i)) != 0)
+		if ((probe & BLOCK_SETEXT) &&
+		    (level = is_headerline(data + i, size - i)) != 0)
 			break;
 
 		/* Other ways of ending a paragraph. */
 
-		if (is_atxheader(doc, data + i, size - i) ||
-		    is_hrule(data + i, size - i) ||
-		    (lines == 1 &&
+		if (((probe & BLOCK_ATX) &&
+		     is_atxheader(doc, data + i, size - i)) ||
+		    ((probe & BLOCK_HRULE) &&
+		     is_hrule(data + i, size - i)) ||
+		    ((probe & BLOCK_DLI) && lines == 1 &&
 		     prefix_dli(doc, data + i, size - i)) ||
-		    prefix_quote(data + i, size - i)) {
+		    ((probe & BLOCK_QUOTE) &&
+		     prefix_quote(data + i, size - i))) {
 			end = i;
 			break;
 		}
@@ -2467,8 +3345,9 @@ parse_fencedcode(struct mdown_doc *doc, char *data, size_t size)
 {
 	struct mdown_buf	 text, lang;
 	size_t	 		 i = 0, text_start, line_start,
-				 w, w2, width, width2;
+				 w, w2, width, width2, ind;
 	char	 		 chr, chr2;
+	unsigned int		 probe;
 	struct mdown_node 	*n;
 
 	memset(&text, 0, sizeof(struct mdown_buf));
@@ -2486,10 +3365,12 @@ parse_fencedcode(struct mdown_doc *doc, char *data, size_t size)
 	i++;
 	text_start = i;
 	while ((line_start = i) < size) {
-		while (i < size && data[i] != '\n')
-			i++;
-		w2 = is_codefence(data + line_start,
-			i - line_start, &width2, &chr2);
+		i += line_get(doc, data + i, size - i, &ind, &probe);
+		if (data[i - 1] == '\n')
+			i--;
+		w2 = (probe_indent(probe, ind) & BLOCK_FENCE) ?
+			is_codefence(data + line_start,
+			i - line_start, &width2, &chr2) : 0;
 		if (w == w2 &&
 		    width == width2 &&
 		    chr == chr2 &&
@@ -2499,16 +3380,25 @@ parse_fencedcode(struct mdown_doc *doc, char *data, size_t size)
 		i++;
 	}
 
+	/*
+	 * An unclosed top-level fence in a chunk might be closed by
+	 * text following the chunk: see parse_chunks().
+	 */
+
+	if (line_start >= size && doc->chunk != NULL &&
+	    doc->current->type == MDOWN_ROOT)
+		doc->chunk->unsettled = 1;
+
 	text.data = data + text_start;
 	text.size = line_start - text_start;
 
 	if ((n = pushnode(doc, MDOWN_BLOCKCODE)) == NULL)
 		return -1;
 
-	if (!pushbuf(&n->rndr_blockcode.text,
+	if (!pushbuf(doc, &n->rndr_blockcode->text,
 	    data + text_start, line_start - text_start))
 		return -1;
-	if (!pushlbuf(&n->rndr_blockcode.lang, &lang))
+	if (!pushlbuf(doc, &n->rndr_blockcode->lang, &lang))
 		return -1;
 	popnode(doc, n);
 	return i;
@@ -2568,7 +3458,7 @@ parse_blockcode(struct mdown_doc *doc, char *data, size_t size)
 
 	if ((n = pushnode(doc, MDOWN_BLOCKCODE)) == NULL)
 		goto err;
-	if (!pushlbuf(&n->rndr_blockcode.text, work))
+	if (!pushlbuf(doc, &n->rndr_blockcode->text, work))
 		goto err;
 	popnode(doc, n);
 	hbuf_free(work);
@@ -2589,9 +3479,10 @@ parse_listitem(struct mdown_buf *ob, struct mdown_doc *doc,
 	struct mdown_buf	*work = NULL;
 	size_t			 beg = 0, end, pre, sublist = 0,
 				 orgpre, i, has_next_uli = 0, dli_lines,
-				 has_next_oli = 0, has_next_dli = 0;
+				 has_next_oli = 0, has_next_dli = 0, ind;
 	int			 in_empty = 0, has_inside_empty = 0,
 				 in_fence = 0, ff, checked = -1;
+	unsigned int		 probe;
 	struct mdown_node	*n;
 
 	/* Keeping track of the first indentation prefix. */
@@ -2633,14 +3524,12 @@ parse_listitem(struct mdown_buf *ob, struct mdown_doc *doc,
 
 	while (beg < size) {
 		has_next_uli = has_next_oli = has_next_dli = 0;
-		end++;
-
-		while (end < size && data[end - 1] != '\n')
-			end++;
+		end = beg + line_get(doc,
+			data + beg, size - beg, &ind, &probe);
 
 		/* Process an empty line. */
 
-		if (is_empty(data + beg, end - beg)) {
+		if (probe & BLOCK_EMPTY) {
 			in_empty = 1;
 			beg = end;
 			dli_lines = 0;
@@ -2651,9 +3540,11 @@ parse_listitem(struct mdown_buf *ob, struct mdown_doc *doc,
 
 		/* Calculating the indentation. */
 
-		pre = i = countspaces(data, beg, end, 4) - beg;
+		pre = i = ind < 4 ? ind : 4;
+		probe = probe_indent(probe, ind - i);
 
-		if (doc->ext_flags & MDOWN_FENCED)
+		if ((doc->ext_flags & MDOWN_FENCED) &&
+		    (probe & BLOCK_FENCE))
 			if (is_codefence(data + beg + i,
 			    end - beg - i, NULL, NULL))
 				in_fence = !in_fence;
@@ -2666,12 +3557,15 @@ parse_listitem(struct mdown_buf *ob, struct mdown_doc *doc,
 		 */
 
 		if (!in_fence) {
-			has_next_uli = prefix_uli(doc,
-				data + beg + i, end - beg - i, NULL);
-			has_next_dli =  dli_lines <= 2 && prefix_dli
-				(doc, data + beg + i, end - beg - i);
-			has_next_oli = prefix_oli
-				(doc, data + beg + i, end - beg - i, NULL);
+			has_next_uli = (probe & BLOCK_ULI) &&
+				prefix_uli(doc, data + beg + i,
+				end - beg - i, NULL);
+			has_next_dli = (probe & BLOCK_DLI) &&
+				dli_lines <= 2 && prefix_dli(doc,
+				data + beg + i, end - beg - i);
+			has_next_oli = (probe & BLOCK_OLI) &&
+				prefix_oli(doc, data + beg + i,
+				end - beg - i, NULL);
 			if (has_next_uli || has_next_dli || has_next_oli)
 				dli_lines = 0;
 		}
@@ -2972,7 +3866,7 @@ parse_footnote_def(struct mdown_doc *doc, struct foot_ref *ref)
 	if ((n = pushnode(doc, MDOWN_FOOTNOTE_DEF)) == NULL)
 		return 0;
 	n->rndr_footnote_def.num = ref->num;
-	if (!pushlbuf(&n->rndr_footnote_def.key, &ref->name))
+	if (!pushlbuf(doc, &n->rndr_footnote_def.key, &ref->name))
 		return 0;
 	if (!parse_block(doc,
 	    ref->contents.data, ref->contents.size))
@@ -2988,32 +3882,25 @@ parse_footnote_def(struct mdown_doc *doc, struct foot_ref *ref)
 static int
 parse_footnote_list(struct mdown_doc *doc)
 {
-	struct foot_ref		*ref;
 	struct mdown_node	*n = NULL;
-	size_t			 i, first = 1;
-
-	if (TAILQ_EMPTY(&doc->footq))
-		return 1;
+	size_t			 i;
 
 	/*
 	 * Print out our footnotes in order.
 	 * Only emit the footnote block if we have some.
+	 * Footnotes may be used for the first time from within these,
+	 * so "doc->foots" may grow as we go.
 	 */
 
-	for (i = 0; i <= doc->foots; i++)
-		TAILQ_FOREACH(ref, &doc->footq, entries) {
-			if (ref->num != i || !ref->is_used)
-				continue;
-			if (first) {
-				n = pushnode(doc,
-					MDOWN_FOOTNOTES_BLOCK);
-				if (n == NULL)
-					return 0;
-				first = 0;
-			}
-			if (!parse_footnote_def(doc, ref))
+	for (i = 0; i < doc->foots; i++) {
+		if (n == NULL) {
+			n = pushnode(doc, MDOWN_FOOTNOTES_BLOCK);
+			if (n == NULL)
 				return 0;
 		}
+		if (!parse_footnote_def(doc, doc->footv[i]))
+			return 0;
+	}
 
 	if (n != NULL)
 		popnode(doc, n);
@@ -3084,16 +3971,13 @@ static size_t
 htmlblock_find_end_strict(const char *tag, size_t tag_len,
 	struct mdown_doc *doc, const char *data, size_t size)
 {
-	size_t i = 0, mark;
+	size_t		 i = 0, mark, ind;
+	unsigned int	 probe;
 
 	while (1) {
-		mark = i;
-		while (i < size && data[i] != '\n')
-			i++;
-		if (i < size)
-			i++;
-		if (i == mark)
+		if ((mark = i) == size)
 			return 0;
+		i += line_get(doc, data + i, size - i, &ind, &probe);
 
 		if (data[mark] == ' ' && mark > 0)
 			continue;
@@ -3167,20 +4051,14 @@ hhtml_find_block(const char *str, size_t len)
 }
 
 /*
- * Parsing of inline HTML block.
- * Return <0 on failure, >0 on success, 0 if not a block.
+ * Find the end of the HTML block at the start of "data".
+ * Returns the length of the block, 0 if not a block.
  */
-static ssize_t
-parse_htmlblock(struct mdown_doc *doc, char *data, size_t size)
+static size_t
+htmlblock_end(struct mdown_doc *doc, const char *data, size_t size)
 {
-	struct mdown_buf	 work;
 	size_t	 	 	 i, j = 0, tag_len, tag_end;
 	const char		*curtag = NULL;
-	struct mdown_node 	*n;
-
-	memset(&work, 0, sizeof(struct mdown_buf));
-
-	work.data = data;
 
 	/* Identification of the opening tag. */
 
@@ -3209,17 +4087,8 @@ parse_htmlblock(struct mdown_doc *doc, char *data, size_t size)
 			if (i < size)
 				j = is_empty(data + i, size - i);
 
-			if (j) {
-				n = pushnode(doc, MDOWN_BLOCKHTML);
-				if (n == NULL)
-					return -1;
-				work.size = i + j;
-				if (!pushlbuf
-				    (&n->rndr_blockhtml.text, &work))
-					return -1;
-				popnode(doc, n);
-				return work.size;
-			}
+			if (j)
+				return i + j;
 		}
 
 		/*
@@ -3237,19 +4106,8 @@ parse_htmlblock(struct mdown_doc *doc, char *data, size_t size)
 			if (i + 1 < size) {
 				i++;
 				j = is_empty(data + i, size - i);
-				if (j) {
-					n = pushnode(doc,
-						MDOWN_BLOCKHTML);
-					if (n == NULL)
-						return -1;
-					work.size = i + j;
-					if (!pushlbuf
-					    (&n->rndr_blockhtml.text,
-					     &work))
-						return -1;
-					popnode(doc, n);
-					return work.size;
-				}
+				if (j)
+					return i + j;
 			}
 		}
 
@@ -3276,20 +4134,33 @@ parse_htmlblock(struct mdown_doc *doc, char *data, size_t size)
 		tag_end = htmlblock_find_end(curtag,
 			tag_len, doc, data, size);
 
-	if (!tag_end)
-		return 0;
+	return tag_end;
+}
+
+/*
+ * Parsing of inline HTML block.
+ * Return <0 on failure, >0 on success, 0 if not a block.
+ */
+static ssize_t
+parse_htmlblock(struct mdown_doc *doc, char *data, size_t size)
+{
+	struct mdown_buf	 work;
+	struct mdown_node 	*n;
+
+	memset(&work, 0, sizeof(struct mdown_buf));
 
-	/* The end of the block has been found. */
+	if ((work.size = htmlblock_end(doc, data, size)) == 0)
+		return 0;
 
 	n = pushnode(doc, MDOWN_BLOCKHTML);
 	if (n == NULL)
 		return -1;
 
-	work.size = tag_end;
-	if (!pushlbuf(&n->rndr_blockhtml.text, &work))
+	work.data = data;
+	if (!pushlbuf(doc, &n->rndr_blockhtml.text, &work))
 		return -1;
 	popnode(doc, n);
-	return tag_end;
+	return work.size;
 }
 
 /*
@@ -3317,7 +4188,7 @@ parse_table_row(struct mdown_buf *ob, struct mdown_doc *doc,
 
 		cell_start = i;
 
-		len = find_emph_char(data + i, size - i, '|');
+		len = find_emph_char(data + i, size - i, '|', NULL);
 
 		/*
 		 * Two possibilities for len == 0:
@@ -3466,8 +4337,8 @@ parse_table_header(struct mdown_node **np,
 	if (n == NULL)
 		return -1;
 
-	n->rndr_table_header.flags = calloc
-		(*columns, sizeof(enum htbl_flags));
+	n->rndr_table_header.flags = arena_calloc
+		(doc->arena, *columns, sizeof(enum htbl_flags));
 	if (n->rndr_table_header.flags == NULL)
 		return -1;
 
@@ -3490,7 +4361,8 @@ parse_table_header(struct mdown_node **np,
 static ssize_t
 parse_table(struct mdown_doc *doc, char *data, size_t size)
 {
-	size_t		 	 i, columns, row_start, pipes;
+	size_t		 	 i, columns, row_start, ind;
+	unsigned int		 probe;
 	ssize_t			 ret;
 	struct mdown_buf 	*header_work = NULL, *body_work = NULL;
 	enum htbl_flags		*col_data = NULL;
@@ -3510,17 +4382,17 @@ parse_table(struct mdown_doc *doc, char *data, size_t size)
 		if (nn == NULL)
 			goto err;
 		while (i < size) {
-			pipes = 0;
 			row_start = i;
+			i += line_get(doc, data + i, size - i,
+				&ind, &probe);
 
-			while (i < size && data[i] != '\n')
-				if (data[i++] == '|')
-					pipes++;
+			/* Rows must have a pipe and a newline. */
 
-			if (pipes == 0 || i == size) {
+			if (!(probe & BLOCK_PIPE) || data[i - 1] != '\n') {
 				i = row_start;
 				break;
 			}
+			i--;
 
 			if (!parse_table_row(body_work,
 			     doc, data + row_start, i - row_start,
@@ -3545,161 +4417,187 @@ err:
 }
 
 /*
- * Parsing of one block, returning next char to parse.
+ * Parse the block (or run of empty lines) at the start of "data".
  * We can assume, entering the block, that our output is newline
  * aligned.
- * Return zero on failure, non-zero on success.
+ * Return <0 on failure, otherwise the number of bytes consumed.
  */
-static int
-parse_block(struct mdown_doc *doc, char *data, size_t size)
+static ssize_t
+parse_block_one(struct mdown_doc *doc, char *data, size_t size)
 {
-	size_t	 		 beg = 0, end, i;
-	char			*txt_data;
+	size_t	 		 i, len;
 	char			 oli_data[10];
 	struct mdown_node	*n;
 	ssize_t			 rc;
+	unsigned int		 probe;
 
 	/*
 	 * What kind of block are we?
-	 * Go through all types of blocks, one by one.
+	 * Look up which block types may start the first line, then try
+	 * these in order.
 	 */
 
-	while (beg < size) {
-		txt_data = data + beg;
-		end = size - beg;
+	len = line_get(doc, data, size, &i, &probe);
+	probe = probe_indent(probe, i);
 
-		/* We are at a #header. */
+	/* We are at a #header. */
 
-		if (is_atxheader(doc, txt_data, end)) {
-			rc = parse_atxheader(doc, txt_data, end);
-			if (rc < 0)
-				return 0;
-			assert(rc > 0);
-			beg += rc;
-			continue;
-		}
+	if ((probe & BLOCK_ATX) && is_atxheader(doc, data, size)) {
+		rc = parse_atxheader(doc, data, size);
+		assert(rc != 0);
+		return rc;
+	}
 
-		/* We have some <HTML>. */
+	/* We have some <HTML>. */
 
-		if (data[beg] == '<') {
-			rc = parse_htmlblock(doc, txt_data, end);
-			if (rc > 0) {
-				beg += rc;
-				continue;
-			} else if (rc < 0)
-				return 0;
-		}
+	if (probe & BLOCK_HTML) {
+		rc = parse_htmlblock(doc, data, size);
+		if (rc != 0)
+			return rc;
+	}
 
-		/* Empty line. */
+	/* Empty line. */
 
-		if ((i = is_empty(txt_data, end)) != 0) {
-			beg += i;
-			continue;
-		}
+	if ((probe & BLOCK_EMPTY) && (i = is_empty(data, size)) != 0)
+		return i;
 
-		/* Horizontal rule. */
+	/* Horizontal rule. */
 
-		if (is_hrule(txt_data, end)) {
-			n = pushnode(doc, MDOWN_HRULE);
-			if (n == NULL)
-				return 0;
-			while (beg < size && data[beg] != '\n')
-				beg++;
-			beg++;
-			popnode(doc, n);
+	if ((probe & BLOCK_HRULE) && is_hrule(data, size)) {
+		if ((n = pushnode(doc, MDOWN_HRULE)) == NULL)
+			return -1;
+		for (i = 0; i < size && data[i] != '\n'; i++)
 			continue;
-		}
+		popnode(doc, n);
+		return i + 1;
+	}
 
-		/* Fenced code. */
+	/* Fenced code. */
 
-		if (doc->ext_flags & MDOWN_FENCED) {
-			rc = parse_fencedcode(doc, txt_data, end);
-			if (rc > 0) {
-				beg += rc;
-				continue;
-			} else if (rc < 0)
-				return 0;
+	if ((probe & BLOCK_FENCE) && (doc->ext_flags & MDOWN_FENCED)) {
+		rc = parse_fencedcode(doc, data, size);
+		if (rc != 0)
+			return rc;
+	}
+	
+	/*
+	 * Table parsing.
+	 * The header line must end in a newline and have a pipe.
+	 */
 
-		}
-		
-		/* Table parsing. */
+	if ((doc->ext_flags & MDOWN_TABLES) &&
+	    (probe & BLOCK_PIPE) && data[len - 1] == '\n') {
+		rc = parse_table(doc, data, size);
+		if (rc != 0)
+			return rc;
+	}
 
-		if (doc->ext_flags & MDOWN_TABLES) {
-			rc = parse_table(doc, txt_data, end);
-			if (rc > 0) {
-				beg += rc;
-				continue;
-			} else if (rc < 0)
-				return 0;
+	/* We're a > block quote. */
 
-		}
+	if ((probe & BLOCK_QUOTE) && prefix_quote(data, size))
+		return parse_blockquote(doc, data, size);
 
-		/* We're a > block quote. */
+	/* Prefixed code (like block-quotes). */
 
-		if (prefix_quote(txt_data, end)) {
-			rc = parse_blockquote(doc, txt_data, end);
-			if (rc < 0)
-				return 0;
-			beg += rc;
-			continue;
-		}
+	if (!(doc->ext_flags & MDOWN_NOCODEIND) &&
+	    prefix_code(data, size))
+		return parse_blockcode(doc, data, size);
 
-		/* Prefixed code (like block-quotes). */
+	/* Some sort of unordered list. */
 
-		if (!(doc->ext_flags & MDOWN_NOCODEIND) &&
-		    prefix_code(txt_data, end)) {
-			rc = parse_blockcode(doc, txt_data, end);
-			if (rc < 0)
-				return 0;
-			beg += rc;
-			continue;
-		}
+	if ((probe & BLOCK_ULI) && prefix_uli(doc, data, size, NULL))
+		return parse_list(doc, data, size, NULL);
 
-		/* Some sort of unordered list. */
+	/*
+	 * A definition list.
+	 * Only use this is preceded by a one-line paragraph.
+	 */
 
-		if (prefix_uli(doc, txt_data, end, NULL)) {
-			rc = parse_list(doc, txt_data, end, NULL);
-			if (rc < 0)
-				return 0;
-			beg += rc;
-			continue;
-		}
+	if ((probe & BLOCK_DLI) && doc->current != NULL &&
+	    prefix_dli(doc, data, size)) {
+		n = TAILQ_LAST(&doc->current->children,
+			mdown_nodeq);
+		if (n != NULL &&
+		    n->type == MDOWN_PARAGRAPH &&
+		    n->rndr_paragraph.lines == 1)
+			return parse_definition(doc, data, size);
+	}
 
-		/*
-		 * A definition list.
-		 * Only use this is preceded by a one-line paragraph.
-		 */
+	/* An ordered list. */
 
-		if (doc->current != NULL &&
-		    prefix_dli(doc, txt_data, end)) {
-			n = TAILQ_LAST(&doc->current->children,
-				mdown_nodeq);
-			if (n != NULL &&
-			    n->type == MDOWN_PARAGRAPH &&
-			    n->rndr_paragraph.lines == 1) {
-				rc = parse_definition(doc, txt_data, end);
-				if (rc < 0)
-					return 0;
-				beg += rc;
-				continue;
-			}
-		}
+	if ((probe & BLOCK_OLI) && prefix_oli(doc, data, size, oli_data))
+		return parse_list(doc, data, size, oli_data);
 
-		/* An ordered list. */
+	/* No match: just a regular paragraph. */
 
-		if (prefix_oli(doc, txt_data, end, oli_data)) {
-			rc = parse_list(doc, txt_data, end, oli_data);
-			if (rc < 0)
-				return 0;
-			beg += rc;
-			continue;
-		}
+	return parse_paragraph(doc, data, size);
+}
+
+/*
+ * With MDOWN_SMARTY_PARSE, make smart typography substitutions in the
+ * children of "root" that haven't been done yet, stopping short of
+ * "last" (if not NULL).
+ * This is done while the tree is being parsed, when the blocks are
+ * still in the cache, but the blocks following any block done here
+ * must not change afterward: see smarty_top().
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+parse_smarty(struct mdown_doc *doc,
+	struct mdown_node *root, const struct mdown_node *last)
+{
+	struct mdown_node	*n;
+
+	if (!(doc->ext_flags & MDOWN_SMARTY_PARSE))
+		return 1;
+
+	/*
+	 * A definition list merged into the one before it removes a
+	 * block, so "last" may already have been done.
+	 */
+
+	if (doc->smarty != NULL && doc->smarty == last)
+		return 1;
+
+	n = doc->smarty == NULL ? TAILQ_FIRST(&root->children) :
+		TAILQ_NEXT(doc->smarty, entries);
+	for ( ; n != NULL && n != last; n = TAILQ_NEXT(n, entries)) {
+		if (!smarty_top(n, &doc->nodes))
+			return 0;
+		doc->smarty = n;
+	}
+	return 1;
+}
 
-		/* No match: just a regular paragraph. */
+/*
+ * Parse all blocks in "data".
+ * Return zero on failure, non-zero on success.
+ */
+static int
+parse_block(struct mdown_doc *doc, char *data, size_t size)
+{
+	size_t			 beg = 0;
+	ssize_t			 rc;
+	struct mdown_node	*n;
 
-		if ((rc = parse_paragraph(doc, txt_data, end)) < 0)
+	while (beg < size) {
+		rc = parse_block_one(doc, data + beg, size - beg);
+		if (rc < 0)
 			return 0;
 		beg += rc;
+
+		/*
+		 * Only the last two top-level blocks may still change,
+		 * as a definition list may take the last paragraph and
+		 * add it to the definition list before it.
+		 */
+
+		if (doc->current->type == MDOWN_ROOT &&
+		    (n = TAILQ_LAST(&doc->current->children,
+		     mdown_nodeq)) != NULL &&
+		    (n = TAILQ_PREV(n, mdown_nodeq, entries)) != NULL &&
+		    !parse_smarty(doc, doc->current, n))
+			return 0;
 	}
 
 	return 1;
@@ -3825,10 +4723,13 @@ is_footnote(struct mdown_doc *doc, const char *data,
 		goto err;
 
 	TAILQ_INSERT_TAIL(&doc->footq, ref, entries);
-	if (!pushlbuf(&ref->contents, contents))
-		return -1;
-	if (!pushbuf(&ref->name, data + id_offs, id_end - id_offs))
-		return -1;
+	if (!pushlbuf(doc, &ref->contents, contents))
+		goto err;
+	if (!pushbuf(doc, &ref->name, data + id_offs, id_end - id_offs))
+		goto err;
+	if (!add_foot_ref(doc, ref))
+		goto err;
+	hbuf_free(contents);
 	return 1;
 err:
 	hbuf_free(contents);
@@ -4048,7 +4949,7 @@ is_ref(struct mdown_doc *doc, const char *data,
 			return -1;
 	}
 
-	return 1;
+	return add_link_ref(doc, ref) ? 1 : -1;
 }
 
 /*
@@ -4093,6 +4994,37 @@ expand_tabs(struct mdown_buf *ob, const char *line, size_t size)
 	return 1;
 }
 
+/*
+ * Build the nibble tables used by find_active_byte() from the
+ * active_char table, less the autolink 'w' and ':' (which are matched
+ * as sequences).
+ * Each distinct high nibble of an active byte is given a bit, which is
+ * set in the high-nibble table for that nibble and in the low-nibble
+ * table for the low nibbles it's paired with.
+ * There are at most eight such high nibbles, as active bytes are only
+ * '\n' and ASCII punctuation and letters.
+ */
+static void
+active_init(struct mdown_doc *doc)
+{
+	size_t		 i;
+	unsigned char	 bit = 0, bits[16];
+
+	memset(bits, 0, sizeof(bits));
+	for (i = 0; i < 256; i++) {
+		if (doc->active_char[i] == 0 ||
+		    doc->active_char[i] == MD_CHAR_AUTOLINK_WWW ||
+		    doc->active_char[i] == MD_CHAR_AUTOLINK_URL)
+			continue;
+		if (bits[i >> 4] == 0) {
+			assert(bit < 8);
+			bits[i >> 4] = 1 << bit++;
+		}
+		doc->active_hi[i >> 4] = bits[i >> 4];
+		doc->active_lo[i & 0x0f] |= bits[i >> 4];
+	}
+}
+
 struct mdown_doc *
 mdown_doc_new(const struct mdown_opts *opts)
 {
@@ -4105,6 +5037,14 @@ mdown_doc_new(const struct mdown_opts *opts)
 		return NULL;
 
 	doc->maxdepth = opts == NULL ? 128 : opts->maxdepth;
+	doc->jobs = opts == NULL ? 0 : opts->jobs;
+#if ACTIVE_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		doc->simd = SIMD_AVX2;
+	else if (__builtin_cpu_supports("ssse3"))
+		doc->simd = SIMD_SSSE3;
+#endif
 	doc->active_char['*'] = MD_CHAR_EMPHASIS;
 	doc->active_char['_'] = MD_CHAR_EMPHASIS;
 	if (extensions & MDOWN_STRIKE)
@@ -4128,6 +5068,8 @@ mdown_doc_new(const struct mdown_opts *opts)
 	if (extensions & MDOWN_MATH)
 		doc->active_char['$'] = MD_CHAR_MATH;
 
+	active_init(doc);
+
 	doc->ext_flags = extensions;
 
 	if (opts != NULL && opts->metasz > 0) {
@@ -4342,7 +5284,7 @@ parse_metadata(struct mdown_doc *doc, const char *data, size_t sz)
 			free(buf);
 			return -1;
 		}
-		if (!pushbuf(&n->rndr_meta.key, buf, cp - buf)) {
+		if (!pushbuf(doc, &n->rndr_meta.key, buf, cp - buf)) {
 			free(buf);
 			return -1;
 		}
@@ -4389,7 +5331,7 @@ parse_metadata(struct mdown_doc *doc, const char *data, size_t sz)
 			return -1;
 		if ((nn = pushnode(doc, MDOWN_NORMAL_TEXT)) == NULL)
 			return -1;
-		if (!pushbuf(&nn->rndr_normal_text.text, val, vsz))
+		if (!pushbuf(doc, &nn->rndr_normal_text.text, val, vsz))
 			return -1;
 
 		popnode(doc, nn);
@@ -4402,104 +5344,78 @@ parse_metadata(struct mdown_doc *doc, const char *data, size_t sz)
 }
 
 /*
- * Parse the buffer in data of length size.
- * If both mp and mszp are not NULL, set them with the meta information
- * instead of locally destroying it.
- * (Obviously only applicable if MDOWN_METADATA has been set.)
+ * Zeroth pass: metadata, creating the MDOWN_DOC_HEADER node.  First
+ * process given metadata, then in-document metadata, then overriding
+ * metadata.  The in-document metadata is conditionally processed.
+ * On success, "beg" is set past the UTF-8 BOM (if any) and the
+ * in-document metadata (if any).
+ * Return zero on failure, non-zero on success.
  */
-struct mdown_node *
-mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
-	const char *data, size_t size, struct mdown_metaq *metaq)
+static int
+parse_doc_header(struct mdown_doc *doc,
+	const char *data, size_t size, size_t *beg)
 {
 	static const char 	 UTF8_BOM[] = { 0xEF, 0xBB, 0xBF };
-	struct mdown_buf	*text;
-	size_t		 	 beg, end, i;
+	struct mdown_node	*n;
+	size_t			 end, i;
 	const char		*sv;
-	struct mdown_node 	*n, *root = NULL;
-	struct mdown_metaq	 mq;
-	int			 c, rc = 0;
+	int			 c;
 
 	/*
-	 * Have a temporary "mq" if "metaq" is not set.  We clear this
-	 * automatically at the tail of the function.
+	 * Skip a possible UTF-8 BOM, even though the Unicode standard
+	 * discourages having these in UTF-8 documents.
 	 */
 
-	TAILQ_INIT(&mq);
+	*beg = 0;
+	if (size >= 3 && memcmp(data, UTF8_BOM, 3) == 0)
+		*beg += 3;
 
-	if (metaq == NULL)
-		metaq = &mq;
+	if ((n = pushnode(doc, MDOWN_DOC_HEADER)) == NULL)
+		return 0;
 
-	/* Initialise the parser. */
-
-	doc->nodes = 0;
-	doc->depth = 0;
-	doc->current = NULL;
-	doc->in_link_body = 0;
-	doc->foots = 0;
-	doc->metaq = metaq;
-
-	TAILQ_INIT(doc->metaq);
-	TAILQ_INIT(&doc->refq);
-	TAILQ_INIT(&doc->footq);
-
-	if ((text = hbuf_new(64)) == NULL)
-		goto out;
-	if (!hbuf_grow(text, size))
-		goto out;
-	if ((root = pushnode(doc, MDOWN_ROOT)) == NULL)
-		goto out;
-
-	/*
-	 * Skip a possible UTF-8 BOM, even though the Unicode standard
-	 * discourages having these in UTF-8 documents.
-	 */
-
-	beg = 0;
-	if (size >= 3 && memcmp(data, UTF8_BOM, 3) == 0)
-		beg += 3;
-
-	/*
-	 * Zeroth pass: metadata.  First process given metadata, then
-	 * in-document metadata, then overriding metadata.  The
-	 * in-document metadata is conditionally processed.
-	 */
-
-	if ((n = pushnode(doc, MDOWN_DOC_HEADER)) == NULL)
-		goto out;
-
-	for (i = 0; i < doc->metasz; i++)
-		if (parse_metadata(doc,
-		    doc->meta[i], strlen(doc->meta[i])) < 0)
-			goto out;
+	for (i = 0; i < doc->metasz; i++)
+		if (parse_metadata(doc,
+		    doc->meta[i], strlen(doc->meta[i])) < 0)
+			return 0;
 
 	/* FIXME: CRLF EOLNs. */
 
 	if ((doc->ext_flags & MDOWN_METADATA) &&
-	    beg < size - 1 &&
-	    isalnum((unsigned char)data[beg])) {
-		sv = &data[beg];
-		for (end = beg + 1; end < size; end++) {
+	    size > 0 && *beg < size - 1 &&
+	    isalnum((unsigned char)data[*beg])) {
+		sv = &data[*beg];
+		for (end = *beg + 1; end < size; end++) {
 			if (data[end] == '\n' &&
 			    data[end - 1] == '\n')
 				break;
 		}
-		if ((c = parse_metadata(doc, sv, end - beg)) > 0)
-			beg = end + 1;
+		if ((c = parse_metadata(doc, sv, end - *beg)) > 0)
+			*beg = end + 1;
 		else if (c < 0)
-			goto out;
+			return 0;
 	}
 
 	for (i = 0; i < doc->metaovrsz; i++)
 		if (parse_metadata(doc,
 		    doc->metaovr[i], strlen(doc->metaovr[i])) < 0)
-			goto out;
+			return 0;
 
 	popnode(doc, n);
+	return 1;
+}
 
-	/*
-	 * First pass: looking for references and footnotes, copying
-	 * everything else.
-	 */
+/*
+ * First pass: looking for references and footnotes in "data" from
+ * "beg" to "size", copying everything else into "text" with tabs
+ * expanded and newlines canonicalised.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+parse_refs(struct mdown_doc *doc, struct mdown_buf *text,
+	const char *data, size_t beg, size_t size)
+{
+	size_t	 end;
+	int	 c;
 
 	while (beg < size) {
 		if (doc->ext_flags & MDOWN_FOOTNOTES) {
@@ -4508,14 +5424,14 @@ mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
 			    beg = end;
 			    continue;
 		    } else if (c < 0)
-			    goto out;
+			    return 0;
 		}
 
 		if ((c = is_ref(doc, data, beg, size, &end)) > 0) {
 			beg = end;
 			continue;
 		} else if (c < 0)
-			goto out;
+			return 0;
 
 		/* Skipping to the next line. */
 
@@ -4528,7 +5444,7 @@ mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
 
 		if (end > beg &&
 		    !expand_tabs(text, data + beg, end - beg))
-			goto out;
+			return 0;
 
 		/* Add one \n per newline. */
 
@@ -4537,13 +5453,472 @@ mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
 			if (data[end] == '\n' ||
 			    (end + 1 < size && data[end + 1] != '\n'))
 				if (!hbuf_putc(text, '\n'))
-					goto out;
+					return 0;
 			end++;
 		}
 
 		beg = end;
 	}
 
+	return 1;
+}
+
+/*
+ * Initialise the parser for a new document.
+ */
+static void
+parse_init(struct mdown_doc *doc, struct mdown_metaq *metaq)
+{
+
+	doc->nodes = 0;
+	doc->src = NULL;
+	doc->srcsz = 0;
+	doc->depth = 0;
+	doc->current = NULL;
+	doc->in_link_body = 0;
+	doc->foots = 0;
+	doc->metaq = metaq;
+	doc->smarty = NULL;
+
+	TAILQ_INIT(doc->metaq);
+	TAILQ_INIT(&doc->refq);
+	TAILQ_INIT(&doc->footq);
+	doc->reftab.key = link_ref_key;
+	doc->foottab.key = foot_ref_key;
+}
+
+/*
+ * Whether the block starting at line "k" of the line index might be
+ * the title of a definition list, which would then be merged into a
+ * definition list before it: see parse_definition().
+ */
+static int
+chunk_deflist(const struct mdown_doc *doc, size_t k)
+{
+	const struct line	*p;
+
+	if (!(doc->ext_flags & MDOWN_DEFLIST))
+		return 0;
+	for (k++; k < doc->linesz; k++) {
+		p = &doc->lines[k];
+		if (!(p->probe & BLOCK_EMPTY))
+			return (probe_indent(p->probe, p->indent) &
+				BLOCK_DLI) != 0;
+	}
+	return 0;
+}
+
+/*
+ * Split the document text into chunks of at least "min" bytes for
+ * parse_chunks().  Chunks begin with a letter or a hash mark after a
+ * blank line, as no block can reach past such a line (see
+ * stream_flush()) but for fenced code and HTML blocks, which are
+ * tracked here.  Fences aren't always where they seem (e.g., within a
+ * paragraph), so parse_chunks() checks the split afterward.
+ * Sets "offs" to the offsets of the chunks.
+ * Returns the number of chunks, or zero on failure (memory).
+ */
+static size_t
+chunk_split(struct mdown_doc *doc, size_t min, size_t **offs)
+{
+	const struct line	*p;
+	const char		*data;
+	struct mdown_buf	 lang;
+	size_t			 k, beg, len, end, html = 0, w = 0,
+				 w2, width = 0, width2, offsz = 0,
+				 offmax = 0;
+	unsigned int		 probe;
+	char			 chr = 0, chr2;
+	int			 fence = 0;
+	void			*pp;
+
+	/* The first chunk starts with the text. */
+
+	if ((*offs = malloc(32 * sizeof(size_t))) == NULL)
+		return 0;
+	offmax = 32;
+	(*offs)[offsz++] = 0;
+
+	for (k = 0; k < doc->linesz; k++) {
+		p = &doc->lines[k];
+		beg = p->beg;
+		data = doc->src + beg;
+		len = p[1].beg - beg;
+		if (data[len - 1] == '\n')
+			len--;
+		probe = probe_indent(p->probe, p->indent);
+
+		/* HTML blocks run to their closing tag. */
+
+		if ((probe & BLOCK_HTML) &&
+		    (end = htmlblock_end(doc,
+		     data, doc->srcsz - beg)) > 0 &&
+		    beg + end > html)
+			html = beg + end;
+		if (beg < html)
+			continue;
+
+		/* Fenced code runs to its closing fence. */
+
+		if ((doc->ext_flags & MDOWN_FENCED) &&
+		    (probe & BLOCK_FENCE)) {
+			if (!fence) {
+				memset(&lang, 0, sizeof(struct mdown_buf));
+				w = parse_codefence((char *)data,
+					len, &lang, &width, &chr);
+				fence = w > 0;
+			} else {
+				w2 = is_codefence(data,
+					len, &width2, &chr2);
+				if (w == w2 &&
+				    width == width2 &&
+				    chr == chr2 &&
+				    is_empty(data + w2, len - w2))
+					fence = 0;
+			}
+			continue;
+		}
+
+		if (fence || k == 0 ||
+		    !(doc->lines[k - 1].probe & BLOCK_EMPTY) ||
+		    !(isalpha((unsigned char)data[0]) ||
+		      data[0] == '#') ||
+		    beg - (*offs)[offsz - 1] < min ||
+		    chunk_deflist(doc, k))
+			continue;
+
+		if (offsz == offmax) {
+			offmax *= 2;
+			pp = reallocarray(*offs, offmax, sizeof(size_t));
+			if (pp == NULL) {
+				free(*offs);
+				*offs = NULL;
+				return 0;
+			}
+			*offs = pp;
+		}
+		(*offs)[offsz++] = beg;
+	}
+
+	return offsz;
+}
+
+/*
+ * Parse the chunk "c" of "doc" with a parser of its own, which is a
+ * copy of the document's.
+ * Sets "c->rc" on success.
+ */
+static void
+chunk_parse(const struct mdown_doc *doc, struct chunk *c)
+{
+	struct mdown_doc	*d;
+
+	if ((d = c->doc = malloc(sizeof(struct mdown_doc))) == NULL)
+		return;
+	*d = *doc;
+	d->chunk = c;
+	d->arena = NULL;
+	d->nodes = 0;
+	d->depth = 0;
+	d->current = NULL;
+	d->in_link_body = 0;
+	d->emph = NULL;
+	d->smarty = NULL;
+	d->footv = NULL;
+	d->foots = d->footvmax = 0;
+	d->linecur = 0;
+	d->lineok = c->data;
+
+	if (doc->foottab.count > 0 &&
+	    (c->footused = calloc(doc->foottab.count, 1)) == NULL)
+		return;
+	if ((d->arena = arena_new()) == NULL)
+		return;
+	if ((c->root = pushnode(d, MDOWN_ROOT)) == NULL)
+		return;
+	if (!parse_block(d, c->data, c->size))
+		return;
+	if (!parse_smarty(d, c->root, NULL))
+		return;
+	popnode(d, c->root);
+	c->rc = 1;
+}
+
+static void
+chunk_free(struct chunk *c)
+{
+
+	if (c->doc != NULL) {
+		arena_free(c->doc->arena);
+		free(c->doc);
+	}
+	free(c->foots);
+	free(c->footused);
+	free(c->saves);
+	hbuf_free(c->saved);
+}
+
+/*
+ * Undo the chunk's changes to the document text (see chunk_save()),
+ * latest first, as nested block quotes rewrite the same text again.
+ */
+static void
+chunk_restore(struct chunk *c)
+{
+	size_t	 i, off;
+
+	if (c->saved == NULL)
+		return;
+	off = c->saved->size;
+	for (i = c->savesz; i > 0; i--) {
+		off -= c->saves[i - 1].size;
+		memcpy(c->saves[i - 1].at,
+			c->saved->data + off, c->saves[i - 1].size);
+	}
+}
+
+/*
+ * Parse chunks from the shared queue until none are left.
+ */
+static void *
+chunk_worker(void *arg)
+{
+	struct chunkq	*cq = arg;
+	size_t		 i;
+
+	for (;;) {
+		if (pthread_mutex_lock(&cq->mutex) != 0)
+			abort();
+		i = cq->next < cq->chunksz ? cq->next++ : cq->chunksz;
+		if (pthread_mutex_unlock(&cq->mutex) != 0)
+			abort();
+		if (i == cq->chunksz)
+			break;
+		chunk_parse(cq->doc, &cq->chunks[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Give "n", parsed in a chunk, and its descendents an identifier
+ * offset by "base" in the document and the document's arena "a".
+ */
+static void
+chunk_node(struct mdown_node *n, size_t base, struct mdown_arena *a)
+{
+	struct mdown_node	*nn;
+
+	n->id += base;
+	n->arena = a;
+	TAILQ_FOREACH(nn, &n->children, entries)
+		chunk_node(nn, base, a);
+}
+
+/*
+ * Move the blocks of chunk "c" to the end of "root", numbering nodes
+ * and footnotes after those already in the document.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+chunk_join(struct mdown_doc *doc,
+	struct mdown_node *root, struct chunk *c)
+{
+	struct mdown_node	*n;
+	struct chunk_foot	*f;
+	size_t			 i, base;
+
+	/* The chunk's root took the first identifier. */
+
+	base = doc->nodes - 1;
+	while ((n = TAILQ_FIRST(&c->root->children)) != NULL) {
+		TAILQ_REMOVE(&c->root->children, n, entries);
+		TAILQ_INSERT_TAIL(&root->children, n, entries);
+		n->parent = root;
+		chunk_node(n, base, doc->arena);
+	}
+	doc->nodes += c->doc->nodes - 1;
+
+	/*
+	 * A footnote already referenced from an earlier chunk is left
+	 * as text, as char_link() does.
+	 */
+
+	for (i = 0; i < c->footsz; i++) {
+		f = &c->foots[i];
+		if (f->ref->is_used) {
+			f->n->type = MDOWN_NORMAL_TEXT;
+			f->n->rndr_normal_text.text = f->text;
+			continue;
+		}
+		if (!use_foot_ref(doc, f->ref))
+			return 0;
+		f->n->rndr_footnote_ref->num = f->ref->num;
+	}
+
+	arena_merge(doc->arena, c->doc->arena);
+	c->doc->arena = NULL;
+	return 1;
+}
+
+/*
+ * Like parse_block() for the document text, but split into chunks (see
+ * chunk_split()) parsed on up to "doc->jobs" threads, then put together
+ * under "root" as if parsed all at once.
+ * If a chunk turns out to have ended within a block, the text is
+ * restored and parsed all at once.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+parse_chunks(struct mdown_doc *doc, struct mdown_node *root)
+{
+	struct chunkq		 cq;
+	struct chunk		*c;
+	const struct mdown_node	*first, *last;
+	pthread_t		*threads = NULL;
+	size_t			*offs = NULL, i, min, nthreads = 0;
+	char			*text = (char *)doc->src;
+	int			 rc = 0, split = 1;
+
+	memset(&cq, 0, sizeof(struct chunkq));
+
+	if ((min = doc->srcsz / (doc->jobs * 4)) < CHUNK_MIN)
+		min = CHUNK_MIN;
+	if ((cq.chunksz = chunk_split(doc, min, &offs)) == 0)
+		goto out;
+	if (cq.chunksz == 1) {
+		rc = parse_block(doc, text, doc->srcsz);
+		goto out;
+	}
+
+	if ((cq.chunks = calloc
+	     (cq.chunksz, sizeof(struct chunk))) == NULL ||
+	    (threads = calloc
+	     (doc->jobs - 1, sizeof(pthread_t))) == NULL)
+		goto out;
+
+	for (i = 0; i < cq.chunksz; i++) {
+		c = &cq.chunks[i];
+		c->data = text + offs[i];
+		c->size = (i + 1 < cq.chunksz ?
+			offs[i + 1] : doc->srcsz) - offs[i];
+	}
+
+	cq.doc = doc;
+	if (pthread_mutex_init(&cq.mutex, NULL) != 0)
+		goto out;
+
+	/* This thread parses chunks along with the others. */
+
+	while (nthreads < doc->jobs - 1 && nthreads + 1 < cq.chunksz &&
+	    pthread_create(&threads[nthreads],
+	    NULL, chunk_worker, &cq) == 0)
+		nthreads++;
+	chunk_worker(&cq);
+	for (i = 0; i < nthreads; i++)
+		if (pthread_join(threads[i], NULL) != 0)
+			abort();
+	pthread_mutex_destroy(&cq.mutex);
+
+	for (i = 0; i < cq.chunksz; i++)
+		if (!cq.chunks[i].rc)
+			goto out;
+
+	/*
+	 * Make sure that each chunk ended between blocks: without an
+	 * open fence, and without a definition list that the next
+	 * chunk continues.
+	 */
+
+	for (i = 1; split && i < cq.chunksz; i++) {
+		first = TAILQ_FIRST(&cq.chunks[i].root->children);
+		last = TAILQ_LAST(&cq.chunks[i - 1].root->children,
+			mdown_nodeq);
+		if (cq.chunks[i - 1].unsettled ||
+		    (first != NULL && last != NULL &&
+		     first->type == MDOWN_DEFINITION &&
+		     last->type == MDOWN_DEFINITION))
+			split = 0;
+	}
+
+	if (!split) {
+		for (i = 0; i < cq.chunksz; i++)
+			chunk_restore(&cq.chunks[i]);
+		rc = parse_block(doc, text, doc->srcsz);
+		goto out;
+	}
+
+	/*
+	 * Smart typography has already been applied to the chunks, but
+	 * not to the document header before them.
+	 */
+
+	if (!parse_smarty(doc, root, NULL))
+		goto out;
+	for (i = 0; i < cq.chunksz; i++)
+		if (!chunk_join(doc, root, &cq.chunks[i]))
+			goto out;
+	doc->smarty = TAILQ_LAST(&root->children, mdown_nodeq);
+	rc = 1;
+out:
+	if (cq.chunks != NULL)
+		for (i = 0; i < cq.chunksz; i++)
+			chunk_free(&cq.chunks[i]);
+	free(cq.chunks);
+	free(threads);
+	free(offs);
+	return rc;
+}
+
+/*
+ * Parse the buffer in data of length size.
+ * If both mp and mszp are not NULL, set them with the meta information
+ * instead of locally destroying it.
+ * (Obviously only applicable if MDOWN_METADATA has been set.)
+ */
+struct mdown_node *
+mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
+	const char *data, size_t size, struct mdown_metaq *metaq)
+{
+	struct mdown_buf	*text;
+	size_t		 	 beg;
+	struct mdown_node 	*n, *root = NULL;
+	struct mdown_metaq	 mq;
+	int			 rc = 0;
+
+	/*
+	 * Have a temporary "mq" if "metaq" is not set.  We clear this
+	 * automatically at the tail of the function.
+	 */
+
+	TAILQ_INIT(&mq);
+
+	if (metaq == NULL)
+		metaq = &mq;
+
+	stream_free(doc);
+	parse_init(doc, metaq);
+
+	if ((text = hbuf_new(64)) == NULL)
+		goto out;
+	if (!hbuf_reserve(text, size + 1))
+		goto out;
+
+	/*
+	 * All nodes and node data are allocated from an arena that
+	 * belongs to the root node: see mdown_node_free().
+	 */
+
+	if ((doc->arena = arena_new()) == NULL)
+		goto out;
+	if ((root = pushnode(doc, MDOWN_ROOT)) == NULL)
+		goto out;
+
+	if (!parse_doc_header(doc, data, size, &beg))
+		goto out;
+	if (!parse_refs(doc, text, data, beg, size))
+		goto out;
+
 	/*
 	 * Second pass (after header): rendering the document body and
 	 * footnotes.
@@ -4555,7 +5930,24 @@ mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
 		    text->data[text->size - 1] != '\r')
 			if (!hbuf_putc(text, '\n'))
 				goto out;
-		if (!parse_block(doc, text->data, text->size))
+
+		/*
+		 * Hand the text over to the tree, which lets nodes
+		 * reference it instead of copying: see pushbuf().
+		 */
+
+		if (!arena_adopt(doc->arena, text->data))
+			goto out;
+		doc->src = text->data;
+		doc->srcsz = text->size;
+		text->data = NULL;
+		if (!line_init(doc))
+			goto out;
+		if (doc->jobs > 1) {
+			if (!parse_chunks(doc, root))
+				goto out;
+		} else if (!parse_block(doc,
+		    (char *)doc->src, doc->srcsz))
 			goto out;
 	}
 
@@ -4569,11 +5961,14 @@ mdown_doc_parse(struct mdown_doc *doc, size_t *maxn,
 		goto out;
 	popnode(doc, n);
 
+	if (!parse_smarty(doc, root, NULL))
+		goto out;
+
 	rc = 1;
 out:
 	hbuf_free(text);
-	free_link_refs(&doc->refq);
-	free_foot_refq(&doc->footq);
+	free_link_refs(doc);
+	free_foot_refq(doc);
 	mdown_metaq_free(&mq);
 
 	if (rc) {
@@ -4582,12 +5977,421 @@ out:
 		popnode(doc, root);
 		assert(doc->depth == 0);
 	} else {
-		mdown_node_free(root);
+		arena_free(doc->arena);
 		root = NULL;
 	}
+	doc->arena = NULL;
+	doc->src = NULL;
+	doc->srcsz = 0;
 	return root;
 }
 
+/*
+ * Release all streaming state.
+ */
+static void
+stream_free(struct mdown_doc *doc)
+{
+	struct stream	*st = doc->stream;
+
+	if (st == NULL)
+		return;
+
+	free_link_refs(doc);
+	free_foot_refq(doc);
+	mdown_metaq_free(&st->mq);
+	if (doc->arena != st->keep)
+		arena_free(doc->arena);
+	arena_free(st->keep);
+	hbuf_free(st->raw);
+	hbuf_free(st->text);
+	hbuf_free(st->work);
+	free(st);
+
+	doc->stream = NULL;
+	doc->arena = NULL;
+	doc->src = NULL;
+	doc->srcsz = 0;
+}
+
+/*
+ * Start a tree for a batch of streamed blocks.
+ * Its root has the identifier of the document root, which it stands
+ * in for, so it does not consume an identifier.
+ * Returns the root or NULL on failure (memory).
+ */
+static struct mdown_node *
+stream_root(struct mdown_doc *doc)
+{
+	struct mdown_node	*root;
+
+	assert(doc->arena == NULL);
+	assert(doc->current == NULL);
+	if ((doc->arena = arena_new()) == NULL)
+		return NULL;
+	if ((root = pushnode(doc, MDOWN_ROOT)) == NULL)
+		return NULL;
+	root->id = 0;
+	doc->nodes--;
+	doc->smarty = NULL;
+	return root;
+}
+
+/*
+ * Hand the children of "root" over to the callback, stopping short of
+ * "last" (if not NULL), then release the tree.
+ * Smart typography is only applied here, as blocks following "last"
+ * may be parsed again.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+stream_emit(struct mdown_doc *doc,
+	struct mdown_node *root, const struct mdown_node *last)
+{
+	const struct mdown_node	*n;
+	int				 rc = 1;
+
+	if (!parse_smarty(doc, root, last))
+		rc = 0;
+	else
+		TAILQ_FOREACH(n, &root->children, entries) {
+			if (n == last)
+				break;
+			if (!doc->stream->cb(n, doc->stream->arg)) {
+				rc = 0;
+				break;
+			}
+		}
+
+	popnode(doc, root);
+	assert(doc->depth == 0);
+	arena_free(doc->arena);
+	doc->arena = NULL;
+	doc->src = NULL;
+	doc->srcsz = 0;
+	return rc;
+}
+
+/*
+ * Whether the top-level block "n", parsed from "data" as the last
+ * thing in the buffer so far, might be parsed differently when more
+ * data arrives.  This is only an issue for HTML blocks, which may look
+ * arbitrarily far ahead for their closing tag: see parse_htmlblock().
+ */
+static int
+stream_unsettled(const struct mdown_node *n,
+	const char *data, size_t size)
+{
+	size_t	 i, end;
+
+	if (size < 2 || data[0] != '<')
+		return 0;
+
+	/*
+	 * A block found in strict mode is settled if there's a blank
+	 * line (not the end of input) after it and its last line is
+	 * not indented, as later data cannot produce an earlier end.
+	 */
+
+	if (n->type == MDOWN_BLOCKHTML) {
+		end = n->rndr_blockhtml.text.size;
+		if (end >= size || !is_empty(data + end, size - end))
+			return 1;
+		for (i = end - 1; i > 0 && data[i - 1] != '\n'; i--)
+			continue;
+		return i > 0 && data[i] == ' ';
+	}
+
+	/* Otherwise, is this something that could become a block? */
+
+	if (size > 5 && data[1] == '!' &&
+	    data[2] == '-' && data[3] == '-')
+		return 1;
+	if (size > 4 &&
+	    (data[1] == 'h' || data[1] == 'H') &&
+	    (data[2] == 'r' || data[2] == 'R'))
+		return 1;
+
+	i = 1;
+	while (i < size && data[i] != '>' && data[i] != ' ')
+		i++;
+	return i >= size || hhtml_find_block(data + 1, i - 1) != NULL;
+}
+
+/*
+ * Roll back the parse to where it stood before a top-level block
+ * that we're going to parse again: node identifiers and footnote
+ * numbers assigned since then are released.
+ */
+static void
+stream_rewind(struct mdown_doc *doc, size_t nodes, size_t foots)
+{
+
+	doc->nodes = nodes;
+	for ( ; doc->foots > foots; doc->foots--) {
+		doc->footv[doc->foots - 1]->is_used = 0;
+		doc->footv[doc->foots - 1]->num = 0;
+	}
+}
+
+/*
+ * Parse the preprocessed text and pass completed top-level blocks to
+ * the callback, keeping the rest for later.
+ * A block is complete once it is followed by another that starts after
+ * a blank line with a letter or a hash mark: no block can reach past
+ * such a line, so the following text may be parsed on its own.
+ * The exceptions, definition lists (which merge with a prior one) and
+ * unsettled HTML blocks, are handled specially.
+ * So are blocks with references not yet defined: they're held back
+ * (along with all following blocks) until the definition arrives or
+ * the input ends, as definitions may follow their use.
+ * If "final", everything is parsed and passed on, followed by the
+ * footnotes and document footer.
+ * Blocks may be parsed more than once, but some parsers (e.g., for
+ * block quotes) rewrite their input, so unless this is the last time,
+ * we parse a copy of the text.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+stream_flush(struct mdown_doc *doc, int final)
+{
+	struct stream		*st = doc->stream;
+	struct mdown_buf	*text = st->text, *buf = text;
+	struct mdown_node	*root, *last, *n, *prev;
+	struct mdown_node	*cut = NULL;
+	size_t			 beg = 0, cutbeg = 0, nodes, foots,
+				 cutnodes, cutfoots, nodes0, foots0;
+	ssize_t			 rc;
+
+	if (!final && (text->size == 0 || text->size < st->next))
+		return 1;
+
+	if (!final) {
+		hbuf_truncate(st->work);
+		if (!hbuf_putb(st->work, text))
+			return 0;
+		buf = st->work;
+	}
+
+	if ((root = stream_root(doc)) == NULL)
+		return 0;
+
+	doc->src = buf->data;
+	doc->srcsz = buf->size;
+	if (!line_init(doc))
+		goto err;
+	cutnodes = nodes0 = doc->nodes;
+	cutfoots = foots0 = doc->foots;
+
+	while (beg < text->size) {
+		last = TAILQ_LAST(&root->children, mdown_nodeq);
+		nodes = doc->nodes;
+		foots = doc->foots;
+		st->unresolved = 0;
+		rc = parse_block_one(doc,
+			buf->data + beg, buf->size - beg);
+		if (rc < 0)
+			goto err;
+
+		/*
+		 * Use the first block we've added: some blocks (e.g.,
+		 * paragraphs with a header underline) add more than one.
+		 */
+
+		n = last == NULL ? TAILQ_FIRST(&root->children) :
+			TAILQ_NEXT(last, entries);
+
+		if (!final && n != NULL) {
+			if (beg >= 2 &&
+			    text->data[beg - 1] == '\n' &&
+			    text->data[beg - 2] == '\n' &&
+			    (isalpha((unsigned char)text->data[beg]) ||
+			     text->data[beg] == '#')) {
+				cut = n;
+				cutbeg = beg;
+				cutnodes = nodes;
+				cutfoots = foots;
+			}
+			if (st->unresolved || stream_unsettled(n,
+			    text->data + beg, text->size - beg))
+				break;
+		}
+		beg += rc;
+	}
+
+	if (final) {
+		if ((doc->ext_flags & MDOWN_FOOTNOTES) &&
+		    !parse_footnote_list(doc))
+			goto err;
+		if ((n = pushnode(doc, MDOWN_DOC_FOOTER)) == NULL)
+			goto err;
+		popnode(doc, n);
+		return stream_emit(doc, root, NULL);
+	}
+
+	/*
+	 * The last cut may have been invalidated: its block might
+	 * have been merged into a definition list, or it might follow
+	 * one that it could later be merged into.
+	 */
+
+	if (cut != NULL &&
+	    (cut->parent != root ||
+	     (prev = TAILQ_PREV(cut, mdown_nodeq, entries)) == NULL ||
+	     prev->type == MDOWN_DEFINITION)) {
+		cut = NULL;
+	}
+
+	if (cut == NULL) {
+		stream_rewind(doc, nodes0, foots0);
+		st->next = text->size * 2;
+		return stream_emit(doc, root,
+			TAILQ_FIRST(&root->children));
+	}
+
+	stream_rewind(doc, cutnodes, cutfoots);
+	if (!stream_emit(doc, root, cut))
+		return 0;
+
+	memmove(text->data, text->data + cutbeg, text->size - cutbeg);
+	text->size -= cutbeg;
+	st->next = text->size * 2;
+	return 1;
+err:
+	return 0;
+}
+
+/*
+ * Preprocess streamed input up to the last line that can't be part of
+ * a reference or footnote definition begun before it (the same rule as
+ * for blocks in stream_flush()), then flush.
+ * If "final", all input is processed.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+stream_input(struct mdown_doc *doc, int final)
+{
+	struct stream		*st = doc->stream;
+	struct mdown_buf	*raw = st->raw;
+	struct mdown_node	*root;
+	size_t			 i, cut = 0, beg = 0;
+	const char		*d = raw->data;
+
+	for (i = st->scan < 2 ? 2 : st->scan; i < raw->size; i++)
+		if (d[i - 1] == '\n' &&
+		    (d[i - 2] == '\n' ||
+		     (i > 2 && d[i - 2] == '\r' && d[i - 3] == '\n')) &&
+		    (isalpha((unsigned char)d[i]) || d[i] == '#'))
+			cut = i;
+	st->scan = raw->size;
+
+	if (final)
+		cut = raw->size;
+	else if (cut == 0)
+		return 1;
+
+	/*
+	 * The document header goes first.  In-document metadata runs
+	 * to the first blank line, so make sure that we have it.
+	 */
+
+	if (!st->header) {
+		if (!final) {
+			for (i = 1; i < cut; i++)
+				if (d[i] == '\n' && d[i - 1] == '\n')
+					break;
+			if (i == cut)
+				return 1;
+		}
+		if ((root = stream_root(doc)) == NULL)
+			return 0;
+		if (!parse_doc_header(doc, d, cut, &beg))
+			return 0;
+		if (!stream_emit(doc, root, NULL))
+			return 0;
+		st->header = 1;
+	}
+
+	/*
+	 * Reference and footnote definitions are used by all blocks to
+	 * come, so they're allocated from the stream's arena.
+	 */
+
+	doc->arena = st->keep;
+	if (!parse_refs(doc, st->text, d, beg, cut))
+		return 0;
+	doc->arena = NULL;
+
+	memmove(raw->data, raw->data + cut, raw->size - cut);
+	raw->size -= cut;
+	st->scan -= cut;
+
+	if (final && st->text->size &&
+	    st->text->data[st->text->size - 1] != '\n' &&
+	    st->text->data[st->text->size - 1] != '\r')
+		if (!hbuf_putc(st->text, '\n'))
+			return 0;
+
+	return stream_flush(doc, final);
+}
+
+int
+mdown_doc_stream(struct mdown_doc *doc, struct mdown_metaq *metaq,
+	int (*cb)(const struct mdown_node *, void *), void *arg)
+{
+	struct stream	*st;
+
+	stream_free(doc);
+
+	if ((st = calloc(1, sizeof(struct stream))) == NULL)
+		return 0;
+	doc->stream = st;
+	st->cb = cb;
+	st->arg = arg;
+	TAILQ_INIT(&st->mq);
+
+	parse_init(doc, metaq == NULL ? &st->mq : metaq);
+
+	/* The document root has the first identifier. */
+
+	doc->nodes = 1;
+
+	if ((st->keep = arena_new()) == NULL ||
+	    (st->raw = hbuf_new(HBUF_START_STREAM)) == NULL ||
+	    (st->text = hbuf_new(HBUF_START_STREAM)) == NULL ||
+	    (st->work = hbuf_new(HBUF_START_STREAM)) == NULL) {
+		stream_free(doc);
+		return 0;
+	}
+
+	return 1;
+}
+
+int
+mdown_doc_feed(struct mdown_doc *doc, const char *data, size_t sz)
+{
+
+	if (doc->stream == NULL)
+		return 0;
+	if (hbuf_put(doc->stream->raw, data, sz) &&
+	    stream_input(doc, 0))
+		return 1;
+	stream_free(doc);
+	return 0;
+}
+
+int
+mdown_doc_finish(struct mdown_doc *doc, size_t *maxn)
+{
+	int	 rc;
+
+	if (doc->stream == NULL)
+		return 0;
+	if ((rc = stream_input(doc, 1)) && maxn != NULL)
+		*maxn = doc->nodes;
+	stream_free(doc);
+	return rc;
+}
 void
 mdown_node_free(struct mdown_node *p)
 {
@@ -4596,6 +6400,19 @@ mdown_node_free(struct mdown_node *p)
 	if (p == NULL)
 		return;
 
+	/*
+	 * Nodes from the parser live in an arena owned by the root.
+	 * Freeing the root releases the arena in one go; freeing any
+	 * other node of the tree is a no-op, as its memory goes away
+	 * with the root.
+	 */
+
+	if (p->arena != NULL) {
+		if (p->type == MDOWN_ROOT)
+			arena_free(p->arena);
+		return;
+	}
+
 	switch (p->type) {
 	case MDOWN_META:
 		hbuf_free(&p->rndr_meta.key);
@@ -4616,14 +6433,20 @@ mdown_node_free(struct mdown_node *p)
 		hbuf_free(&p->rndr_raw_html.text);
 		break;
 	case MDOWN_LINK:
-		hbuf_free(&p->rndr_link.link);
-		hbuf_free(&p->rndr_link.title);
-		hbuf_free(&p->rndr_link.attr_cls);
-		hbuf_free(&p->rndr_link.attr_id);
+		if (p->rndr_link == NULL)
+			break;
+		hbuf_free(&p->rndr_link->link);
+		hbuf_free(&p->rndr_link->title);
+		hbuf_free(&p->rndr_link->attr_cls);
+		hbuf_free(&p->rndr_link->attr_id);
+		free(p->rndr_link);
 		break;
 	case MDOWN_BLOCKCODE:
-		hbuf_free(&p->rndr_blockcode.text);
-		hbuf_free(&p->rndr_blockcode.lang);
+		if (p->rndr_blockcode == NULL)
+			break;
+		hbuf_free(&p->rndr_blockcode->text);
+		hbuf_free(&p->rndr_blockcode->lang);
+		free(p->rndr_blockcode);
 		break;
 	case MDOWN_BLOCKHTML:
 		hbuf_free(&p->rndr_blockhtml.text);
@@ -4632,14 +6455,17 @@ mdown_node_free(struct mdown_node *p)
 		free(p->rndr_table_header.flags);
 		break;
 	case MDOWN_IMAGE:
-		hbuf_free(&p->rndr_image.link);
-		hbuf_free(&p->rndr_image.title);
-		hbuf_free(&p->rndr_image.dims);
-		hbuf_free(&p->rndr_image.alt);
-		hbuf_free(&p->rndr_image.attr_width);
-		hbuf_free(&p->rndr_image.attr_height);
-		hbuf_free(&p->rndr_image.attr_cls);
-		hbuf_free(&p->rndr_image.attr_id);
+		if (p->rndr_image == NULL)
+			break;
+		hbuf_free(&p->rndr_image->link);
+		hbuf_free(&p->rndr_image->title);
+		hbuf_free(&p->rndr_image->dims);
+		hbuf_free(&p->rndr_image->alt);
+		hbuf_free(&p->rndr_image->attr_width);
+		hbuf_free(&p->rndr_image->attr_height);
+		hbuf_free(&p->rndr_image->attr_cls);
+		hbuf_free(&p->rndr_image->attr_id);
+		free(p->rndr_image);
 		break;
 	case MDOWN_MATH_BLOCK:
 		hbuf_free(&p->rndr_math.text);
@@ -4648,8 +6474,11 @@ mdown_node_free(struct mdown_node *p)
 		hbuf_free(&p->rndr_footnote_def.key);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		hbuf_free(&p->rndr_footnote_ref.def);
-		hbuf_free(&p->rndr_footnote_ref.key);
+		if (p->rndr_footnote_ref == NULL)
+			break;
+		hbuf_free(&p->rndr_footnote_ref->def);
+		hbuf_free(&p->rndr_footnote_ref->key);
+		free(p->rndr_footnote_ref);
 		break;
 	default:
 		break;
@@ -4687,6 +6516,8 @@ mdown_doc_free(struct mdown_doc *doc)
 	if (doc == NULL)
 		return;
 
+	stream_free(doc);
+
 	for (i = 0; i < doc->metasz; i++)
 		free(doc->meta[i]);
 	for (i = 0; i < doc->metaovrsz; i++)
@@ -4694,5 +6525,6 @@ mdown_doc_free(struct mdown_doc *doc)
 
 	free(doc->meta);
 	free(doc->metaovr);
+	free(doc->lines);
 	free(doc);
 }
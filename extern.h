@@ -18,6 +18,33 @@
 #define EXTERN_H
 
 int	 	 smarty(struct mdown_node *, size_t, enum mdown_type);
+int		 smarty_top(struct mdown_node *, size_t *);
+
+int		 arena_adopt(struct mdown_arena *, void *);
+void		 arena_merge(struct mdown_arena *, struct mdown_arena *);
+void		*arena_calloc(struct mdown_arena *, size_t, size_t);
+void		 arena_free(struct mdown_arena *);
+struct mdown_arena *arena_new(void);
+
+/*
+ * A tree laid out in pre-order: see flat_new().
+ */
+#define		 FLAT_NONE	 SIZE_MAX
+struct	flat_node {
+	const struct mdown_node	*n; /* indexed node */
+	size_t			 parent; /* index or FLAT_NONE */
+	size_t			 child; /* first child or FLAT_NONE */
+	size_t			 next; /* next sibling or FLAT_NONE */
+};
+
+struct	flat {
+	struct flat_node	*nodes; /* nodes in pre-order */
+	size_t			 nodesz; /* number of nodes */
+};
+
+void		 flat_free(struct flat *);
+int		 flat_new(struct flat *, const struct mdown_node *);
+struct mdown_node *flat_tree(const struct flat *);
 
 int32_t	 	 entity_find_iso(const struct mdown_buf *);
 const char	*entity_find_tex(const struct mdown_buf *, unsigned char *);
@@ -38,6 +65,7 @@ int		 hbuf_putb(struct mdown_buf *, const struct mdown_buf *);
 int		 hbuf_putc(struct mdown_buf *, char);
 int		 hbuf_putf(struct mdown_buf *, FILE *);
 int		 hbuf_puts(struct mdown_buf *, const char *);
+int		 hbuf_reserve(struct mdown_buf *, size_t);
 void		 hbuf_truncate(struct mdown_buf *);
 int		 hbuf_shortlink(struct mdown_buf *, const struct mdown_buf *);
 
@@ -52,8 +80,23 @@ int		 hesc_attr(struct mdown_buf *, const char *, size_t);
 int		 hesc_href(struct mdown_buf *, const char *, size_t);
 int		 hesc_html(struct mdown_buf *, const char *, size_t, int, int, int);
 
-char		*rcsdate2str(const char *);
-char		*date2str(const char *);
-char		*rcsauthor2str(const char *);
+/*
+ * Open-addressed table of entries, each with a byte string key given
+ * by the "key" function.
+ */
+struct	htab {
+	void		**tab; /* entries (or NULL) */
+	size_t		  tabsz; /* size of tab (power of 2) */
+	size_t		  count; /* entries in tab */
+	const char	*(*key)(const void *, size_t *); /* entry's key */
+};
+
+void		*htab_find(const struct htab *, const char *, size_t);
+void		 htab_free(struct htab *);
+void		**htab_slot(struct htab *, const char *, size_t);
+
+char		*rcsdate2str(const char *, char *, size_t);
+char		*date2str(const char *, char *, size_t);
+char		*rcsauthor2str(const char *, char *, size_t);
 
 #endif /* !EXTERN_H */
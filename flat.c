@@ -0,0 +1,272 @@
+/*	$Id$ */
+/*
+ * Copyright (c) 2021 Kristaps Dzonsons <kristaps@bsd.lv>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "config.h"
+
+#if HAVE_SYS_QUEUE
+# include <sys/queue.h>
+#endif
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdown.h"
+#include "extern.h"
+
+/*
+ * Replace the data of "b", which is shared with the source tree, with
+ * a copy in the arena.
+ * Like buffers from the parser, the copy is read-only (zero unit).
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+flat_buf(struct mdown_arena *a, struct mdown_buf *b)
+{
+	const char	*data = b->data;
+	size_t		 size = b->size;
+
+	memset(b, 0, sizeof(struct mdown_buf));
+	if (size == 0)
+		return 1;
+	if ((b->data = arena_calloc(a, 1, size + 1)) == NULL)
+		return 0;
+	memcpy(b->data, data, size);
+	b->size = size;
+	return 1;
+}
+
+/*
+ * Make a copy of out-of-line attribute "p" of "sz" bytes in the arena.
+ * Return NULL on failure (memory), the copy on success.
+ */
+static void *
+flat_attr(struct mdown_arena *a, const void *p, size_t sz)
+{
+	void	*cp;
+
+	if ((cp = arena_calloc(a, 1, sz)) != NULL)
+		memcpy(cp, p, sz);
+	return cp;
+}
+
+/*
+ * Copy all data owned by "n", whose attributes were copied as-is from
+ * its source node, into the arena.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+flat_data(struct mdown_arena *a, struct mdown_node *n)
+{
+	enum htbl_flags	*fl;
+
+	switch (n->type) {
+	case MDOWN_META:
+		return flat_buf(a, &n->rndr_meta.key);
+	case MDOWN_NORMAL_TEXT:
+		return flat_buf(a, &n->rndr_normal_text.text);
+	case MDOWN_CODESPAN:
+		return flat_buf(a, &n->rndr_codespan.text);
+	case MDOWN_ENTITY:
+		return flat_buf(a, &n->rndr_entity.text);
+	case MDOWN_LINK_AUTO:
+		return flat_buf(a, &n->rndr_autolink.link);
+	case MDOWN_RAW_HTML:
+		return flat_buf(a, &n->rndr_raw_html.text);
+	case MDOWN_BLOCKHTML:
+		return flat_buf(a, &n->rndr_blockhtml.text);
+	case MDOWN_MATH_BLOCK:
+		return flat_buf(a, &n->rndr_math.text);
+	case MDOWN_FOOTNOTE_DEF:
+		return flat_buf(a, &n->rndr_footnote_def.key);
+	case MDOWN_TABLE_HEADER:
+		if (n->rndr_table_header.flags == NULL)
+			return 1;
+		fl = n->rndr_table_header.flags;
+		n->rndr_table_header.flags = arena_calloc(a,
+			n->rndr_table_header.columns, sizeof(enum htbl_flags));
+		if (n->rndr_table_header.flags == NULL)
+			return 0;
+		memcpy(n->rndr_table_header.flags, fl,
+			n->rndr_table_header.columns * sizeof(enum htbl_flags));
+		return 1;
+	case MDOWN_LINK:
+		if (n->rndr_link == NULL)
+			return 1;
+		n->rndr_link = flat_attr(a, n->rndr_link,
+			sizeof(struct rndr_link));
+		return n->rndr_link != NULL &&
+			flat_buf(a, &n->rndr_link->link) &&
+			flat_buf(a, &n->rndr_link->title) &&
+			flat_buf(a, &n->rndr_link->attr_cls) &&
+			flat_buf(a, &n->rndr_link->attr_id);
+	case MDOWN_BLOCKCODE:
+		if (n->rndr_blockcode == NULL)
+			return 1;
+		n->rndr_blockcode = flat_attr(a, n->rndr_blockcode,
+			sizeof(struct rndr_blockcode));
+		return n->rndr_blockcode != NULL &&
+			flat_buf(a, &n->rndr_blockcode->text) &&
+			flat_buf(a, &n->rndr_blockcode->lang);
+	case MDOWN_FOOTNOTE_REF:
+		if (n->rndr_footnote_ref == NULL)
+			return 1;
+		n->rndr_footnote_ref = flat_attr(a, n->rndr_footnote_ref,
+			sizeof(struct rndr_footnote_ref));
+		return n->rndr_footnote_ref != NULL &&
+			flat_buf(a, &n->rndr_footnote_ref->def) &&
+			flat_buf(a, &n->rndr_footnote_ref->key);
+	case MDOWN_IMAGE:
+		if (n->rndr_image == NULL)
+			return 1;
+		n->rndr_image = flat_attr(a, n->rndr_image,
+			sizeof(struct rndr_image));
+		return n->rndr_image != NULL &&
+			flat_buf(a, &n->rndr_image->link) &&
+			flat_buf(a, &n->rndr_image->title) &&
+			flat_buf(a, &n->rndr_image->dims) &&
+			flat_buf(a, &n->rndr_image->alt) &&
+			flat_buf(a, &n->rndr_image->attr_width) &&
+			flat_buf(a, &n->rndr_image->attr_height) &&
+			flat_buf(a, &n->rndr_image->attr_cls) &&
+			flat_buf(a, &n->rndr_image->attr_id);
+	default:
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Number of nodes in the tree rooted at "n".
+ */
+static size_t
+flat_count(const struct mdown_node *n)
+{
+	const struct mdown_node	*nn;
+	size_t			 sz = 1;
+
+	TAILQ_FOREACH(nn, &n->children, entries)
+		sz += flat_count(nn);
+	return sz;
+}
+
+/*
+ * Append "n" and its children to "f" in pre-order, "n" being a child
+ * of the node at index "parent" (FLAT_NONE for the root).
+ * Returns the index of "n".
+ */
+static size_t
+flat_fill(struct flat *f, size_t parent, const struct mdown_node *n)
+{
+	const struct mdown_node	*nn;
+	size_t			 i, c, prev = FLAT_NONE;
+
+	i = f->nodesz++;
+	f->nodes[i].n = n;
+	f->nodes[i].parent = parent;
+	f->nodes[i].child = f->nodes[i].next = FLAT_NONE;
+
+	TAILQ_FOREACH(nn, &n->children, entries) {
+		c = flat_fill(f, i, nn);
+		if (prev == FLAT_NONE)
+			f->nodes[i].child = c;
+		else
+			f->nodes[prev].next = c;
+		prev = c;
+	}
+	return i;
+}
+
+/*
+ * Lay out the tree rooted at "root" in "f" as an array in pre-order,
+ * each entry giving the indices of its parent, first child and next
+ * sibling.
+ * The index refers to the nodes of the tree, which must outlive it.
+ * Children have greater indices than their parents, so walking the
+ * array backward visits each node after all of its descendants.
+ * The index is freed with flat_free().
+ * Return zero on failure (memory), non-zero on success.
+ */
+int
+flat_new(struct flat *f, const struct mdown_node *root)
+{
+	size_t	 sz;
+
+	memset(f, 0, sizeof(struct flat));
+	sz = flat_count(root);
+	if ((f->nodes = calloc(sz, sizeof(struct flat_node))) == NULL)
+		return 0;
+	flat_fill(f, FLAT_NONE, root);
+	assert(f->nodesz == sz);
+	return 1;
+}
+
+void
+flat_free(struct flat *f)
+{
+
+	free(f->nodes);
+	f->nodes = NULL;
+	f->nodesz = 0;
+}
+
+/*
+ * Copy the tree indexed by "f", whose root must be of type MDOWN_ROOT,
+ * into one array of nodes laid out as the index, all allocated from one
+ * arena belonging to the copied root.
+ * A tree pieced together node by node (as by mdown_diff()) is much
+ * cheaper to walk afterward.
+ * The copy is freed with mdown_node_free().
+ * Returns NULL on failure (memory), the copied root on success.
+ */
+struct mdown_node *
+flat_tree(const struct flat *f)
+{
+	struct mdown_arena	*a;
+	struct mdown_node	*nodes, *n;
+	size_t			 i;
+
+	assert(f->nodesz > 0 && f->nodes[0].n->type == MDOWN_ROOT);
+
+	if ((a = arena_new()) == NULL)
+		return NULL;
+	if ((nodes = arena_calloc
+	    (a, f->nodesz, sizeof(struct mdown_node))) == NULL)
+		goto err;
+
+	/* Parents come first and siblings in order. */
+
+	for (i = 0; i < f->nodesz; i++) {
+		n = &nodes[i];
+		*n = *f->nodes[i].n;
+		n->arena = a;
+		TAILQ_INIT(&n->children);
+		if (f->nodes[i].parent == FLAT_NONE)
+			n->parent = NULL;
+		else {
+			n->parent = &nodes[f->nodes[i].parent];
+			TAILQ_INSERT_TAIL(&n->parent->children, n, entries);
+		}
+		if (!flat_data(a, n))
+			goto err;
+	}
+	return nodes;
+err:
+	arena_free(a);
+	return NULL;
+}
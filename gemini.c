@@ -380,11 +380,11 @@ rndr_flush_linkq(struct gemini *st, struct mdown_buf *out)
 		if (!HBUF_PUTSL(out, "=> "))
 			return 0;
 		if (l->n->type == MDOWN_LINK)
-			rc = hbuf_putb(out, &l->n->rndr_link.link);
+			rc = hbuf_putb(out, &l->n->rndr_link->link);
 		else if (l->n->type == MDOWN_LINK_AUTO)
 			rc = hbuf_putb(out, &l->n->rndr_autolink.link);
 		else if (l->n->type == MDOWN_IMAGE)
-			rc = hbuf_putb(out, &l->n->rndr_image.link);
+			rc = hbuf_putb(out, &l->n->rndr_image->link);
 		else
 			rc = 1;
 		if (!rc)
@@ -738,9 +738,9 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 		if (n->type == MDOWN_LINK_AUTO)
 			rc = hbuf_putb(st->tmp, &n->rndr_autolink.link);
 		else if (n->type == MDOWN_LINK)
-			rc = hbuf_putb(st->tmp, &n->rndr_link.link);
+			rc = hbuf_putb(st->tmp, &n->rndr_link->link);
 		else if (n->type == MDOWN_IMAGE)
-			rc = hbuf_putb(st->tmp, &n->rndr_image.link);
+			rc = hbuf_putb(st->tmp, &n->rndr_image->link);
 		if (!rc)
 			return 0;
 		rc = HBUF_PUTSL(st->tmp, " ") &&
@@ -806,7 +806,7 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 		break;
 	case MDOWN_FOOTNOTE_REF:
 		rc = hbuf_printf(st->tmp, "[%zu]", 
-			n->rndr_footnote_ref.num) &&
+			n->rndr_footnote_ref->num) &&
 			rndr_buf(st, ob, n, st->tmp);
 		break;
 	case MDOWN_RAW_HTML:
@@ -824,7 +824,7 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 			rc = rndr_buf(st, ob, n, &n->rndr_entity.text);
 		break;
 	case MDOWN_BLOCKCODE:
-		rc = rndr_buf(st, ob, n, &n->rndr_blockcode.text);
+		rc = rndr_buf(st, ob, n, &n->rndr_blockcode->text);
 		break;
 	case MDOWN_BLOCKHTML:
 		rc = rndr_buf(st, ob, n, &n->rndr_blockhtml.text);
@@ -833,7 +833,7 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 		rc = rndr_buf(st, ob, n, &n->rndr_codespan.text);
 		break;
 	case MDOWN_IMAGE:
-		rc = rndr_buf(st, ob, n, &n->rndr_image.alt);
+		rc = rndr_buf(st, ob, n, &n->rndr_image->alt);
 		/* FALLTHROUGH */
 	case MDOWN_LINK:
 	case MDOWN_LINK_AUTO:
@@ -46,16 +46,22 @@ struct	hentry {
 	TAILQ_ENTRY(hentry) entries;
 };
 
+TAILQ_HEAD(hentryq, hentry);
+
 /*
  * Our internal state object.
  */
 struct 	html {
-	TAILQ_HEAD(, hentry) 	 headers_used;
+	struct hentryq		 headers_used;
 	ssize_t			 headers_offs; /* header offset */
 	unsigned int 		 flags; /* "oflags" in mdown_opts */
 	int			 noescape; /* don't escape text */
+	size_t			 base; /* start of parent's content */
 };
 
+static int rndr(struct mdown_buf *, struct mdown_metaq *,
+	struct html *, const struct mdown_node *);
+
 /*
  * Escape regular text that shouldn't be HTML.
  * Return zero on failure, non-zero on success.
@@ -124,6 +130,66 @@ escape_attr(struct mdown_buf *ob, const struct mdown_buf *in)
 	return hesc_attr(ob, in->data, in->size);
 }
 
+/*
+ * Render the children of "n" directly into "ob", noting where their
+ * content begins so that block elements can tell whether they're the
+ * first output of their parent.
+ * Return zero on failure, non-zero on success.
+ */
+static int
+rndr_children(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
+{
+	const struct mdown_node	*child;
+	size_t			 base = st->base;
+
+	st->base = ob->size;
+	TAILQ_FOREACH(child, &n->children, entries)
+		if (!rndr(ob, mq, st, child))
+			return 0;
+	st->base = base;
+	return 1;
+}
+
+/*
+ * Like rndr_children(), but into a freshly-allocated buffer.
+ * This is only used when markup depends upon the rendered content of
+ * the children, which is rare.
+ * Returns NULL on failure.
+ */
+static struct mdown_buf *
+rndr_children_buf(struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
+{
+	struct mdown_buf	*tmp;
+
+	if ((tmp = hbuf_new(64)) == NULL)
+		return NULL;
+	if (!rndr_children(tmp, mq, st, n)) {
+		hbuf_free(tmp);
+		return NULL;
+	}
+	return tmp;
+}
+
+/*
+ * Insert "data" of size "sz" into "ob" at offset "pos".
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+insert_at(struct mdown_buf *ob, size_t pos,
+	const char *data, size_t sz)
+{
+
+	assert(pos <= ob->size);
+	if (!hbuf_grow(ob, ob->size + sz))
+		return 0;
+	memmove(ob->data + pos + sz, ob->data + pos, ob->size - pos);
+	memcpy(ob->data + pos, data, sz);
+	ob->size += sz;
+	return 1;
+}
+
 static int
 rndr_autolink(struct mdown_buf *ob, 
 	const struct rndr_autolink *parm,
@@ -166,7 +232,7 @@ rndr_blockcode(struct mdown_buf *ob,
 	const struct rndr_blockcode *parm,
 	const struct html *st)
 {
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 
 	if (parm->lang.size) {
@@ -187,58 +253,57 @@ rndr_blockcode(struct mdown_buf *ob,
 }
 
 static int
-rndr_definition_data(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_definition_data(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<dd>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "\n</dd>\n");
 }
 
 static int
-rndr_definition_title(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_definition_title(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
-	size_t	 sz;
+	size_t	 start;
 
 	if (!HBUF_PUTSL(ob, "<dt>"))
 		return 0;
-	if ((sz = content->size) > 0) {
-		while (sz && content->data[sz - 1] == '\n')
-			sz--;
-		if (!hbuf_put(ob, content->data, sz))
-			return 0;
-	}
+	start = ob->size;
+	if (!rndr_children(ob, mq, st, n))
+		return 0;
+	while (ob->size > start && ob->data[ob->size - 1] == '\n')
+		ob->size--;
 	return HBUF_PUTSL(ob, "</dt>\n");
 }
 
 static int
-rndr_definition(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_definition(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<dl>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</dl>\n");
 }
 
 static int
-rndr_blockquote(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_blockquote(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<blockquote>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</blockquote>\n");
 }
@@ -257,49 +322,49 @@ rndr_codespan(struct mdown_buf *ob,
 }
 
 static int
-rndr_strikethrough(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_strikethrough(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<del>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</del>");
 }
 
 static int
-rndr_double_emphasis(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_double_emphasis(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<strong>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</strong>");
 }
 
 static int
-rndr_emphasis(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_emphasis(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<em>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</em>");
 }
 
 static int
-rndr_highlight(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_highlight(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<mark>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</mark>");
 }
@@ -363,45 +428,63 @@ rndr_header_id(struct mdown_buf *ob,
 }
 
 static int
-rndr_header(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct rndr_header *param, 
-	struct html *st)
+rndr_header(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
-	ssize_t	level;
+	ssize_t			 level;
+	struct mdown_buf	*tmp = NULL;
+	int			 rc = 0;
 
-	level = (ssize_t)param->level + st->headers_offs;
+	level = (ssize_t)n->rndr_header.level + st->headers_offs;
 	if (level < 1)
 		level = 1;
 	else if (level > 6)
 		level = 6;
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
-		return 0;
+	/*
+	 * The identifier is derived from the rendered content, so in
+	 * that case we need the content before emitting the header.
+	 */
 
-	if (content->size && (st->flags & MDOWN_HTML_HEAD_IDS)) {
-		if (!hbuf_printf(ob, "<h%zu id=\"", level))
-			return 0;
-		if (!rndr_header_id(ob, content, st))
+	if (st->flags & MDOWN_HTML_HEAD_IDS) {
+		if ((tmp = rndr_children_buf(mq, st, n)) == NULL)
 			return 0;
+	}
+
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
+		goto out;
+
+	if (tmp != NULL && tmp->size) {
+		if (!hbuf_printf(ob, "<h%zu id=\"", level))
+			goto out;
+		if (!rndr_header_id(ob, tmp, st))
+			goto out;
 		if (!HBUF_PUTSL(ob, "\">"))
-			return 0;
+			goto out;
 	} else {
 		if (!hbuf_printf(ob, "<h%zu>", level))
-			return 0;
+			goto out;
 	}
 
-	if (!hbuf_putb(ob, content))
-		return 0;
-	return hbuf_printf(ob, "</h%zu>\n", level);
+	if (tmp != NULL) {
+		if (!hbuf_putb(ob, tmp))
+			goto out;
+	} else {
+		if (!rndr_children(ob, mq, st, n))
+			goto out;
+	}
+
+	rc = hbuf_printf(ob, "</h%zu>\n", level);
+out:
+	hbuf_free(tmp);
+	return rc;
 }
 
 static int
-rndr_link(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct rndr_link *param,
-	const struct html *st)
+rndr_link(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
+	const struct rndr_link	*param = n->rndr_link;
 
 	if (!HBUF_PUTSL(ob, "<a href=\"") ||
 	    !escape_href(ob, &param->link, st))
@@ -421,7 +504,7 @@ rndr_link(struct mdown_buf *ob,
 			return 0;
 
 	if (!HBUF_PUTSL(ob, "\">") ||
-	    !hbuf_putb(ob, content) ||
+	    !rndr_children(ob, mq, st, n) ||
 	    !HBUF_PUTSL(ob, "</a>"))
 		return 0;
 
@@ -429,12 +512,12 @@ rndr_link(struct mdown_buf *ob,
 }
 
 static int
-rndr_list(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct rndr_list *param)
+rndr_list(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
+	const struct rndr_list	*param = &n->rndr_list;
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (param->flags & HLIST_FL_ORDERED) {
 		if (param->start > 1) {
@@ -448,7 +531,7 @@ rndr_list(struct mdown_buf *ob,
 	} else if (!HBUF_PUTSL(ob, "<ul>\n"))
 		return 0;
 
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 
 	return (param->flags & HLIST_FL_ORDERED) ?
@@ -457,12 +540,35 @@ rndr_list(struct mdown_buf *ob,
 }
 
 static int
-rndr_listitem(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct mdown_node *n)
+rndr_listitem(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
-	size_t	 size;
-	int	 blk = 0;
+	struct mdown_buf	 content;
+	size_t			 pos, start;
+	int			 blk = 0;
+
+	/* Only emit <li> if we're not a <dl> list. */
+
+	if (!(n->rndr_listitem.flags & HLIST_FL_DEF) &&
+	    !HBUF_PUTSL(ob, "<li>"))
+		return 0;
+
+	/* This is where we'd put a <p> (see below). */
+
+	pos = ob->size;
+
+	if (n->rndr_listitem.flags &
+	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
+		HBUF_PUTSL(ob, "<input type=\"checkbox\" ");
+	if (n->rndr_listitem.flags & HLIST_FL_CHECKED)
+		HBUF_PUTSL(ob, "checked=\"checked\" ");
+	if (n->rndr_listitem.flags &
+	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
+		HBUF_PUTSL(ob, "/>");
+
+	start = ob->size;
+	if (!rndr_children(ob, mq, st, n))
+		return 0;
 
 	/*
 	 * If we're in block mode (which can be assigned post factum in
@@ -480,44 +586,31 @@ rndr_listitem(struct mdown_buf *ob,
 	     n->parent != NULL &&
 	     n->parent->type == MDOWN_LIST &&
 	     (n->parent->rndr_list.flags & HLIST_FL_BLOCK))) {
-		if (!(hbuf_strprefix(content, "<ul") ||
-		      hbuf_strprefix(content, "<ol") ||
-		      hbuf_strprefix(content, "<dl") ||
-		      hbuf_strprefix(content, "<div") ||
-		      hbuf_strprefix(content, "<table") ||
-		      hbuf_strprefix(content, "<blockquote") ||
-		      hbuf_strprefix(content, "<pre>") ||
-		      hbuf_strprefix(content, "<h") ||
-		      hbuf_strprefix(content, "<p>")))
+		memset(&content, 0, sizeof(struct mdown_buf));
+		content.data = ob->data + start;
+		content.size = ob->size - start;
+		if (!(hbuf_strprefix(&content, "<ul") ||
+		      hbuf_strprefix(&content, "<ol") ||
+		      hbuf_strprefix(&content, "<dl") ||
+		      hbuf_strprefix(&content, "<div") ||
+		      hbuf_strprefix(&content, "<table") ||
+		      hbuf_strprefix(&content, "<blockquote") ||
+		      hbuf_strprefix(&content, "<pre>") ||
+		      hbuf_strprefix(&content, "<h") ||
+		      hbuf_strprefix(&content, "<p>")))
 			blk = 1;
 	}
 
-	/* Only emit <li> if we're not a <dl> list. */
-
-	if (!(n->rndr_listitem.flags & HLIST_FL_DEF) &&
-	    !HBUF_PUTSL(ob, "<li>"))
-		return 0;
-
-	if (blk && !HBUF_PUTSL(ob, "<p>"))
-		return 0;
-
-	if (n->rndr_listitem.flags &
-	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
-		HBUF_PUTSL(ob, "<input type=\"checkbox\" ");
-	if (n->rndr_listitem.flags & HLIST_FL_CHECKED)
-		HBUF_PUTSL(ob, "checked=\"checked\" ");
-	if (n->rndr_listitem.flags &
-	    (HLIST_FL_CHECKED|HLIST_FL_UNCHECKED))
-		HBUF_PUTSL(ob, "/>");
+	if (blk) {
+		if (!insert_at(ob, pos, "<p>", 3))
+			return 0;
+		start += 3;
+	}
 
 	/* Cut off any trailing space. */
 
-	if ((size = content->size) > 0) {
-		while (size && content->data[size - 1] == '\n')
-			size--;
-		if (!hbuf_put(ob, content->data, size))
-			return 0;
-	}
+	while (ob->size > start && ob->data[ob->size - 1] == '\n')
+		ob->size--;
 
 	if (blk && !HBUF_PUTSL(ob, "</p>"))
 		return 0;
@@ -528,8 +621,12 @@ rndr_listitem(struct mdown_buf *ob,
 	return 1;
 }
 
+/*
+ * Paragraph with hard-wrapping: we need the whole content to know
+ * which newline is the last one.
+ */
 static int
-rndr_paragraph(struct mdown_buf *ob,
+rndr_paragraph_wrap(struct mdown_buf *ob,
 	const struct mdown_buf *content, 
 	struct html *st)
 {
@@ -543,7 +640,7 @@ rndr_paragraph(struct mdown_buf *ob,
 	if (i == content->size)
 		return 1;
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<p>"))
 		return 0;
@@ -578,6 +675,56 @@ rndr_paragraph(struct mdown_buf *ob,
 	return HBUF_PUTSL(ob, "</p>\n");
 }
 
+static int
+rndr_paragraph(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
+{
+	struct mdown_buf	*tmp;
+	size_t			 org, start, i;
+	int			 rc;
+
+	if (st->flags & MDOWN_HTML_HARD_WRAP) {
+		if ((tmp = rndr_children_buf(mq, st, n)) == NULL)
+			return 0;
+		rc = rndr_paragraph_wrap(ob, tmp, st);
+		hbuf_free(tmp);
+		return rc;
+	}
+
+	/*
+	 * Optimistically open the paragraph, then back out if the
+	 * content turns out to be empty or only white-space.
+	 */
+
+	org = ob->size;
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
+		return 0;
+	if (!HBUF_PUTSL(ob, "<p>"))
+		return 0;
+
+	start = ob->size;
+	if (!rndr_children(ob, mq, st, n))
+		return 0;
+
+	for (i = start; i < ob->size; i++)
+		if (!isspace((unsigned char)ob->data[i]))
+			break;
+	if (i == ob->size) {
+		ob->size = org;
+		return 1;
+	}
+
+	/* Strip leading white-space. */
+
+	if (i > start) {
+		memmove(ob->data + start, 
+			ob->data + i, ob->size - i);
+		ob->size -= i - start;
+	}
+
+	return HBUF_PUTSL(ob, "</p>\n");
+}
+
 static int
 rndr_raw_block(struct mdown_buf *ob,
 	const struct rndr_blockhtml *param,
@@ -606,7 +753,7 @@ rndr_raw_block(struct mdown_buf *ob,
 	if (org >= sz)
 		return 1;
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 
 	if (!hbuf_put(ob, param->text.data + org, sz - org))
@@ -615,22 +762,22 @@ rndr_raw_block(struct mdown_buf *ob,
 }
 
 static int
-rndr_triple_emphasis(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_triple_emphasis(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<strong><em>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</em></strong>");
 }
 
 static int
-rndr_hrule(struct mdown_buf *ob)
+rndr_hrule(struct mdown_buf *ob, const struct html *st)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	return hbuf_puts(ob, "<hr/>\n");
 }
@@ -723,64 +870,64 @@ rndr_raw_html(struct mdown_buf *ob,
 }
 
 static int
-rndr_table(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_table(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<table>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</table>\n");
 }
 
 static int
-rndr_table_header(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_table_header(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<thead>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</thead>\n");
 }
 
 static int
-rndr_table_body(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_table_body(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<tbody>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</tbody>\n");
 }
 
 static int
-rndr_tablerow(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_tablerow(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<tr>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</tr>\n");
 }
 
 static int
-rndr_tablecell(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct rndr_table_cell *param)
+rndr_tablecell(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
+	const struct rndr_table_cell	*param = &n->rndr_table_cell;
 
 	if (param->flags & HTBL_FL_HEADER) {
 		if (!HBUF_PUTSL(ob, "<th"))
@@ -809,7 +956,7 @@ rndr_tablecell(struct mdown_buf *ob,
 		break;
 	}
 
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 
 	return (param->flags & HTBL_FL_HEADER) ?
@@ -818,13 +965,13 @@ rndr_tablecell(struct mdown_buf *ob,
 }
 
 static int
-rndr_superscript(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_superscript(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if (!HBUF_PUTSL(ob, "<sup>"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "</sup>");
 }
@@ -839,11 +986,11 @@ rndr_normal_text(struct mdown_buf *ob,
 }
 
 static int
-rndr_footnotes(struct mdown_buf *ob,
-	const struct mdown_buf *content)
+rndr_footnotes(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
-	if (ob->size && !hbuf_putc(ob, '\n'))
+	if (ob->size > st->base && !hbuf_putc(ob, '\n'))
 		return 0;
 	if (!HBUF_PUTSL(ob, "<div class=\"footnotes\">\n"))
 		return 0;
@@ -851,52 +998,56 @@ rndr_footnotes(struct mdown_buf *ob,
 		return 0;
 	if (!HBUF_PUTSL(ob, "<ol>\n"))
 		return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	return HBUF_PUTSL(ob, "\n</ol>\n</div>\n");
 }
 
 static int
-rndr_footnote_def(struct mdown_buf *ob,
-	const struct mdown_buf *content, 
-	const struct rndr_footnote_def *param)
+rndr_footnote_def(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
-	size_t	i = 0;
-	int	pfound = 0;
+	const struct rndr_footnote_def	*param = &n->rndr_footnote_def;
+	const char			*content;
+	char				 anchor[96];
+	size_t				 i = 0, start, size;
+	int				 pfound = 0, len;
+
+	if (!hbuf_printf(ob, "\n<li id=\"fn%zu\">\n", param->num))
+		return 0;
+
+	start = ob->size;
+	if (!rndr_children(ob, mq, st, n))
+		return 0;
 
 	/* Insert anchor at the end of first paragraph block. */
 
-	while ((i + 3) < content->size) {
-		if (content->data[i++] != '<') 
+	content = ob->data + start;
+	size = ob->size - start;
+
+	while ((i + 3) < size) {
+		if (content[i++] != '<') 
 			continue;
-		if (content->data[i++] != '/') 
+		if (content[i++] != '/') 
 			continue;
-		if (content->data[i++] != 'p' && 
-		    content->data[i] != 'P') 
+		if (content[i++] != 'p' && 
+		    content[i] != 'P') 
 			continue;
-		if (content->data[i] != '>') 
+		if (content[i] != '>') 
 			continue;
 		i -= 3;
 		pfound = 1;
 		break;
 	}
 
-	if (!hbuf_printf(ob, "\n<li id=\"fn%zu\">\n", param->num))
-		return 0;
-
 	if (pfound) {
-		if (!hbuf_put(ob, content->data, i))
-			return 0;
-		if (!hbuf_printf(ob, "&#160;"
+		len = snprintf(anchor, sizeof(anchor), "&#160;"
 		    "<a href=\"#fnref%zu\" rev=\"footnote\">"
 		    "&#8617;"
-		    "</a>", param->num))
+		    "</a>", param->num);
+		if (len < 0 || (size_t)len >= sizeof(anchor))
 			return 0;
-		if (!hbuf_put(ob, 
-		    content->data + i, content->size - i))
-			return 0;
-	} else {
-		if (!hbuf_putb(ob, content))
+		if (!insert_at(ob, start + i, anchor, len))
 			return 0;
 	}
 
@@ -944,15 +1095,14 @@ rndr_doc_footer(struct mdown_buf *ob, const struct html *st)
 }
 
 static int
-rndr_root(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct html *st)
+rndr_root(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 
 	if ((st->flags & MDOWN_STANDALONE) && 
    	    !HBUF_PUTSL(ob, "<!DOCTYPE html>\n<html>\n"))
 		    return 0;
-	if (!hbuf_putb(ob, content))
+	if (!rndr_children(ob, mq, st, n))
 		return 0;
 	if (st->flags & MDOWN_STANDALONE)
 		return HBUF_PUTSL(ob, "</html>\n");
@@ -1055,10 +1205,8 @@ rndr_meta(struct mdown_buf *ob,
 }
 
 static int
-rndr_doc_header(struct mdown_buf *ob,
-	const struct mdown_buf *content,
-	const struct mdown_metaq *mq, 
-	const struct html *st)
+rndr_doc_header(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
 	const struct mdown_meta	*m;
 	const char			*author = NULL, *title = NULL,
@@ -1066,9 +1214,22 @@ rndr_doc_header(struct mdown_buf *ob,
 					*copy = NULL, *rcsauthor = NULL, 
 					*rcsdate = NULL, *css = NULL,
 					*script = NULL;
+	char				 rcsauthorbuf[1024], rcsdatebuf[32];
+	size_t				 start;
+
+	/*
+	 * Render the metadata first, as this fills in "mq".
+	 * Its output is only used in standalone mode.
+	 */
+
+	start = ob->size;
+	if (!rndr_children(ob, mq, st, n))
+		return 0;
 
-	if (!(st->flags & MDOWN_STANDALONE))
+	if (!(st->flags & MDOWN_STANDALONE)) {
+		ob->size = start;
 		return 1;
+	}
 
 	TAILQ_FOREACH(m, mq, entries)
 		if (strcasecmp(m->key, "author") == 0)
@@ -1080,9 +1241,11 @@ rndr_doc_header(struct mdown_buf *ob,
 		else if (strcasecmp(m->key, "date") == 0)
 			date = m->value;
 		else if (strcasecmp(m->key, "rcsauthor") == 0)
-			rcsauthor = rcsauthor2str(m->value);
+			rcsauthor = rcsauthor2str(m->value,
+			    rcsauthorbuf, sizeof(rcsauthorbuf));
 		else if (strcasecmp(m->key, "rcsdate") == 0)
-			rcsdate = rcsdate2str(m->value);
+			rcsdate = rcsdate2str(m->value,
+			    rcsdatebuf, sizeof(rcsdatebuf));
 		else if (strcasecmp(m->key, "title") == 0)
 			title = m->value;
 		else if (strcasecmp(m->key, "css") == 0)
@@ -1090,9 +1253,6 @@ rndr_doc_header(struct mdown_buf *ob,
 		else if (strcasecmp(m->key, "javascript") == 0)
 			script = m->value;
 
-	if (!hbuf_putb(ob, content))
-		return 0;
-
 	if (!HBUF_PUTSL(ob, 
 	    "<head>\n"
 	    "<meta charset=\"utf-8\" />\n"
@@ -1156,106 +1316,102 @@ rndr_doc_header(struct mdown_buf *ob,
 	return HBUF_PUTSL(ob, "</head>\n<body>\n");
 }
 
+/*
+ * Render "n" and its children straight into "ob": opening markup is
+ * emitted before the children and closing markup after them.
+ * Return zero on failure, non-zero on success.
+ */
 static int
-rndr(struct mdown_buf *ob,
-	struct mdown_metaq *mq, void *ref, 
-	const struct mdown_node *n)
+rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
+	struct html *st, const struct mdown_node *n)
 {
-	const struct mdown_node	*child;
 	struct mdown_buf		*tmp;
 	int32_t				 ent;
-	struct html			*st = ref;
-	int				 ret = 1, rc = 1;
-
-	if ((tmp = hbuf_new(64)) == NULL)
-		return 0;
-
-	/*
-	 * If we're processing metadata, don't escape the content as we
-	 * read and parse it.  This prevents double-escaping.  We'll
-	 * properly escape things as we inline them (standalone mode) or
-	 * when we write body text.
-	 */
-
-	if (n->type == MDOWN_META)
-		st->noescape = 1;
-
-	TAILQ_FOREACH(child, &n->children, entries)
-		if (!rndr(tmp, mq, st, child))
-			goto out;
+	int				 rc = 1;
 
 	if (n->chng == MDOWN_CHNG_INSERT && 
 	    !HBUF_PUTSL(ob, "<ins>"))
-		goto out;
+		return 0;
 	if (n->chng == MDOWN_CHNG_DELETE && 
 	   !HBUF_PUTSL(ob, "<del>"))
-		goto out;
+		return 0;
 
 	switch (n->type) {
 	case MDOWN_ROOT:
-		rc = rndr_root(ob, tmp, st);
+		rc = rndr_root(ob, mq, st, n);
 		break;
 	case MDOWN_BLOCKCODE:
-		rc = rndr_blockcode(ob, &n->rndr_blockcode, st);
+		rc = rndr_blockcode(ob, n->rndr_blockcode, st);
 		break;
 	case MDOWN_BLOCKQUOTE:
-		rc = rndr_blockquote(ob, tmp);
+		rc = rndr_blockquote(ob, mq, st, n);
 		break;
 	case MDOWN_DEFINITION:
-		rc = rndr_definition(ob, tmp);
+		rc = rndr_definition(ob, mq, st, n);
 		break;
 	case MDOWN_DEFINITION_TITLE:
-		rc = rndr_definition_title(ob, tmp);
+		rc = rndr_definition_title(ob, mq, st, n);
 		break;
 	case MDOWN_DEFINITION_DATA:
-		rc = rndr_definition_data(ob, tmp);
+		rc = rndr_definition_data(ob, mq, st, n);
 		break;
 	case MDOWN_DOC_HEADER:
-		rc = rndr_doc_header(ob, tmp, mq, st);
+		rc = rndr_doc_header(ob, mq, st, n);
 		break;
 	case MDOWN_META:
+		/*
+		 * Don't escape the content as we read and parse it.
+		 * This prevents double-escaping.  We'll properly escape
+		 * things as we inline them (standalone mode) or when we
+		 * write body text.
+		 */
+		st->noescape = 1;
+		tmp = rndr_children_buf(mq, st, n);
 		st->noescape = 0;
+		if (tmp == NULL)
+			return 0;
 		if (n->chng != MDOWN_CHNG_DELETE)
 			rc = rndr_meta(ob, tmp, mq, n, st);
+		hbuf_free(tmp);
 		break;
 	case MDOWN_DOC_FOOTER:
 		rc = rndr_doc_footer(ob, st);
 		break;
 	case MDOWN_HEADER:
-		rc = rndr_header(ob, tmp, &n->rndr_header, st);
+		rc = rndr_header(ob, mq, st, n);
 		break;
 	case MDOWN_HRULE:
-		rc = rndr_hrule(ob);
+		rc = rndr_hrule(ob, st);
 		break;
 	case MDOWN_LIST:
-		rc = rndr_list(ob, tmp, &n->rndr_list);
+		rc = rndr_list(ob, mq, st, n);
 		break;
 	case MDOWN_LISTITEM:
-		rc = rndr_listitem(ob, tmp, n);
+		rc = rndr_listitem(ob, mq, st, n);
 		break;
 	case MDOWN_PARAGRAPH:
-		rc = rndr_paragraph(ob, tmp, st);
+		rc = rndr_paragraph(ob, mq, st, n);
 		break;
 	case MDOWN_TABLE_BLOCK:
-		rc = rndr_table(ob, tmp);
+		rc = rndr_table(ob, mq, st, n);
 		break;
 	case MDOWN_TABLE_HEADER:
-		rc = rndr_table_header(ob, tmp);
+		rc = rndr_table_header(ob, mq, st, n);
 		break;
 	case MDOWN_TABLE_BODY:
-		rc = rndr_table_body(ob, tmp);
+		rc = rndr_table_body(ob, mq, st, n);
 		break;
 	case MDOWN_TABLE_ROW:
-		rc = rndr_tablerow(ob, tmp);
+		rc = rndr_tablerow(ob, mq, st, n);
 		break;
 	case MDOWN_TABLE_CELL:
-		rc = rndr_tablecell(ob, tmp, &n->rndr_table_cell);
+		rc = rndr_tablecell(ob, mq, st, n);
 		break;
 	case MDOWN_FOOTNOTES_BLOCK:
-		rc = rndr_footnotes(ob, tmp);
+		rc = rndr_footnotes(ob, mq, st, n);
 		break;
 	case MDOWN_FOOTNOTE_DEF:
-		rc = rndr_footnote_def(ob, tmp, &n->rndr_footnote_def);
+		rc = rndr_footnote_def(ob, mq, st, n);
 		break;
 	case MDOWN_BLOCKHTML:
 		rc = rndr_raw_block(ob, &n->rndr_blockhtml, st);
@@ -1267,34 +1423,34 @@ rndr(struct mdown_buf *ob,
 		rc = rndr_codespan(ob, &n->rndr_codespan, st);
 		break;
 	case MDOWN_DOUBLE_EMPHASIS:
-		rc = rndr_double_emphasis(ob, tmp);
+		rc = rndr_double_emphasis(ob, mq, st, n);
 		break;
 	case MDOWN_EMPHASIS:
-		rc = rndr_emphasis(ob, tmp);
+		rc = rndr_emphasis(ob, mq, st, n);
 		break;
 	case MDOWN_HIGHLIGHT:
-		rc = rndr_highlight(ob, tmp);
+		rc = rndr_highlight(ob, mq, st, n);
 		break;
 	case MDOWN_IMAGE:
-		rc = rndr_image(ob, &n->rndr_image, st);
+		rc = rndr_image(ob, n->rndr_image, st);
 		break;
 	case MDOWN_LINEBREAK:
 		rc = rndr_linebreak(ob);
 		break;
 	case MDOWN_LINK:
-		rc = rndr_link(ob, tmp, &n->rndr_link, st);
+		rc = rndr_link(ob, mq, st, n);
 		break;
 	case MDOWN_TRIPLE_EMPHASIS:
-		rc = rndr_triple_emphasis(ob, tmp);
+		rc = rndr_triple_emphasis(ob, mq, st, n);
 		break;
 	case MDOWN_STRIKETHROUGH:
-		rc = rndr_strikethrough(ob, tmp);
+		rc = rndr_strikethrough(ob, mq, st, n);
 		break;
 	case MDOWN_SUPERSCRIPT:
-		rc = rndr_superscript(ob, tmp);
+		rc = rndr_superscript(ob, mq, st, n);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		rc = rndr_footnote_ref(ob, &n->rndr_footnote_ref);
+		rc = rndr_footnote_ref(ob, n->rndr_footnote_ref);
 		break;
 	case MDOWN_MATH_BLOCK:
 		rc = rndr_math(ob, &n->rndr_math, st);
@@ -1324,23 +1480,32 @@ rndr(struct mdown_buf *ob,
 			hbuf_putb(ob, &n->rndr_entity.text);
 		break;
 	default:
-		rc = hbuf_putb(ob, tmp);
+		rc = rndr_children(ob, mq, st, n);
 		break;
 	}
 	if (!rc)
-		goto out;
+		return 0;
 
 	if (n->chng == MDOWN_CHNG_INSERT && 
 	    !HBUF_PUTSL(ob, "</ins>"))
-		goto out;
+		return 0;
 	if (n->chng == MDOWN_CHNG_DELETE &&
 	    !HBUF_PUTSL(ob, "</del>"))
-		goto out;
+		return 0;
 
-	ret = 1;
-out:
-	hbuf_free(tmp);
-	return ret;
+	return 1;
+}
+
+static void
+hentryq_clear(struct hentryq *q)
+{
+	struct hentry	*hentry;
+
+	while ((hentry = TAILQ_FIRST(q)) != NULL) {
+		TAILQ_REMOVE(q, hentry, entries);
+		free(hentry->str);
+		free(hentry);
+	}
 }
 
 int
@@ -1352,7 +1517,19 @@ mdown_html_rndr(struct mdown_buf *ob,
 	int			 rc;
 
 	TAILQ_INIT(&metaq);
-	st->headers_offs = 1;
+	st->base = 0;
+
+	/*
+	 * A new document starts with no header identifiers.  Parts of
+	 * a document share them, so only reset on the root.  The same
+	 * goes for the header offset, which is set by the metadata in
+	 * the document header.
+	 */
+
+	if (n->type == MDOWN_ROOT)
+		hentryq_clear(&st->headers_used);
+	if (n->type == MDOWN_ROOT || n->type == MDOWN_DOC_HEADER)
+		st->headers_offs = 1;
 
 	rc = rndr(ob, &metaq, st, n);
 
@@ -1369,6 +1546,7 @@ mdown_html_new(const struct mdown_opts *opts)
 		return NULL;
 
 	TAILQ_INIT(&p->headers_used);
+	p->headers_offs = 1;
 	p->flags = opts == NULL ? 0 : opts->oflags;
 	return p;
 }
@@ -1377,16 +1555,10 @@ void
 mdown_html_free(void *arg)
 {
 	struct html	*st = arg;
-	struct hentry	*hentry;
 
 	if (st == NULL)
 		return;
 
-	while ((hentry = TAILQ_FIRST(&st->headers_used)) != NULL) {
-		TAILQ_REMOVE(&st->headers_used, hentry, entries);
-		free(hentry->str);
-		free(hentry);
-	}
-
+	hentryq_clear(&st->headers_used);
 	free(st);
 }
@@ -678,6 +678,7 @@ rndr_doc_header(struct mdown_buf *ob,
 					*affil = NULL, *date = NULL,
 					*rcsauthor = NULL, 
 					*rcsdate = NULL;
+	char				 rcsauthorbuf[1024], rcsdatebuf[32];
 
 	if (!(st->oflags & MDOWN_STANDALONE))
 		return 1;
@@ -724,9 +725,11 @@ rndr_doc_header(struct mdown_buf *ob,
 		else if (strcasecmp(m->key, "date") == 0)
 			date = m->value;
 		else if (strcasecmp(m->key, "rcsauthor") == 0)
-			rcsauthor = rcsauthor2str(m->value);
+			rcsauthor = rcsauthor2str(m->value,
+			    rcsauthorbuf, sizeof(rcsauthorbuf));
 		else if (strcasecmp(m->key, "rcsdate") == 0)
-			rcsdate = rcsdate2str(m->value);
+			rcsdate = rcsdate2str(m->value,
+			    rcsdatebuf, sizeof(rcsdatebuf));
 		else if (strcasecmp(m->key, "title") == 0)
 			title = m->value;
 
@@ -828,7 +831,7 @@ rndr(struct mdown_buf *ob,
 
 	switch (n->type) {
 	case MDOWN_BLOCKCODE:
-		rc = rndr_blockcode(ob, &n->rndr_blockcode);
+		rc = rndr_blockcode(ob, n->rndr_blockcode);
 		break;
 	case MDOWN_BLOCKQUOTE:
 		rc = rndr_blockquote(ob, tmp);
@@ -896,13 +899,13 @@ rndr(struct mdown_buf *ob,
 		rc = rndr_highlight(ob, tmp);
 		break;
 	case MDOWN_IMAGE:
-		rc = rndr_image(ob, &n->rndr_image);
+		rc = rndr_image(ob, n->rndr_image);
 		break;
 	case MDOWN_LINEBREAK:
 		rc = rndr_linebreak(ob);
 		break;
 	case MDOWN_LINK:
-		rc = rndr_link(ob, tmp, &n->rndr_link);
+		rc = rndr_link(ob, tmp, n->rndr_link);
 		break;
 	case MDOWN_TRIPLE_EMPHASIS:
 		rc = rndr_triple_emphasis(ob, tmp);
@@ -911,7 +914,7 @@ rndr(struct mdown_buf *ob,
 		rc = rndr_superscript(ob, tmp);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		rc = rndr_footnote_ref(ob, &n->rndr_footnote_ref);
+		rc = rndr_footnote_ref(ob, n->rndr_footnote_ref);
 		break;
 	case MDOWN_MATH_BLOCK:
 		rc = rndr_math(ob, &n->rndr_math);
@@ -22,6 +22,7 @@
 
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -40,9 +41,17 @@
  */
 #define HBUF_START_SMALL 128
 
+/*
+ * Output is reserved as this much more than the input, which covers
+ * most documents without any growth.
+ */
+#define HBUF_OUT_HINT(_sz) ((_sz) + (_sz) / 2)
+
 /*
  * Merge adjacent text nodes into single text nodes, freeing the
  * duplicates along the way.
+ * Each run of text nodes is merged with a single allocation made from
+ * the arena of the tree (if any).
  * This is only used when diffing, as it makes the diff algorithm hvae a
  * more reasonable view of text in the tree.
  * Otherwise, it's just a waste of time.
@@ -51,122 +60,283 @@
 static int
 mdown_merge_adjacent_text(struct mdown_node *n)
 {
-	struct mdown_node 	*nn, *prev, *tmp;
+	struct mdown_node 	*nn, *next, *last;
+	struct mdown_buf	*b;
+	size_t			 sz;
+	char			*cp;
 
-	TAILQ_FOREACH_SAFE(nn, &n->children, entries, tmp) {
+	for (nn = TAILQ_FIRST(&n->children); nn != NULL; nn = next) {
+		next = TAILQ_NEXT(nn, entries);
 		if (nn->type != MDOWN_NORMAL_TEXT) {
 			if (!mdown_merge_adjacent_text(nn))
 				return 0;
 			continue;
 		}
-		prev = TAILQ_PREV(nn, mdown_nodeq, entries);
-		if (prev == NULL ||
-		    prev->type != MDOWN_NORMAL_TEXT)
+
+		/* Size up the run of text nodes starting here. */
+
+		sz = nn->rndr_normal_text.text.size;
+		for (last = nn; next != NULL &&
+		     next->type == MDOWN_NORMAL_TEXT;
+		     next = TAILQ_NEXT(next, entries)) {
+			sz += next->rndr_normal_text.text.size;
+			last = next;
+		}
+		if (last == nn)
 			continue;
-		hbuf_putb(&prev->rndr_normal_text.text, 
-			&nn->rndr_normal_text.text);
-		TAILQ_REMOVE(&n->children, nn, entries);
-		mdown_node_free(nn);
+
+		if ((cp = arena_calloc(nn->arena, 1, sz + 1)) == NULL)
+			return 0;
+		b = &nn->rndr_normal_text.text;
+		memcpy(cp, b->data, b->size);
+		if (nn->arena == NULL)
+			free(b->data);
+		b->data = cp;
+
+		while ((last = TAILQ_NEXT(nn, entries)) != next) {
+			memcpy(b->data + b->size,
+				last->rndr_normal_text.text.data,
+				last->rndr_normal_text.text.size);
+			b->size += last->rndr_normal_text.text.size;
+			TAILQ_REMOVE(&n->children, last, entries);
+			mdown_node_free(last);
+		}
+		assert(b->size == sz);
+		b->maxsize = 0;
+		b->unit = 0;
 	}
 	return 1;
 }
 
 /*
- * Return FALSE on failure, TRUE on success.
+ * Rendering state kept across documents.
+ */
+struct	mdown_batch {
+	enum mdown_type	 type; /* output type */
+	struct mdown_doc	*doc; /* parser */
+	void			*rndr; /* renderer or NULL */
+	struct mdown_buf	*in; /* mdown_batch_file() input */
+	size_t			 maxdepth; /* for mdown_ast_load() */
+	int			 ast; /* input is a serialised tree */
+};
+
+/*
+ * Allocate the renderer for output type "t" into "rndr", which is set
+ * to NULL for types without any renderer state.
+ * Return FALSE on failure (memory), TRUE on success.
  */
 static int
-mdown_render(const struct mdown_opts *opts,
-	struct mdown_buf *ob, const struct mdown_node *n)
+rndr_new(const struct mdown_opts *opts, enum mdown_type t, void **rndr)
 {
-	void	*rndr;
-	int	 c = 0;
 
-	switch (opts == NULL ? MDOWN_HTML : opts->type) {
+	switch (t) {
+	case MDOWN_GEMINI:
+		*rndr = mdown_gemini_new(opts);
+		break;
+	case MDOWN_HTML:
+		*rndr = mdown_html_new(opts);
+		break;
+	case MDOWN_XELATEX:
+		*rndr = mdown_xelatex_new(opts);
+		break;
+	case MDOWN_LATEX:
+		*rndr = mdown_latex_new(opts);
+		break;
+	case MDOWN_MAN:
+	case MDOWN_NROFF:
+		*rndr = mdown_nroff_new(opts);
+		break;
+	case MDOWN_FODT:
+		*rndr = mdown_odt_new(opts);
+		break;
+	case MDOWN_TERM:
+		*rndr = mdown_term_new(opts);
+		break;
+	case MDOWN_AST:
+	case MDOWN_TREE:
+	case MDOWN_NULL:
+		*rndr = NULL;
+		return 1;
+	default:
+		abort();
+		/* NOTREACHED */
+	}
+
+	return *rndr != NULL;
+}
+
+static void
+rndr_free(enum mdown_type t, void *rndr)
+{
+
+	switch (t) {
 	case MDOWN_GEMINI:
-		if ((rndr = mdown_gemini_new(opts)) == NULL)
-			return 0;
-		c = mdown_gemini_rndr(ob, rndr, n);
 		mdown_gemini_free(rndr);
 		break;
 	case MDOWN_HTML:
-		if ((rndr = mdown_html_new(opts)) == NULL)
-			return 0;
-		c = mdown_html_rndr(ob, rndr, n);
 		mdown_html_free(rndr);
 		break;
 	case MDOWN_XELATEX:
-		if ((rndr = mdown_xelatex_new(opts)) == NULL)
-			return 0;
-		c = mdown_xelatex_rndr(ob, rndr, n);
 		mdown_xelatex_free(rndr);
 		break;
 	case MDOWN_LATEX:
-		if ((rndr = mdown_latex_new(opts)) == NULL)
-			return 0;
-		c = mdown_latex_rndr(ob, rndr, n);
 		mdown_latex_free(rndr);
 		break;
 	case MDOWN_MAN:
 	case MDOWN_NROFF:
-		if ((rndr = mdown_nroff_new(opts)) == NULL)
-			return 0;
-		c = mdown_nroff_rndr(ob, rndr, n);
 		mdown_nroff_free(rndr);
 		break;
 	case MDOWN_FODT:
-		if ((rndr = mdown_odt_new(opts)) == NULL)
-			return 0;
-		c = mdown_odt_rndr(ob, rndr, n);
 		mdown_odt_free(rndr);
 		break;
 	case MDOWN_TERM:
-		if ((rndr = mdown_term_new(opts)) == NULL)
-			return 0;
-		c = mdown_term_rndr(ob, rndr, n);
 		mdown_term_free(rndr);
 		break;
-	case MDOWN_TREE:
-		c = mdown_tree_rndr(ob, n);
+	default:
 		break;
+	}
+}
+
+/*
+ * Render "n" into "ob" with the renderer from rndr_new().
+ * The MDOWN_NULL type produces no output.
+ * Only MDOWN_AST makes use of the metadata "mq", which may be NULL.
+ * Return FALSE on failure, TRUE on success.
+ */
+static int
+rndr_render(enum mdown_type t, void *rndr, struct mdown_buf *ob,
+	const struct mdown_node *n, const struct mdown_metaq *mq)
+{
+
+	switch (t) {
+	case MDOWN_GEMINI:
+		return mdown_gemini_rndr(ob, rndr, n);
+	case MDOWN_HTML:
+		return mdown_html_rndr(ob, rndr, n);
+	case MDOWN_XELATEX:
+		return mdown_xelatex_rndr(ob, rndr, n);
+	case MDOWN_LATEX:
+		return mdown_latex_rndr(ob, rndr, n);
+	case MDOWN_MAN:
+	case MDOWN_NROFF:
+		return mdown_nroff_rndr(ob, rndr, n);
+	case MDOWN_FODT:
+		return mdown_odt_rndr(ob, rndr, n);
+	case MDOWN_TERM:
+		return mdown_term_rndr(ob, rndr, n);
+	case MDOWN_TREE:
+		return mdown_tree_rndr(ob, n);
+	case MDOWN_AST:
+		return mdown_ast_rndr(ob, n, mq);
+	case MDOWN_NULL:
+		return 1;
 	default:
-		abort();
-		/* NOTREACHED */
+		break;
 	}
 
+	abort();
+	/* NOTREACHED */
+}
+
+/*
+ * Return FALSE on failure, TRUE on success.
+ */
+static int
+mdown_render(const struct mdown_opts *opts,
+	struct mdown_buf *ob, const struct mdown_node *n)
+{
+	void		*rndr;
+	enum mdown_type	 t;
+	int		 c;
+
+	t = opts == NULL ? MDOWN_HTML : opts->type;
+	if (!rndr_new(opts, t, &rndr))
+		return 0;
+	c = rndr_render(t, rndr, ob, n, NULL);
+	rndr_free(t, rndr);
 	return c;
 }
 
+struct mdown_batch *
+mdown_batch_new(const struct mdown_opts *opts)
+{
+	struct mdown_batch	*b;
+	struct mdown_opts	 popts;
+
+	if ((b = calloc(1, sizeof(struct mdown_batch))) == NULL)
+		return NULL;
+
+	b->type = opts == NULL ? MDOWN_HTML : opts->type;
+	b->maxdepth = opts == NULL ? 128 : opts->maxdepth;
+	b->ast = opts != NULL && (opts->feat & MDOWN_AST_IN);
+
+	/*
+	 * Smart typography is applied by the parser as it goes instead
+	 * of walking the finished tree again.
+	 */
+
+	if (opts != NULL && (opts->oflags & MDOWN_SMARTY)) {
+		popts = *opts;
+		popts.feat |= MDOWN_SMARTY_PARSE;
+		opts = &popts;
+	}
+
+	if ((b->doc = mdown_doc_new(opts)) == NULL ||
+	    !rndr_new(opts, b->type, &b->rndr)) {
+		mdown_batch_free(b);
+		return NULL;
+	}
+	return b;
+}
+
+void
+mdown_batch_free(struct mdown_batch *b)
+{
+
+	if (b == NULL)
+		return;
+	rndr_free(b->type, b->rndr);
+	mdown_doc_free(b->doc);
+	mdown_buf_free(b->in);
+	free(b);
+}
+
 int
-mdown_buf(const struct mdown_opts *opts,
+mdown_batch_buf(struct mdown_batch *b,
 	const char *data, size_t datasz,
 	char **res, size_t *rsz,
 	struct mdown_metaq *metaq)
 {
 	struct mdown_buf	*ob = NULL;
-	struct mdown_doc	*doc;
-	size_t			 maxn;
-	enum mdown_type	 t;
-	struct mdown_node	*n = NULL;
+	struct mdown_node	*n;
+	struct mdown_metaq	 mq;
+	struct mdown_opts	 lopts;
 	int			 rc = 0;
 
-	t = opts == NULL ? MDOWN_HTML : opts->type;
+	/* Serialised trees always carry the metadata. */
 
-	if ((doc = mdown_doc_new(opts)) == NULL)
-		goto err;
+	TAILQ_INIT(&mq);
+	if (metaq == NULL && b->type == MDOWN_AST)
+		metaq = &mq;
+
+	/* Previously-serialised trees are loaded instead of parsed. */
 
-	n = mdown_doc_parse(doc, &maxn, data, datasz, metaq);
+	if (b->ast) {
+		memset(&lopts, 0, sizeof(struct mdown_opts));
+		lopts.maxdepth = b->maxdepth;
+		n = mdown_ast_load(&lopts, data, datasz, NULL, metaq);
+	} else
+		n = mdown_doc_parse(b->doc, NULL, data, datasz, metaq);
 	if (n == NULL)
 		goto err;
 	assert(n->type == MDOWN_ROOT);
 
-    	if (opts != NULL && (opts->oflags & MDOWN_SMARTY)) 
-		if (!smarty(n, maxn, t))
-			goto err;
-
 	if ((ob = mdown_buf_new(HBUF_START_BIG)) == NULL)
 		goto err;
+	if (!hbuf_reserve(ob, HBUF_OUT_HINT(datasz)))
+		goto err;
 
-	if (!mdown_render(opts, ob, n))
+	if (!rndr_render(b->type, b->rndr, ob, n, metaq))
 		goto err;
 
 	*res = ob->data;
@@ -176,7 +346,180 @@ mdown_buf(const struct mdown_opts *opts,
 err:
 	mdown_buf_free(ob);
 	mdown_node_free(n);
+	mdown_metaq_free(&mq);
+	return rc;
+}
+
+int
+mdown_batch_file(struct mdown_batch *b, FILE *fin,
+	char **res, size_t *rsz, struct mdown_metaq *metaq)
+{
+
+	if (b->in == NULL &&
+	    (b->in = mdown_buf_new(HBUF_START_BIG)) == NULL)
+		return 0;
+	hbuf_truncate(b->in);
+	if (!hbuf_putf(b->in, fin))
+		return 0;
+	return mdown_batch_buf(b,
+		b->in->data, b->in->size, res, rsz, metaq);
+}
+
+int
+mdown_buf(const struct mdown_opts *opts,
+	const char *data, size_t datasz,
+	char **res, size_t *rsz,
+	struct mdown_metaq *metaq)
+{
+	struct mdown_batch	*b;
+	int			 rc;
+
+	if ((b = mdown_batch_new(opts)) == NULL)
+		return 0;
+	rc = mdown_batch_buf(b, data, datasz, res, rsz, metaq);
+	mdown_batch_free(b);
+	return rc;
+}
+
+/*
+ * One output of mdown_buf_multi().
+ * All of them share the same parse tree, which none of the renderers
+ * modify, so they may be rendered concurrently.
+ */
+struct	multi {
+	pthread_t		  thread;
+	int			  started; /* "thread" is running */
+	struct mdown_opts	  opts; /* with the output type */
+	const struct mdown_node	 *n; /* shared parse tree */
+	const struct mdown_metaq *mq; /* shared metadata (or NULL) */
+	size_t			  hint; /* input size */
+	struct mdown_output	 *out; /* where the output goes */
+	int			  rc; /* TRUE on success */
+};
+
+/*
+ * Render one output of mdown_buf_multi(), usually in its own thread.
+ * Sets "rc" to TRUE on success, FALSE on failure (memory).
+ */
+static void *
+multi_render(void *arg)
+{
+	struct multi		*m = arg;
+	struct mdown_buf	*ob = NULL;
+	void			*rndr = NULL;
+
+	m->rc = 0;
+	if (!rndr_new(&m->opts, m->opts.type, &rndr))
+		goto out;
+	if ((ob = mdown_buf_new(HBUF_START_BIG)) == NULL)
+		goto out;
+	if (!hbuf_reserve(ob, HBUF_OUT_HINT(m->hint)))
+		goto out;
+	if (!rndr_render(m->opts.type, rndr, ob, m->n, m->mq))
+		goto out;
+
+	m->out->res = ob->data;
+	m->out->rsz = ob->size;
+	ob->data = NULL;
+	m->rc = 1;
+out:
+	mdown_buf_free(ob);
+	rndr_free(m->opts.type, rndr);
+	return NULL;
+}
+
+int
+mdown_buf_multi(const struct mdown_opts *opts,
+	const char *data, size_t datasz,
+	struct mdown_output *outs, size_t outsz,
+	struct mdown_metaq *metaq)
+{
+	struct mdown_doc	*doc = NULL;
+	struct mdown_node	*n = NULL;
+	struct mdown_metaq	 mq;
+	struct mdown_opts	 popts;
+	struct multi		*ms = NULL;
+	size_t			 i;
+	int			 rc = 0;
+
+	for (i = 0; i < outsz; i++) {
+		outs[i].res = NULL;
+		outs[i].rsz = 0;
+	}
+
+	/* No options are the same as zeroed ones with the usual depth. */
+
+	if (opts == NULL) {
+		memset(&popts, 0, sizeof(struct mdown_opts));
+		popts.maxdepth = 128;
+	} else
+		popts = *opts;
+
+	/*
+	 * Smart typography doesn't depend on the output type, so the
+	 * parser applies it once for all outputs.
+	 */
+
+	if (popts.oflags & MDOWN_SMARTY)
+		popts.feat |= MDOWN_SMARTY_PARSE;
+
+	/* Serialised trees always carry the metadata. */
+
+	TAILQ_INIT(&mq);
+	for (i = 0; i < outsz; i++)
+		if (metaq == NULL && outs[i].type == MDOWN_AST)
+			metaq = &mq;
+
+	if (popts.feat & MDOWN_AST_IN)
+		n = mdown_ast_load(&popts, data, datasz, NULL, metaq);
+	else if ((doc = mdown_doc_new(&popts)) != NULL)
+		n = mdown_doc_parse(doc, NULL, data, datasz, metaq);
+	if (n == NULL)
+		goto out;
+	assert(n->type == MDOWN_ROOT);
+
+	if ((ms = calloc(outsz, sizeof(struct multi))) == NULL)
+		goto out;
+	for (i = 0; i < outsz; i++) {
+		ms[i].opts = popts;
+		ms[i].opts.type = outs[i].type;
+		ms[i].n = n;
+		ms[i].mq = metaq;
+		ms[i].hint = datasz;
+		ms[i].out = &outs[i];
+	}
+
+	/*
+	 * The first output is rendered here while the others are in
+	 * their own threads.  If a thread can't be started, its output
+	 * is rendered here after the first.
+	 */
+
+	for (i = 1; i < outsz; i++)
+		ms[i].started = pthread_create
+			(&ms[i].thread, NULL, multi_render, &ms[i]) == 0;
+	for (i = 0; i < outsz; i++)
+		if (!ms[i].started)
+			multi_render(&ms[i]);
+
+	rc = 1;
+	for (i = 0; i < outsz; i++) {
+		if (ms[i].started && pthread_join(ms[i].thread, NULL) != 0)
+			abort();
+		if (!ms[i].rc)
+			rc = 0;
+	}
+out:
+	if (!rc)
+		for (i = 0; i < outsz; i++) {
+			free(outs[i].res);
+			outs[i].res = NULL;
+			outs[i].rsz = 0;
+		}
+	free(ms);
+	mdown_node_free(n);
 	mdown_doc_free(doc);
+	mdown_metaq_free(&mq);
 	return rc;
 }
 
@@ -190,19 +533,34 @@ mdown_buf_diff(const struct mdown_opts *opts,
 	struct mdown_doc 	*doc = NULL;
 	enum mdown_type 	 t;
 	struct mdown_node 	*nnew = NULL, *nold = NULL, 
-				*ndiff = NULL;
+				*ndiff = NULL, *flat;
+	struct mdown_opts	 popts;
+	struct flat		 f;
 	size_t			 maxn;
 	int			 rc = 0;
 
 	t = opts == NULL ? MDOWN_HTML : opts->type;
 
-	if ((doc = mdown_doc_new(opts)) == NULL)
+	/* Smart typography is applied to the difference, not inputs. */
+
+	if (opts != NULL && (opts->feat & MDOWN_SMARTY_PARSE)) {
+		popts = *opts;
+		popts.feat &= ~MDOWN_SMARTY_PARSE;
+		if ((doc = mdown_doc_new(&popts)) == NULL)
+			goto err;
+	} else if ((doc = mdown_doc_new(opts)) == NULL)
 		goto err;
 
-	nnew = mdown_doc_parse(doc, NULL, new, newsz, NULL);
+	if (opts != NULL && (opts->feat & MDOWN_AST_IN))
+		nnew = mdown_ast_load(opts, new, newsz, NULL, NULL);
+	else
+		nnew = mdown_doc_parse(doc, NULL, new, newsz, NULL);
 	if (nnew == NULL)
 		goto err;
-	nold = mdown_doc_parse(doc, NULL, old, oldsz, NULL);
+	if (opts != NULL && (opts->feat & MDOWN_AST_IN))
+		nold = mdown_ast_load(opts, old, oldsz, NULL, NULL);
+	else
+		nold = mdown_doc_parse(doc, NULL, old, oldsz, NULL);
 	if (nold == NULL)
 		goto err;
 
@@ -211,7 +569,22 @@ mdown_buf_diff(const struct mdown_opts *opts,
 	if (!mdown_merge_adjacent_text(nold))
 		goto err;
 
-	ndiff = mdown_diff(nold, nnew, &maxn);
+	if ((ndiff = mdown_diff(nold, nnew, &maxn)) == NULL)
+		goto err;
+
+	/*
+	 * The difference is pieced together node by node from both
+	 * inputs: lay it out contiguously before walking it.
+	 */
+
+	if (!flat_new(&f, ndiff))
+		goto err;
+	flat = flat_tree(&f);
+	flat_free(&f);
+	if (flat == NULL)
+		goto err;
+	mdown_node_free(ndiff);
+	ndiff = flat;
 
     	if (opts != NULL && (opts->oflags & MDOWN_SMARTY)) 
 		if (!smarty(ndiff, maxn, t))
@@ -219,6 +592,8 @@ mdown_buf_diff(const struct mdown_opts *opts,
 
 	if ((ob = mdown_buf_new(HBUF_START_BIG)) == NULL)
 		goto err;
+	if (!hbuf_reserve(ob, HBUF_OUT_HINT(newsz)))
+		goto err;
 
 	if (!mdown_render(opts, ob, ndiff))
 		goto err;
@@ -257,6 +632,28 @@ out:
 	return rc;
 }
 
+int
+mdown_file_multi(const struct mdown_opts *opts, FILE *fin,
+	struct mdown_output *outs, size_t outsz,
+	struct mdown_metaq *metaq)
+{
+	struct mdown_buf	*bin = NULL;
+	int	 		 rc = 0;
+
+	if ((bin = mdown_buf_new(HBUF_START_BIG)) == NULL)
+		goto out;
+	if (!hbuf_putf(bin, fin))
+		goto out;
+
+	if (!mdown_buf_multi(opts,
+	    bin->data, bin->size, outs, outsz, metaq))
+		goto out;
+	rc = 1;
+out:
+	mdown_buf_free(bin);
+	return rc;
+}
+
 int
 mdown_file_diff(const struct mdown_opts *opts,
 	FILE *fnew, FILE *fold, char **res, size_t *rsz)
@@ -25,6 +25,8 @@
 # include <sys/capsicum.h>
 #endif
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #if HAVE_ERR
@@ -34,6 +36,7 @@
 #include <getopt.h>
 #include <limits.h> /* INT_MAX */
 #include <locale.h> /* set_locale() */
+#include <pthread.h>
 #if HAVE_SANDBOX_INIT
 # include <sandbox.h>
 #endif
@@ -151,6 +154,389 @@ sandbox_pre(void)
 
 #endif
 
+/*
+ * Map the input file "f" read-only into memory, setting "p" and "sz".
+ * This only works for non-empty regular files that haven't been read
+ * from (e.g., if passed on standard input), so callers must fall back
+ * to reading the stream if it fails.
+ * Returns zero if not mapped, non-zero if mapped.
+ */
+static int
+map_file(FILE *f, char **p, size_t *sz)
+{
+	struct stat	 st;
+	int		 fd = fileno(f);
+	void		*map;
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX)
+		return 0;
+	if (lseek(fd, 0, SEEK_CUR) != 0)
+		return 0;
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return 0;
+	*p = map;
+	*sz = st.st_size;
+	return 1;
+}
+
+/*
+ * Output types for -T.
+ */
+static const struct {
+	const char	*name;
+	enum mdown_type	 type;
+} types[] = {
+	{ "ast",	MDOWN_AST },
+	{ "fodt",	MDOWN_FODT },
+	{ "gemini",	MDOWN_GEMINI },
+	{ "html",	MDOWN_HTML },
+	{ "latex",	MDOWN_LATEX },
+	{ "man",	MDOWN_MAN },
+	{ "ms",		MDOWN_NROFF },
+	{ "null",	MDOWN_NULL },
+	{ "term",	MDOWN_TERM },
+	{ "tree",	MDOWN_TREE },
+	{ "xelatex",	MDOWN_XELATEX },
+};
+
+/*
+ * Look up the output type named by the "sz" bytes of "s".
+ * Returns the index in "types" or -1 if not found.
+ */
+static int
+type_find(const char *s, size_t sz)
+{
+	size_t	 i;
+
+	for (i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+		if (strlen(types[i].name) == sz &&
+		    strncasecmp(types[i].name, s, sz) == 0)
+			return i;
+	return -1;
+}
+
+/*
+ * Default output file suffix for batch mode.
+ */
+static const char *
+batch_suffix(enum mdown_type t)
+{
+
+	switch (t) {
+	case MDOWN_GEMINI:
+		return ".gmi";
+	case MDOWN_HTML:
+		return ".html";
+	case MDOWN_LATEX:
+		return ".tex";
+	case MDOWN_XELATEX:
+		return ".tex";
+	case MDOWN_MAN:
+		return ".man";
+	case MDOWN_NROFF:
+		return ".ms";
+	case MDOWN_FODT:
+		return ".fodt";
+	case MDOWN_AST:
+		return ".ast";
+	case MDOWN_TREE:
+		return ".tree";
+	default:
+		break;
+	}
+	return ".txt";
+}
+
+/*
+ * Convert the input file "fn" in batch mode.
+ * Output is written into "dir", if not NULL, or next to the input file,
+ * to a file named as the input with its suffix replaced by "suffix".
+ * Errors are reported, but only memory errors are fatal.
+ * Returns zero on failure, non-zero on success.
+ */
+static int
+batch_file(struct mdown_batch *b, enum mdown_type t,
+	const char *fn, const char *dir, const char *suffix)
+{
+	FILE		*fin, *fout;
+	char		*map = NULL, *ret = NULL, *fnout = NULL;
+	const char	*base, *ext;
+	size_t		 mapsz = 0, retsz = 0;
+	int		 c, rc = 0;
+
+	if ((fin = fopen(fn, "r")) == NULL) {
+		warn("%s", fn);
+		return 0;
+	}
+
+	if (map_file(fin, &map, &mapsz))
+		c = mdown_batch_buf(b, map, mapsz, &ret, &retsz, NULL);
+	else
+		c = mdown_batch_file(b, fin, &ret, &retsz, NULL);
+	if (!c) {
+		warnx("%s: failed parse", fn);
+		goto out;
+	}
+
+	if (t == MDOWN_NULL) {
+		rc = 1;
+		goto out;
+	}
+
+	if ((base = strrchr(fn, '/')) != NULL)
+		base++;
+	else
+		base = fn;
+	if ((ext = strrchr(base, '.')) == NULL || ext == base)
+		ext = base + strlen(base);
+
+	if (dir != NULL)
+		c = asprintf(&fnout, "%s/%.*s%s",
+			dir, (int)(ext - base), base, suffix);
+	else
+		c = asprintf(&fnout, "%.*s%s",
+			(int)(ext - fn), fn, suffix);
+	if (c == -1)
+		err(1, NULL);
+
+	if (strcmp(fnout, fn) == 0) {
+		warnx("%s: output would overwrite input", fn);
+		goto out;
+	}
+	if ((fout = fopen(fnout, "w")) == NULL) {
+		warn("%s", fnout);
+		goto out;
+	}
+	fwrite(ret, 1, retsz, fout);
+	c = ferror(fout);
+	if (fclose(fout) == EOF || c) {
+		warn("%s", fnout);
+		goto out;
+	}
+	rc = 1;
+out:
+	free(fnout);
+	free(ret);
+	if (map != NULL)
+		munmap(map, mapsz);
+	fclose(fin);
+	return rc;
+}
+
+/*
+ * An input file in batch mode.
+ */
+struct	bfile {
+	const char	*fn; /* file name */
+	off_t		 size; /* size or zero if unknown */
+};
+
+/*
+ * Files being converted in parallel by batch_worker().
+ */
+struct	batch {
+	pthread_mutex_t		  mutex; /* protects "next" */
+	const struct mdown_opts	 *opts; /* configuration */
+	struct bfile		 *files; /* files (largest first) */
+	size_t			  filesz; /* number of files */
+	size_t			  next; /* next file to convert */
+	const char		 *dir; /* output directory or NULL */
+	const char		 *suffix; /* output suffix */
+};
+
+/*
+ * One of the threads started by batch_parallel().
+ */
+struct	worker {
+	pthread_t		  thread;
+	struct batch		 *batch; /* shared state */
+	int			  status; /* non-zero if a file failed */
+};
+
+/*
+ * Convert files from the shared list until none are left.
+ * Each worker has its own parser and renderer.
+ */
+static void *
+batch_worker(void *arg)
+{
+	struct worker		*w = arg;
+	struct batch		*bt = w->batch;
+	struct mdown_batch	*b;
+	size_t			 i;
+	int			 c;
+
+	if ((b = mdown_batch_new(bt->opts)) == NULL)
+		err(1, NULL);
+
+	for (;;) {
+		if ((c = pthread_mutex_lock(&bt->mutex)) != 0)
+			errc(1, c, "pthread_mutex_lock");
+		i = bt->next < bt->filesz ? bt->next++ : bt->filesz;
+		if ((c = pthread_mutex_unlock(&bt->mutex)) != 0)
+			errc(1, c, "pthread_mutex_unlock");
+		if (i == bt->filesz)
+			break;
+		if (!batch_file(b, bt->opts->type,
+		    bt->files[i].fn, bt->dir, bt->suffix))
+			w->status = 1;
+	}
+
+	mdown_batch_free(b);
+	return NULL;
+}
+
+static int
+bfile_cmp(const void *a, const void *b)
+{
+	const struct bfile	*f1 = a, *f2 = b;
+
+	if (f1->size > f2->size)
+		return -1;
+	return f1->size < f2->size;
+}
+
+/*
+ * Convert "fns" on "jobs" threads.
+ * Files are handed out largest first, so that a long one doesn't hold
+ * up the end of the batch.
+ * Returns zero on success, non-zero if any file failed.
+ */
+static int
+batch_parallel(const struct mdown_opts *opts, char *fns[],
+	size_t fnsz, const char *dir, const char *suffix, size_t jobs)
+{
+	struct batch	 bt;
+	struct worker	*ws;
+	struct stat	 st;
+	size_t		 i;
+	int		 c, status = 0;
+
+	memset(&bt, 0, sizeof(struct batch));
+	bt.opts = opts;
+	bt.dir = dir;
+	bt.suffix = suffix;
+	bt.filesz = fnsz;
+
+	if ((bt.files = calloc(fnsz, sizeof(struct bfile))) == NULL)
+		err(1, NULL);
+	for (i = 0; i < fnsz; i++) {
+		bt.files[i].fn = fns[i];
+		if (stat(fns[i], &st) != -1)
+			bt.files[i].size = st.st_size;
+	}
+	qsort(bt.files, fnsz, sizeof(struct bfile), bfile_cmp);
+
+	if (jobs > fnsz)
+		jobs = fnsz;
+	if ((ws = calloc(jobs, sizeof(struct worker))) == NULL)
+		err(1, NULL);
+	if ((c = pthread_mutex_init(&bt.mutex, NULL)) != 0)
+		errc(1, c, "pthread_mutex_init");
+
+	for (i = 0; i < jobs; i++) {
+		ws[i].batch = &bt;
+		if ((c = pthread_create(&ws[i].thread,
+		    NULL, batch_worker, &ws[i])) != 0)
+			errc(1, c, "pthread_create");
+	}
+	for (i = 0; i < jobs; i++) {
+		if ((c = pthread_join(ws[i].thread, NULL)) != 0)
+			errc(1, c, "pthread_join");
+		status |= ws[i].status;
+	}
+
+	pthread_mutex_destroy(&bt.mutex);
+	free(ws);
+	free(bt.files);
+	return status;
+}
+
+/*
+ * Render "fin" into each of the "outsz" output types, writing each
+ * into a file named by "base" and the type's suffix.
+ * As in batch mode, -Tnull writes no file.
+ * The input is parsed once and the outputs are rendered concurrently.
+ * Returns zero on success, non-zero on failure.
+ */
+static int
+multi_write(const struct mdown_opts *opts, FILE *fin,
+	const char *fnin, const char *base,
+	struct mdown_output *outs, size_t outsz)
+{
+	FILE		**fouts;
+	char		**fns, *min = NULL;
+	size_t		  i, j, minsz = 0;
+	int		  c, fd = STDOUT_FILENO, status = 0;
+
+	if ((fouts = calloc(outsz, sizeof(FILE *))) == NULL ||
+	    (fns = calloc(outsz, sizeof(char *))) == NULL)
+		err(1, NULL);
+
+	for (i = 0; i < outsz; i++)
+		if (outs[i].type != MDOWN_NULL &&
+		    asprintf(&fns[i], "%s%s",
+		    base, batch_suffix(outs[i].type)) == -1)
+			err(1, NULL);
+	for (i = 0; i < outsz; i++)
+		for (j = 0; j < i && fns[i] != NULL; j++)
+			if (fns[j] != NULL && strcmp(fns[i], fns[j]) == 0)
+				errx(1, "%s: output given twice", fns[i]);
+	for (i = 0; i < outsz; i++)
+		if (fns[i] != NULL && strcmp(fns[i], fnin) == 0)
+			errx(1, "%s: output would overwrite input", fnin);
+	for (i = 0; i < outsz; i++)
+		if (fns[i] != NULL &&
+		    (fouts[i] = fopen(fns[i], "w")) == NULL)
+			err(1, "%s", fns[i]);
+	for (i = 0; i < outsz; i++)
+		if (fouts[i] != NULL) {
+			fd = fileno(fouts[i]);
+			break;
+		}
+
+	if (!map_file(fin, &min, &minsz))
+		min = NULL;
+
+	/*
+	 * All outputs are open, so no more files need be opened.
+	 * Capsicum only limits the rights of the first.
+	 */
+
+	sandbox_post(fileno(fin), -1, fd);
+
+	if (min != NULL)
+		c = mdown_buf_multi(opts,
+			min, minsz, outs, outsz, NULL);
+	else
+		c = mdown_file_multi(opts, fin, outs, outsz, NULL);
+	if (!c)
+		errx(1, "%s: failed parse", fnin);
+
+	for (i = 0; i < outsz; i++) {
+		if (fouts[i] == NULL) {
+			free(outs[i].res);
+			continue;
+		}
+		fwrite(outs[i].res, 1, outs[i].rsz, fouts[i]);
+		c = ferror(fouts[i]);
+		if (fclose(fouts[i]) == EOF || c) {
+			warn("%s", fns[i]);
+			status = 1;
+		}
+		free(outs[i].res);
+		free(fns[i]);
+	}
+
+	if (min != NULL)
+		munmap(min, minsz);
+	free(fouts);
+	free(fns);
+	return status;
+}
+
 static size_t
 get_columns(void)
 {
@@ -210,16 +596,23 @@ main(int argc, char *argv[])
 				*din = NULL;
 	const char		*fnin = "<stdin>", *fnout = NULL,
 	      	 		*fndin = NULL, *extract = NULL, *er,
-				*mainopts = "M:m:sT:o:X:",
+				*outdir = NULL, *outsuffix = NULL,
+				*mainopts = "j:M:m:sT:o:X:",
 	      			*diffopts = "M:m:sT:o:";
 	struct mdown_opts 	 opts;
 	int			 c, diff = 0,
 				 status = 0, aoflag = 0, roflag = 0,
 				 aiflag = 0, riflag = 0, centre = 0;
-	char			*ret = NULL;
-	size_t		 	 i, retsz = 0, rcols;
+	char			*ret = NULL, *min = NULL, *mdin = NULL;
+	size_t		 	 i, retsz = 0, rcols, minsz = 0,
+				 mdinsz = 0, jobs = 0;
 	struct mdown_meta 	*m;
 	struct mdown_metaq	 mq;
+	struct mdown_batch	*b;
+	struct mdown_output	 outs[sizeof(types) / sizeof(types[0])];
+	const char		*cp;
+	size_t			 sz, outsz = 1;
+	int			 j;
 	struct option 		 lo[] = {
 		{ "html-skiphtml",	no_argument,	&aoflag, MDOWN_HTML_SKIP_HTML },
 		{ "html-no-skiphtml",	no_argument,	&roflag, MDOWN_HTML_SKIP_HTML },
@@ -279,6 +672,8 @@ main(int argc, char *argv[])
 		{ "out-no-smarty",	no_argument,	&roflag, MDOWN_SMARTY },
 		{ "out-standalone",	no_argument,	&aoflag, MDOWN_STANDALONE },
 		{ "out-no-standalone",	no_argument,	&roflag, MDOWN_STANDALONE },
+		{ "out-dir",		required_argument, NULL, 6 },
+		{ "out-suffix",		required_argument, NULL, 7 },
 		{ "parse-hilite",	no_argument,	&aiflag, MDOWN_HILITE },
 		{ "parse-no-hilite",	no_argument,	&riflag, MDOWN_HILITE },
 		{ "parse-tables",	no_argument,	&aiflag, MDOWN_TABLES },
@@ -311,7 +706,9 @@ main(int argc, char *argv[])
 		{ "parse-no-ext-attrs",	no_argument,	&riflag, MDOWN_ATTRS },
 		{ "parse-tasklists",	no_argument,	&aiflag, MDOWN_TASKLIST },
 		{ "parse-no-tasklists",	no_argument,	&riflag, MDOWN_TASKLIST },
+		{ "parse-ast",		no_argument,	&aiflag, MDOWN_AST_IN },
 		{ "parse-maxdepth",	required_argument, NULL, 5 },
+		{ "parse-jobs",		required_argument, NULL, 8 },
 		{ NULL,			0,	NULL,	0 }
 	};
 
@@ -326,6 +723,8 @@ main(int argc, char *argv[])
 
 	opts.maxdepth = 128;
 	opts.type = MDOWN_HTML;
+	memset(outs, 0, sizeof(outs));
+	outs[0].type = MDOWN_HTML;
 	opts.feat =
 		MDOWN_ATTRS |
 		MDOWN_AUTOLINK |
@@ -358,6 +757,11 @@ main(int argc, char *argv[])
 	while ((c = getopt_long(argc, argv, 
 	       diff ? diffopts : mainopts, lo, NULL)) != -1)
 		switch (c) {
+		case 'j':
+			jobs = strtonum(optarg, 1, 1024, &er);
+			if (er == NULL)
+				break;
+			errx(1, "-j: %s", er);
 		case 'M':
 			metadata_parse(c, &opts.metaovr, 
 				&opts.metaovrsz, optarg);
@@ -373,28 +777,19 @@ main(int argc, char *argv[])
 			opts.oflags |= MDOWN_STANDALONE;
 			break;
 		case 'T':
-			if (strcasecmp(optarg, "ms") == 0)
-				opts.type = MDOWN_NROFF;
-			else if (strcasecmp(optarg, "gemini") == 0)
-				opts.type = MDOWN_GEMINI;
-			else if (strcasecmp(optarg, "html") == 0)
-				opts.type = MDOWN_HTML;
-			else if (strcasecmp(optarg, "xelatex") == 0)
-				opts.type = MDOWN_XELATEX;
-			else if (strcasecmp(optarg, "latex") == 0)
-				opts.type = MDOWN_LATEX;
-			else if (strcasecmp(optarg, "man") == 0)
-				opts.type = MDOWN_MAN;
-			else if (strcasecmp(optarg, "fodt") == 0)
-				opts.type = MDOWN_FODT;
-			else if (strcasecmp(optarg, "term") == 0)
-				opts.type = MDOWN_TERM;
-			else if (strcasecmp(optarg, "tree") == 0)
-				opts.type = MDOWN_TREE;
-			else if (strcasecmp(optarg, "null") == 0)
-				opts.type = MDOWN_NULL;
-			else
-				goto usage;
+			/* A comma-separated list of output types. */
+			outsz = 0;
+			for (cp = optarg; ; cp += sz + 1) {
+				sz = strcspn(cp, ",");
+				if ((j = type_find(cp, sz)) == -1)
+					goto usage;
+				if (outsz == sizeof(outs) / sizeof(outs[0]))
+					goto usage;
+				outs[outsz++].type = types[j].type;
+				if (cp[sz] == '\0')
+					break;
+			}
+			opts.type = outs[0].type;
 			break;
 		case 'X':
 			extract = optarg;
@@ -440,6 +835,17 @@ main(int argc, char *argv[])
 			if (er == NULL)
 				break;
 			errx(1, "--parse-maxdepth: %s", er);
+		case 6:
+			outdir = optarg;
+			break;
+		case 7:
+			outsuffix = optarg;
+			break;
+		case 8:
+			opts.jobs = strtonum(optarg, 1, 1024, &er);
+			if (er == NULL)
+				break;
+			errx(1, "--parse-jobs: %s", er);
 		default:
 			goto usage;
 		}
@@ -447,9 +853,12 @@ main(int argc, char *argv[])
 	argc -= optind;
 	argv += optind;
 
-	if (opts.type == MDOWN_TERM ||
- 	    opts.type == MDOWN_GEMINI)
-		setlocale(LC_CTYPE, "");
+	for (i = 0; i < outsz; i++)
+		if (outs[i].type == MDOWN_TERM ||
+		    outs[i].type == MDOWN_GEMINI) {
+			setlocale(LC_CTYPE, "");
+			break;
+		}
 
 	/* 
 	 * By default, try to show 80 columns.
@@ -467,6 +876,64 @@ main(int argc, char *argv[])
 	if (centre && opts.cols < rcols)
 		opts.hmargin = (rcols - opts.cols) / 2;
 
+	/* 
+	 * Allow NO_COLOUR to dictate colours.
+	 * This only works for -Tterm output when not in diff mode.
+	 */
+
+	if (getenv("NO_COLOR") != NULL ||
+	    getenv("NO_COLOUR") != NULL)
+		opts.oflags |= MDOWN_TERM_NOCOLOUR;
+
+	/*
+	 * Several output types are rendered from one parse of one input
+	 * file, each into "-o" with the type's suffix.
+	 */
+
+	if (outsz > 1) {
+		if (diff || argc > 1 || outdir != NULL ||
+		    outsuffix != NULL || jobs > 0 || extract != NULL ||
+		    fnout == NULL || strcmp(fnout, "-") == 0)
+			goto usage;
+		if (argc && strcmp(argv[0], "-")) {
+			fnin = argv[0];
+			if ((fin = fopen(fnin, "r")) == NULL)
+				err(1, "%s", fnin);
+		}
+		status = multi_write(&opts, fin, fnin, fnout, outs, outsz);
+		if (fin != stdin)
+			fclose(fin);
+		goto out;
+	}
+
+	/*
+	 * Batch mode converts any number of files, each into its own
+	 * output file, so it can't be sandboxed beyond sandbox_pre().
+	 * Per-file errors are reported but don't stop the batch.
+	 */
+
+	if (!diff && (argc > 1 || outdir != NULL ||
+	    outsuffix != NULL || jobs > 0)) {
+		if (argc == 0 || fnout != NULL || extract != NULL)
+			goto usage;
+		if (outsuffix == NULL)
+			outsuffix = batch_suffix(opts.type);
+		if (jobs > 1) {
+			status = batch_parallel(&opts,
+				argv, argc, outdir, outsuffix, jobs);
+			goto out;
+		}
+		if ((b = mdown_batch_new(&opts)) == NULL)
+			err(1, NULL);
+		for (i = 0; i < (size_t)argc; i++)
+			if (!batch_file(b, opts.type,
+			    argv[i], outdir, outsuffix))
+				status = 1;
+		mdown_batch_free(b);
+		goto out;
+	} else if (outdir != NULL || outsuffix != NULL)
+		goto usage;
+
 	/* 
 	 * Diff mode takes two arguments: the first is mandatory (the
 	 * old file) and the second (the new one) is optional.
@@ -499,6 +966,17 @@ main(int argc, char *argv[])
 	    (fout = fopen(fnout, "w")) == NULL)
 		err(1, "%s", fnout);
 
+	/*
+	 * Map regular input files while we still may: this saves
+	 * copying them into a buffer.
+	 * Anything else (e.g., pipes) is read as a stream.
+	 */
+
+	if (!map_file(fin, &min, &minsz))
+		min = NULL;
+	if (din != NULL && !map_file(din, &mdin, &mdinsz))
+		mdin = NULL;
+
 	sandbox_post(fileno(fin), din == NULL ? 
 		-1 : fileno(din), fileno(fout));
 
@@ -509,20 +987,18 @@ main(int argc, char *argv[])
 	if (extract)
 		opts.feat |= MDOWN_METADATA;
 
-	/* 
-	 * Allow NO_COLOUR to dictate colours.
-	 * This only works for -Tterm output when not in diff mode.
-	 */
-
-	if (getenv("NO_COLOR") != NULL ||
-	    getenv("NO_COLOUR") != NULL)
-		opts.oflags |= MDOWN_TERM_NOCOLOUR;
-
 	if (diff) {
 		opts.oflags &= ~MDOWN_TERM_NOCOLOUR;
-		if (!mdown_file_diff
+		if (min != NULL && mdin != NULL) {
+			if (!mdown_buf_diff(&opts, min, minsz,
+			    mdin, mdinsz, &ret, &retsz))
+				errx(1, "%s: failed parse", fnin);
+		} else if (!mdown_file_diff
 		    (&opts, fin, din, &ret, &retsz))
 			errx(1, "%s: failed parse", fnin);
+	} else if (min != NULL) {
+		if (!mdown_buf(&opts, min, minsz, &ret, &retsz, &mq))
+			errx(1, "%s: failed parse", fnin);
 	} else {
 		if (!mdown_file(&opts, fin, &ret, &retsz, &mq))
 			errx(1, "%s: failed parse", fnin);
@@ -544,6 +1020,10 @@ main(int argc, char *argv[])
 
 	free(ret);
 
+	if (min != NULL)
+		munmap(min, minsz);
+	if (mdin != NULL)
+		munmap(mdin, mdinsz);
 	if (fout != stdout)
 		fclose(fout);
 	if (din != NULL)
@@ -551,6 +1031,7 @@ main(int argc, char *argv[])
 	if (fin != stdin)
 		fclose(fin);
 
+out:
 	for (i = 0; i < opts.metasz; i++)
 		free(opts.meta[i]);
 	for (i = 0; i < opts.metaovrsz; i++)
@@ -564,8 +1045,9 @@ main(int argc, char *argv[])
 usage:
 	if (!diff) {
 		fprintf(stderr, 
-			"usage: mdown [-s] [input_options] [output_options] [-M metadata]\n"
-			"               [-m metadata] [-o output] [-T mode] [-X keyword] [file]\n");
+			"usage: mdown [-s] [input_options] [output_options] [-j jobs]\n"
+			"               [-M metadata] [-m metadata] [-o output] [-T mode]\n"
+			"               [-X keyword] [file ...]\n");
 	} else
 		fprintf(stderr, 
 			"usage: mdown-diff [-s] [input_options] [output_options] [-M metadata]\n"
@@ -53,7 +53,8 @@ enum	mdown_type {
 	MDOWN_FODT,
 	MDOWN_TERM,
 	MDOWN_TREE,
-	MDOWN_NULL
+	MDOWN_NULL,
+	MDOWN_AST
 };
 
 /*
@@ -111,6 +112,8 @@ struct	mdown_buf {
 
 TAILQ_HEAD(mdown_nodeq, mdown_node);
 
+struct	mdown_arena;
+
 enum 	htbl_flags {
 	HTBL_FL_ALIGN_LEFT = 1,
 	HTBL_FL_ALIGN_RIGHT = 2,
@@ -261,11 +264,15 @@ struct rndr_math {
 /*
  * Node parsed from input document.
  * Each node is part of the parse tree.
+ * The larger and less common attributes (links, images, code blocks,
+ * and footnote references) are allocated separately, so that the
+ * union is no larger than a text node needs.
  */
 struct	mdown_node {
 	enum mdown_rndrt	 type;
 	enum mdown_chng	 chng; /* change type */
 	size_t			 id; /* unique identifier */
+	struct mdown_arena	*arena; /* allocator (or NULL) */
 	union {
 		struct rndr_meta rndr_meta;
 		struct rndr_list rndr_list; 
@@ -276,16 +283,16 @@ struct	mdown_node {
 		struct rndr_entity rndr_entity; 
 		struct rndr_autolink rndr_autolink; 
 		struct rndr_raw_html rndr_raw_html; 
-		struct rndr_link rndr_link; 
-		struct rndr_blockcode rndr_blockcode; 
+		struct rndr_link *rndr_link; 
+		struct rndr_blockcode *rndr_blockcode; 
 		struct rndr_definition rndr_definition; 
 		struct rndr_codespan rndr_codespan; 
 		struct rndr_table rndr_table; 
 		struct rndr_table_header rndr_table_header; 
 		struct rndr_table_cell rndr_table_cell; 
 		struct rndr_footnote_def rndr_footnote_def;
-		struct rndr_footnote_ref rndr_footnote_ref;
-		struct rndr_image rndr_image;
+		struct rndr_footnote_ref *rndr_footnote_ref;
+		struct rndr_image *rndr_image;
 		struct rndr_math rndr_math;
 		struct rndr_blockhtml rndr_blockhtml;
 	};
@@ -323,6 +330,8 @@ struct	mdown_opts {
 #define	MDOWN_IMG_EXT	 	  0x20000 /* -> MDOWN_ATTRS */
 #define MDOWN_TASKLIST	  0x40000
 #define MDOWN_ATTRS		  0x80000
+#define MDOWN_SMARTY_PARSE	  0x100000
+#define MDOWN_AST_IN		  0x200000
 	unsigned int		  oflags;
 #define	MDOWN_GEMINI_LINK_END	  0x8000 /* links at end */
 #define	MDOWN_GEMINI_LINK_IN	  0x10000 /* links inline */
@@ -356,8 +365,19 @@ struct	mdown_opts {
 	size_t			  metasz;
 	char			**metaovr;
 	size_t			  metaovrsz;
+	size_t			  jobs; /* parser threads (if >1) */
+};
+
+/*
+ * One of the outputs rendered from a single parse by mdown_buf_multi().
+ */
+struct	mdown_output {
+	enum mdown_type	 type; /* output type */
+	char		*res; /* output (on success) */
+	size_t		 rsz; /* size of "res" */
 };
 
+struct mdown_batch;
 struct mdown_doc;
 
 __BEGIN_DECLS
@@ -377,6 +397,23 @@ int	 mdown_file(const struct mdown_opts *,
 		FILE *, char **, size_t *, struct mdown_metaq *);
 int	 mdown_file_diff(const struct mdown_opts *, FILE *, 
 		FILE *, char **, size_t *);
+int	 mdown_buf_multi(const struct mdown_opts *,
+		const char *, size_t, struct mdown_output *, size_t,
+		struct mdown_metaq *);
+int	 mdown_file_multi(const struct mdown_opts *, FILE *,
+		struct mdown_output *, size_t, struct mdown_metaq *);
+
+/*
+ * Like the above, but keeping the parser and renderer between documents
+ * for converting many of them.
+ */
+struct mdown_batch
+	*mdown_batch_new(const struct mdown_opts *);
+int	 mdown_batch_buf(struct mdown_batch *, const char *, size_t,
+		char **, size_t *, struct mdown_metaq *);
+int	 mdown_batch_file(struct mdown_batch *, FILE *,
+		char **, size_t *, struct mdown_metaq *);
+void	 mdown_batch_free(struct mdown_batch *);
 
 /* 
  * Low-level functions.
@@ -387,12 +424,17 @@ int	 mdown_file_diff(const struct mdown_opts *, FILE *,
 struct mdown_buf
 	*mdown_buf_new(size_t) __attribute__((malloc));
 void	 mdown_buf_free(struct mdown_buf *);
+int	 mdown_buf_reserve(struct mdown_buf *, size_t);
 
 struct mdown_doc
 	*mdown_doc_new(const struct mdown_opts *);
 struct mdown_node
 	*mdown_doc_parse(struct mdown_doc *, size_t *,
 		const char *, size_t, struct mdown_metaq *);
+int	 mdown_doc_stream(struct mdown_doc *, struct mdown_metaq *,
+		int (*)(const struct mdown_node *, void *), void *);
+int	 mdown_doc_feed(struct mdown_doc *, const char *, size_t);
+int	 mdown_doc_finish(struct mdown_doc *, size_t *);
 struct mdown_node
 	*mdown_diff(const struct mdown_node *,
 		const struct mdown_node *, size_t *);
@@ -424,6 +466,12 @@ int 	 mdown_nroff_rndr(struct mdown_buf *, void *,
 int 	 mdown_tree_rndr(struct mdown_buf *, 
 		const struct mdown_node *);
 
+int	 mdown_ast_rndr(struct mdown_buf *,
+		const struct mdown_node *, const struct mdown_metaq *);
+struct mdown_node
+	*mdown_ast_load(const struct mdown_opts *, const char *,
+		size_t, size_t *, struct mdown_metaq *);
+
 void	 mdown_xelatex_free(void *);
 void	*mdown_xelatex_new(const struct mdown_opts *);
 int 	 mdown_xelatex_rndr(struct mdown_buf *, void *, 
@@ -175,26 +175,22 @@ hesc_nroff(struct mdown_buf *ob, const char *data,
 static const char *
 nstate_colour_buf(unsigned int ft)
 {
-	static char 	 fonts[10];
 
-	fonts[0] = '\0';
 	if (ft == BFONT_BLUE)
-		strlcat(fonts, "blue", sizeof(fonts));
+		return "blue";
 	else if (ft == BFONT_RED)
-		strlcat(fonts, "red", sizeof(fonts));
-	else
-		strlcat(fonts, "black", sizeof(fonts));
-	return fonts;
+		return "red";
+	return "black";
 }
 
 /*
  * For compatibility with traditional troff, return non-block font code
  * using the correct sequence of \fX, \f(xx, and \f[xxx].
+ * This is written into "fonts", which must have at least 6 bytes.
  */
 static const char *
-nstate_font_buf(unsigned int ft, int blk)
+nstate_font_buf(unsigned int ft, int blk, char *fonts)
 {
-	static char 	 fonts[10];
 	char		*cp = fonts;
 	size_t		 len = 0;
 
@@ -340,6 +336,7 @@ bqueue_flush(struct mdown_buf *ob, const struct bnodeq *bq, int esc)
 	const struct bnode	*bn, *chk;
 	const char		*cp;
 	int		 	 nextblk;
+	char			 fonts[6];
 
 	TAILQ_FOREACH(bn, bq, entries) {
 		nextblk = 0;
@@ -385,11 +382,11 @@ bqueue_flush(struct mdown_buf *ob, const struct bnodeq *bq, int esc)
 
 		if (bn->scope == BSCOPE_FONT && nextblk) {
 			if (!hbuf_printf(ob, ".ft %s",
-			    nstate_font_buf(bn->font, nextblk)))
+			    nstate_font_buf(bn->font, nextblk, fonts)))
 				return 0;
 		} else if (bn->scope == BSCOPE_FONT) {
 			if (!hbuf_printf(ob, "\\f%s", 
-			    nstate_font_buf(bn->font, nextblk)))
+			    nstate_font_buf(bn->font, nextblk, fonts)))
 				return 0;
 		} else if (bn->scope == BSCOPE_COLOUR) {
 			assert(nextblk);
@@ -528,7 +525,7 @@ putlink(struct bnodeq *obq, struct nroff *st,
 	const struct mdown_buf *link, struct bnodeq *bq,
 	enum halink_type type, const struct mdown_node *next)
 {
-	struct mdown_buf		*ob = NULL, *tmp = NULL;
+	struct mdown_buf		*ob = NULL;
 	const struct mdown_buf	*nbuf;
 	struct bnode			*bn, *prev;
 	size_t				 sz, i;
@@ -628,16 +625,12 @@ putlink(struct bnodeq *obq, struct nroff *st,
 		if (!HBUF_PUTSL(ob, "\" "))
 			goto out;
 
-		if ((tmp = hbuf_new(32)) == NULL)
-			goto out;
-		if (!hesc_nroff(tmp, prev->buf, sz, 1, 0, 1))
-			goto out;
-		assert(prev->nbuf == NULL);
-		prev->nbuf = strndup(tmp->data, tmp->size);
-		if (prev->nbuf == NULL)
-			goto out;
-		free(prev->buf);
-		prev->buf = NULL;
+		/*
+		 * Leave the rest to be escaped when flushed, which also
+		 * strips its leading white-space if it starts a line.
+		 */
+
+		prev->buf[sz] = '\0';
 	}
 
 	/* 
@@ -691,7 +684,6 @@ putlink(struct bnodeq *obq, struct nroff *st,
 
 	rc = 1;
 out:
-	hbuf_free(tmp);
 	hbuf_free(ob);
 	return rc ? ret : -1;
 }
@@ -1457,6 +1449,7 @@ rndr_doc_header(const struct nroff *st,
 					*copy = NULL, *sec = NULL,
 					*rcsauthor = NULL, *rcsdate = NULL,
 					*source = NULL, *volume = NULL;
+	char				 rcsauthorbuf[1024], rcsdatebuf[32];
 
 	if (!(st->flags & MDOWN_STANDALONE))
 		return 1;
@@ -1471,9 +1464,11 @@ rndr_doc_header(const struct nroff *st,
 		else if (strcasecmp(m->key, "date") == 0)
 			date = m->value;
 		else if (strcasecmp(m->key, "rcsauthor") == 0)
-			rcsauthor = rcsauthor2str(m->value);
+			rcsauthor = rcsauthor2str(m->value,
+			    rcsauthorbuf, sizeof(rcsauthorbuf));
 		else if (strcasecmp(m->key, "rcsdate") == 0)
-			rcsdate = rcsdate2str(m->value);
+			rcsdate = rcsdate2str(m->value,
+			    rcsdatebuf, sizeof(rcsdatebuf));
 		else if (strcasecmp(m->key, "title") == 0)
 			title = m->value;
 		else if (strcasecmp(m->key, "section") == 0)
@@ -1661,7 +1656,7 @@ rndr(struct mdown_metaq *mq, struct nroff *st,
 	ret = 0;
 	switch (n->type) {
 	case MDOWN_BLOCKCODE:
-		rc = rndr_blockcode(st, obq, &n->rndr_blockcode);
+		rc = rndr_blockcode(st, obq, n->rndr_blockcode);
 		break;
 	case MDOWN_BLOCKQUOTE:
 		rc = rndr_blockquote(st, obq, &tmpbq);
@@ -1728,20 +1723,20 @@ rndr(struct mdown_metaq *mq, struct nroff *st,
 		rc = rndr_codespan(obq, &n->rndr_codespan);
 		break;
 	case MDOWN_IMAGE:
-		rc = rndr_image(st, obq, &n->rndr_image);
+		rc = rndr_image(st, obq, n->rndr_image);
 		break;
 	case MDOWN_LINEBREAK:
 		rc = rndr_linebreak(obq);
 		break;
 	case MDOWN_LINK:
 		ret = rndr_link(st, obq, &tmpbq, 
-			&n->rndr_link, TAILQ_NEXT(n, entries));
+			n->rndr_link, TAILQ_NEXT(n, entries));
 		break;
 	case MDOWN_SUPERSCRIPT:
 		rc = rndr_superscript(obq, &tmpbq);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		rc = rndr_footnote_ref(st, obq, &n->rndr_footnote_ref);
+		rc = rndr_footnote_ref(st, obq, n->rndr_footnote_ref);
 		break;
 	case MDOWN_RAW_HTML:
 		rc = rndr_raw_html(st, obq, &n->rndr_raw_html);
@@ -858,9 +858,11 @@ odt_changes_flush(struct mdown_buf *ob,
 	const struct mdown_meta	*m;
 	const char			*author = NULL, *date = NULL,
 	      				*rcsauthor = NULL, *rcsdate = NULL;
+	char				 rcsauthorbuf[1024], rcsdatebuf[32];
 	char				 buf[64];
 	size_t	 			 i;
 	time_t				 t = time(NULL);
+	struct tm			 tm;
 
 	if (st->chngsz == 0)
 		return 1;
@@ -871,9 +873,11 @@ odt_changes_flush(struct mdown_buf *ob,
 		else if (strcasecmp(m->key, "date") == 0)
 			date = m->value;
 		else if (strcasecmp(m->key, "rcsauthor") == 0)
-			rcsauthor = rcsauthor2str(m->value);
+			rcsauthor = rcsauthor2str(m->value,
+			    rcsauthorbuf, sizeof(rcsauthorbuf));
 		else if (strcasecmp(m->key, "rcsdate") == 0)
-			rcsdate = rcsdate2str(m->value);
+			rcsdate = rcsdate2str(m->value,
+			    rcsdatebuf, sizeof(rcsdatebuf));
 
 	/* Overrides. */
 
@@ -885,8 +889,9 @@ odt_changes_flush(struct mdown_buf *ob,
 	/* We require at least a date. */
 
 	if (date == NULL) {
-		if (strftime(buf, sizeof(buf),
-		    "%Y-%m-%dT%H:%M:%S", localtime(&t)) == 0)
+		if (localtime_r(&t, &tm) == NULL ||
+		    strftime(buf, sizeof(buf),
+		    "%Y-%m-%dT%H:%M:%S", &tm) == 0)
 			date = "1970-01-01";
 		else
 			date = buf;
@@ -944,6 +949,7 @@ odt_metaq_flush(struct mdown_buf *ob,
 	const char			*author = NULL, *title = NULL,
 					*date = NULL, *rcsauthor = NULL, 
 					*rcsdate = NULL;
+	char				 rcsauthorbuf[1024], rcsdatebuf[32];
 
 	if (mq == NULL || TAILQ_EMPTY(mq))
 		return 1;
@@ -954,9 +960,11 @@ odt_metaq_flush(struct mdown_buf *ob,
 		else if (strcasecmp(m->key, "date") == 0)
 			date = m->value;
 		else if (strcasecmp(m->key, "rcsauthor") == 0)
-			rcsauthor = rcsauthor2str(m->value);
+			rcsauthor = rcsauthor2str(m->value,
+			    rcsauthorbuf, sizeof(rcsauthorbuf));
 		else if (strcasecmp(m->key, "rcsdate") == 0)
-			rcsdate = rcsdate2str(m->value);
+			rcsdate = rcsdate2str(m->value,
+			    rcsdatebuf, sizeof(rcsdatebuf));
 		else if (strcasecmp(m->key, "title") == 0)
 			title = m->value;
 
@@ -1996,7 +2004,7 @@ rndr(struct mdown_buf *ob,
 		rc = rndr_root(ob, mq, tmp, st);
 		break;
 	case MDOWN_BLOCKCODE:
-		rc = rndr_blockcode(ob, &n->rndr_blockcode, st);
+		rc = rndr_blockcode(ob, n->rndr_blockcode, st);
 		break;
 	case MDOWN_META:
 		if (n->chng != MDOWN_CHNG_DELETE)
@@ -2050,16 +2058,16 @@ rndr(struct mdown_buf *ob,
 		rc = rndr_span(ob, tmp, n, st);
 		break;
 	case MDOWN_IMAGE:
-		rc = rndr_image(ob, &n->rndr_image, st);
+		rc = rndr_image(ob, n->rndr_image, st);
 		break;
 	case MDOWN_LINEBREAK:
 		rc = rndr_linebreak(ob);
 		break;
 	case MDOWN_LINK:
-		rc = rndr_link(ob, tmp, &n->rndr_link, st);
+		rc = rndr_link(ob, tmp, n->rndr_link, st);
 		break;
 	case MDOWN_FOOTNOTE_REF:
-		rc = rndr_footnote_ref(ob, &n->rndr_footnote_ref, st);
+		rc = rndr_footnote_ref(ob, n->rndr_footnote_ref, st);
 		break;
 	case MDOWN_MATH_BLOCK:
 		rc = rndr_math(ob, &n->rndr_math, st);
@@ -158,62 +158,71 @@ static const enum type types[MDOWN__MAX] = {
 };
 
 /*
- * Given the sequence in "n" starting at "start" and ending at "end",
- * split "n" around the sequence and replace it with "entity".
- * This behaves properly if the leading or trailing sequence is
- * zero-length.
- * It may modify the subtree rooted at the parent of "n".
- * Return zero on failure (memory), non-zero on success.
+ * Allocate a node of type "type" and insert it after "prev".
+ * New nodes come from the same arena as "prev" (if any).
+ * Return NULL on failure (memory), the new node on success.
  */
-static int
-smarty_entity(struct mdown_node *n, size_t *maxn,
-	size_t start, size_t end, enum entity entity)
+static struct mdown_node *
+smarty_node(struct mdown_node *prev, size_t *maxn, enum mdown_rndrt type)
 {
-	struct mdown_node	*nn, *nent;
+	struct mdown_node	*nn;
+
+	nn = arena_calloc(prev->arena, 1, sizeof(struct mdown_node));
+	if (nn == NULL)
+		return NULL;
+	TAILQ_INSERT_AFTER(&prev->parent->children, prev, nn, entries);
+
+	nn->id = (*maxn)++;
+	nn->arena = prev->arena;
+	nn->type = type;
+	nn->parent = prev->parent;
+	TAILQ_INIT(&nn->children);
+	return nn;
+}
 
-	assert(n->type == MDOWN_NORMAL_TEXT);
+/*
+ * Add an entity node for "entity" after "prev".
+ * Return NULL on failure (memory), the new node on success.
+ */
+static struct mdown_node *
+smarty_entity(struct mdown_node *prev, size_t *maxn, enum entity entity)
+{
+	struct mdown_node	*nent;
+	size_t			 sz;
 
-	/* Allocate the subsequent entity. */
+	if ((nent = smarty_node(prev, maxn, MDOWN_ENTITY)) == NULL)
+		return NULL;
+	sz = strlen(ents[entity]);
+	nent->rndr_entity.text.data = arena_calloc(prev->arena, 1, sz + 1);
+	if (nent->rndr_entity.text.data == NULL)
+		return NULL;
+	memcpy(nent->rndr_entity.text.data, ents[entity], sz);
+	nent->rndr_entity.text.size = sz;
+	return nent;
+}
 
-	nent = calloc(1, sizeof(struct mdown_node));
-	if (nent == NULL)
-		return 0;
-	TAILQ_INSERT_AFTER(&n->parent->children, n, nent, entries);
+/*
+ * Set the text of "nn", which was split off from the text node "n", to
+ * bytes "start" through "end" of the original text "data".
+ * Nodes in an arena share the original text, which lives as long as the
+ * arena; otherwise each node must own a copy.
+ * Return zero on failure (memory), non-zero on success.
+ */
+static int
+smarty_text(struct mdown_node *n, struct mdown_node *nn,
+	const char *data, size_t start, size_t end)
+{
+	struct mdown_buf	*b = &nn->rndr_normal_text.text;
 
-	nent->id = (*maxn)++;
-	nent->type = MDOWN_ENTITY;
-	nent->parent = n->parent;
-	TAILQ_INIT(&nent->children);
-	nent->rndr_entity.text.data = strdup(ents[entity]);
-	if (nent->rndr_entity.text.data == NULL)
-		return 0;
-	nent->rndr_entity.text.size = strlen(ents[entity]);
-
-	/* Allocate the remaining bits, if applicable. */
-
-	if (n->rndr_normal_text.text.size - end > 0) {
-		nn = calloc(1, sizeof(struct mdown_node));
-		if (nn == NULL)
-			return 0;
-		TAILQ_INSERT_AFTER(&n->parent->children, 
-			nent, nn, entries);
-
-		nn->id = (*maxn)++;
-		nn->type = MDOWN_NORMAL_TEXT;
-		nn->parent = n->parent;
-		TAILQ_INIT(&nn->children);
-		nn->rndr_normal_text.text.size = 
-			n->rndr_normal_text.text.size - end;
-		nn->rndr_normal_text.text.data = 
-			malloc(nn->rndr_normal_text.text.size);
-		if (nn->rndr_normal_text.text.data == NULL)
-			return 0;
-		memcpy(nn->rndr_normal_text.text.data,
-			n->rndr_normal_text.text.data + end,
-			nn->rndr_normal_text.text.size);
+	if (nn == n || nn->arena != NULL) {
+		b->data = (char *)data + start;
+		b->size = end - start;
+		return 1;
 	}
-
-	n->rndr_normal_text.text.size = start;
+	if ((b->data = calloc(1, end - start + 1)) == NULL)
+		return 0;
+	memcpy(b->data, data + start, end - start);
+	b->size = end - start;
 	return 1;
 }
 
@@ -286,41 +295,51 @@ smarty_right_wb_r(const struct mdown_node *n, int skip)
 }
 
 /*
- * See if the character to the right of position "pos" in node "n" marks
- * the end of a word.
- * This may require us to traverse the node graph if we're on a node
- * boundary as well.
+ * See if the character to the right of position "pos" in the text
+ * "data" of size "size" marks the end of a word.
+ * If we're at the end of the text, traverse the node graph from "n", the
+ * last node split from the text.
  */
 static int
-smarty_right_wb(const struct mdown_node *n, size_t pos)
+smarty_right_wb(const struct mdown_node *n,
+	const char *data, size_t size, size_t pos)
 {
-	const struct mdown_buf	*b;
 
 	assert(n->type == MDOWN_NORMAL_TEXT);
-	b = &n->rndr_normal_text.text;
 
-	if (pos + 1 <= b->size)
-		return smarty_is_wb_r(b->data[pos]);
+	if (pos < size)
+		return smarty_is_wb_r(data[pos]);
 
 	return smarty_right_wb_r(n, 1);
 }
 
 /*
- * FIXME: this can be faster with a table-based lookup instead of the
- * switch statement.
- * Returns >1 if a left-quote entity was inserted as the next node
- * of the parse tree, <0 on failure, otherwise return zero.
+ * Make all substitutions in the text node "n" in one pass.
+ * Each substitution truncates the current text node, then adds an entity
+ * node and (if any text remains) a new current text node after it.
+ * Left quotes don't clear the left word-break, as they're skipped
+ * instead of being visited as opaque nodes.
+ * Returns the last node split from "n" (or "n" itself), NULL on failure.
  */
-static int
-smarty_hbuf(struct mdown_node *n, size_t *maxn,
-	struct mdown_buf *b, struct smarty *s)
+static struct mdown_node *
+smarty_hbuf(struct mdown_node *n, size_t *maxn, struct smarty *s)
 {
-	size_t	 i = 0, j, sz;
+	struct mdown_node	*cur = n, *last = n;
+	const char		*data;
+	size_t			 i = 0, j, sz, size, start = 0, end;
+	enum entity		 ent;
+	int			 left;
 
 	assert(n->type == MDOWN_NORMAL_TEXT);
+	data = n->rndr_normal_text.text.data;
+	size = n->rndr_normal_text.text.size;
+
+	while (i < size) {
+		ent = ENT__MAX;
+		end = i + 1;
+		left = 0;
 
-	for (i = 0; i < b->size; i++) {
-		switch (b->data[i]) {
+		switch (data[i]) {
 		case '.':
 		case '(':
 		case '-':
@@ -328,45 +347,32 @@ smarty_hbuf(struct mdown_node *n, size_t *maxn,
 
 			for (j = 0; syms[j].key != NULL; j++) {
 				sz = strlen(syms[j].key);
-				if (i + sz - 1 >= b->size)
-					continue;
-				if (memcmp(syms[j].key, 
-				    &b->data[i], sz))
+				if (i + sz > size ||
+				    memcmp(syms[j].key, &data[i], sz))
 					continue;
-				if (!smarty_entity(n, maxn, 
-				    i, i + sz, syms[j].ent))
-					return -1;
-				return 0;
+				ent = syms[j].ent;
+				end = i + sz;
+				break;
 			}
 			break;
 		case '"':
 			/* Left-wb and right-wb differ. */
 
-			if (!s->left_wb) {
-				if (!smarty_right_wb(n, i + 1)) 
-					break;
-				if (!smarty_entity(n, maxn, 
-				    i, i + 1, ENT_RDQUO))
-					return -1;
-				return 0;
-			}
-			if (!smarty_entity
-			    (n, maxn, i, i + 1, ENT_LDQUO))
-				return -1;
-			return 1;
+			if (s->left_wb) {
+				ent = ENT_LDQUO;
+				left = 1;
+			} else if (smarty_right_wb(cur, data, size, i + 1))
+				ent = ENT_RDQUO;
+			break;
 		case '\'':
 			/* Left-wb and right-wb differ. */
 
-			if (!s->left_wb) {
-				if (!smarty_entity(n, maxn, 
-				    i, i + 1, ENT_RSQUO))
-					return -1;
-				return 0;
-			}
-			if (!smarty_entity
-			    (n, maxn, i, i + 1, ENT_LSQUO))
-				return -1;
-			return 1;
+			if (s->left_wb) {
+				ent = ENT_LSQUO;
+				left = 1;
+			} else
+				ent = ENT_RSQUO;
+			break;
 		case '1':
 		case '3':
 			/* Symbols that require wb. */
@@ -375,45 +381,56 @@ smarty_hbuf(struct mdown_node *n, size_t *maxn,
 				break;
 			for (j = 0; syms2[j].key != NULL; j++) {
 				sz = strlen(syms2[j].key);
-				if (i + sz - 1 >= b->size)
-					continue;
-				if (memcmp(syms2[j].key, 
-				    &b->data[i], sz))
+				if (i + sz > size ||
+				    memcmp(syms2[j].key, &data[i], sz))
 					continue;
-				if (!smarty_right_wb(n, i + sz)) 
+				if (!smarty_right_wb(cur, data, size, i + sz))
 					continue;
-				if (!smarty_entity(n, maxn, i, 
-				    i + sz, syms2[j].ent))
-					return -1;
-				return 0;
+				ent = syms2[j].ent;
+				end = i + sz;
+				break;
 			}
 			break;
 		default:
 			break;
 		}
 
-		s->left_wb = smarty_is_wb_l(b->data[i]);
+		if (ent == ENT__MAX) {
+			s->left_wb = smarty_is_wb_l(data[i++]);
+			continue;
+		}
+
+		if (!smarty_text(n, cur, data, start, i))
+			return NULL;
+		if ((last = smarty_entity(last, maxn, ent)) == NULL)
+			return NULL;
+		if (!left)
+			s->left_wb = 0;
+		cur = NULL;
+		if (end < size) {
+			cur = smarty_node(last, maxn, MDOWN_NORMAL_TEXT);
+			if ((last = cur) == NULL)
+				return NULL;
+		}
+		start = i = end;
 	}
 
-	return 0;
+	if (cur != NULL && !smarty_text(n, cur, data, start, size))
+		return NULL;
+	return last;
 }
 
 static int
 smarty_span(struct mdown_node *root, size_t *maxn, struct smarty *s)
 {
 	struct mdown_node	*n;
-	int			 c;
 
 	TAILQ_FOREACH(n, &root->children, entries)
 		switch (types[n->type]) {
 		case TYPE_TEXT:
 			assert(n->type == MDOWN_NORMAL_TEXT);
-			c = smarty_hbuf(n, maxn, 
-				&n->rndr_normal_text.text, s);
-			if (c < 0)
+			if ((n = smarty_hbuf(n, maxn, s)) == NULL)
 				return 0;
-			if (c > 0)
-				n = TAILQ_NEXT(n, entries);
 			break;
 		case TYPE_SPAN:
 			if (!smarty_span(n, maxn, s))
@@ -432,12 +449,10 @@ smarty_span(struct mdown_node *root, size_t *maxn, struct smarty *s)
 }
 
 static int
-smarty_block(struct mdown_node *root,
-	size_t *maxn, enum mdown_type type)
+smarty_block(struct mdown_node *root, size_t *maxn)
 {
 	struct smarty		 s;
 	struct mdown_node	*n;
-	int			 c;
 
 	s.left_wb = 1;
 
@@ -446,17 +461,13 @@ smarty_block(struct mdown_node *root,
 		case TYPE_ROOT:
 		case TYPE_BLOCK:
 			s.left_wb = 1;
-			if (!smarty_block(n, maxn, type))
+			if (!smarty_block(n, maxn))
 				return 0;
 			break;
 		case TYPE_TEXT:
 			assert(n->type == MDOWN_NORMAL_TEXT);
-			c = smarty_hbuf(n, maxn, 
-				&n->rndr_normal_text.text, &s);
-			if (c < 0)
+			if ((n = smarty_hbuf(n, maxn, &s)) == NULL)
 				return 0;
-			if (c > 0)
-				n = TAILQ_NEXT(n, entries);
 			break;
 		case TYPE_SPAN:
 			if (!smarty_span(n, maxn, &s))
@@ -480,5 +491,24 @@ smarty(struct mdown_node *n, size_t maxn, enum mdown_type type)
 	if (n == NULL)
 		return 1;
 	assert(types[n->type] == TYPE_ROOT);
-	return smarty_block(n, &maxn, type);
+	return smarty_block(n, &maxn);
+}
+
+/*
+ * Like smarty(), but only for "n", a child of the root, while the tree
+ * is still being parsed.  New nodes are numbered from "maxn", which is
+ * incremented accordingly.
+ * Text at the end of "n" looks ahead to its next sibling, so the caller
+ * must make sure that it exists and won't change (or that there won't
+ * be one).
+ * Return zero on failure (memory), non-zero on success.
+ */
+int
+smarty_top(struct mdown_node *n, size_t *maxn)
+{
+
+	assert(n->parent != NULL && types[n->parent->type] == TYPE_ROOT);
+	assert(types[n->type] == TYPE_BLOCK ||
+	    types[n->type] == TYPE_OPAQUE);
+	return types[n->type] == TYPE_OPAQUE || smarty_block(n, maxn);
 }
@@ -1306,7 +1306,7 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 	case MDOWN_FOOTNOTE_REF:
 		hbuf_truncate(p->tmp);
 		if (!hbuf_printf(p->tmp, "%s%zu%s", ifx_fref_left,
-		    n->rndr_footnote_ref.num, ifx_fref_right))
+		    n->rndr_footnote_ref->num, ifx_fref_right))
 			return 0;
 		rc = rndr_buf(p, ob, n, p->tmp, NULL);
 		break;
@@ -1328,7 +1328,7 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 				&sty_bad_ent);
 		break;
 	case MDOWN_BLOCKCODE:
-		rc = rndr_buf(p, ob, n, &n->rndr_blockcode.text, NULL);
+		rc = rndr_buf(p, ob, n, &n->rndr_blockcode->text, NULL);
 		break;
 	case MDOWN_BLOCKHTML:
 		rc = rndr_buf(p, ob, n, &n->rndr_blockhtml.text, NULL);
@@ -1357,16 +1357,16 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 		if (p->opts & MDOWN_TERM_SHORTLINK) {
 			hbuf_truncate(p->tmp);
 			if (!hbuf_shortlink
-			    (p->tmp, &n->rndr_link.link))
+			    (p->tmp, &n->rndr_link->link))
 				return 0;
 			rc = rndr_buf(p, ob, n, p->tmp, NULL);
 		} else
-			rc = rndr_buf(p, ob, n, &n->rndr_link.link, NULL);
+			rc = rndr_buf(p, ob, n, &n->rndr_link->link, NULL);
 		break;
 	case MDOWN_IMAGE:
-		if (!rndr_buf(p, ob, n, &n->rndr_image.alt, NULL))
+		if (!rndr_buf(p, ob, n, &n->rndr_image->alt, NULL))
 			return 0;
-		if (n->rndr_image.alt.size) {
+		if (n->rndr_image->alt.size) {
 			hbuf_truncate(p->tmp);
 			if (!HBUF_PUTSL(p->tmp, " "))
 				return 0;
@@ -1389,13 +1389,13 @@ rndr(struct mdown_buf *ob, struct mdown_metaq *mq,
 		if (p->opts & MDOWN_TERM_SHORTLINK) {
 			hbuf_truncate(p->tmp);
 			if (!hbuf_shortlink
-			    (p->tmp, &n->rndr_image.link))
+			    (p->tmp, &n->rndr_image->link))
 				return 0;
 			if (!rndr_buf(p, ob, n, p->tmp, &sty_imgurl))
 				return 0;
 		} else
 			if (!rndr_buf(p, ob, n,
-			    &n->rndr_image.link, &sty_imgurl))
+			    &n->rndr_image->link, &sty_imgurl))
 				return 0;
 		hbuf_truncate(p->tmp);
 		if (!hbuf_puts(p->tmp, ifx_imgbox_right))
@@ -141,64 +141,64 @@ rndr(struct mdown_buf *ob,
 			return 0;
 		if (!hbuf_printf(ob, "source: "))
 			return 0;
-		if (!rndr_short(ob, &root->rndr_image.link))
+		if (!rndr_short(ob, &root->rndr_image->link))
 			return 0;
-		if (root->rndr_image.dims.size) {
+		if (root->rndr_image->dims.size) {
 			if (!HBUF_PUTSL(ob, "("))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.dims))
+			if (!rndr_short(ob, &root->rndr_image->dims))
 				return 0;
 			if (!HBUF_PUTSL(ob, ")"))
 				return 0;
 		}
 		if (!HBUF_PUTSL(ob, "\n"))
 			return 0;
-		if (root->rndr_image.title.size) {
+		if (root->rndr_image->title.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!hbuf_printf(ob, "title: "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.title))
+			if (!rndr_short(ob, &root->rndr_image->title))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
 		}
-		if (root->rndr_image.alt.size) {
+		if (root->rndr_image->alt.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!hbuf_printf(ob, "alt: "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.alt))
+			if (!rndr_short(ob, &root->rndr_image->alt))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
 		}
-		if (root->rndr_image.dims.size) {
+		if (root->rndr_image->dims.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!hbuf_printf(ob, "dims: "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.dims))
+			if (!rndr_short(ob, &root->rndr_image->dims))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
 		}
-		if (root->rndr_image.attr_width.size) {
+		if (root->rndr_image->attr_width.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!hbuf_printf(ob, "width (extended): "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.attr_width))
+			if (!rndr_short(ob, &root->rndr_image->attr_width))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
 		}
-		if (root->rndr_image.attr_height.size) {
+		if (root->rndr_image->attr_height.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!hbuf_printf(ob, "height (extended): "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_image.attr_height))
+			if (!rndr_short(ob, &root->rndr_image->attr_height))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
@@ -215,13 +215,13 @@ rndr(struct mdown_buf *ob,
 		if (!rndr_indent(ob, indent + 1))
 			return 0;
 		if (!hbuf_printf(ob, "number: %zu\n",
-		    root->rndr_footnote_ref.num))
+		    root->rndr_footnote_ref->num))
 			return 0;
 		if (!rndr_indent(ob, indent + 1))
 			return 0;
 		if (!hbuf_printf(ob, "name: "))
 			return 0;
-		if (!rndr_short(ob, &root->rndr_footnote_ref.key))
+		if (!rndr_short(ob, &root->rndr_footnote_ref->key))
 			return 0;
 		if (!HBUF_PUTSL(ob, "\n"))
 			return 0;
@@ -267,9 +267,9 @@ rndr(struct mdown_buf *ob,
 		if (!rndr_indent(ob, indent + 1))
 			return 0;
 		if (!hbuf_printf(ob, "data: %zu Bytes: ",
-		    root->rndr_blockcode.text.size))
+		    root->rndr_blockcode->text.size))
 			return 0;
-		if (!rndr_short(ob, &root->rndr_blockcode.text))
+		if (!rndr_short(ob, &root->rndr_blockcode->text))
 			return 0;
 		if (!HBUF_PUTSL(ob, "\n"))
 			return 0;
@@ -371,22 +371,22 @@ rndr(struct mdown_buf *ob,
 		}
 		break;
 	case MDOWN_LINK:
-		if (root->rndr_link.title.size) {
+		if (root->rndr_link->title.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!HBUF_PUTSL(ob, "title: "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_link.title))
+			if (!rndr_short(ob, &root->rndr_link->title))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
 		}
-		if (root->rndr_link.link.size) {
+		if (root->rndr_link->link.size) {
 			if (!rndr_indent(ob, indent + 1))
 				return 0;
 			if (!HBUF_PUTSL(ob, "link: "))
 				return 0;
-			if (!rndr_short(ob, &root->rndr_link.link))
+			if (!rndr_short(ob, &root->rndr_link->link))
 				return 0;
 			if (!HBUF_PUTSL(ob, "\n"))
 				return 0;
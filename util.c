@@ -22,22 +22,129 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "mdown.h"
 #include "extern.h"
 
 /*
- * Convert the "$Date$" string to a simple ISO date in a
- * static buffer.
+ * Slot in a table of size "tabsz" (a power of two) for the key "key" of
+ * size "sz".
+ * This uses the FNV-1a hash.
+ */
+static size_t
+htab_hash(const char *key, size_t sz, size_t tabsz)
+{
+	uint32_t	 h = 2166136261U;
+	size_t		 i;
+
+	for (i = 0; i < sz; i++)
+		h = (h ^ (unsigned char)key[i]) * 16777619U;
+	return h & (tabsz - 1);
+}
+
+/*
+ * Whether the entry "ent" of table "t" has the key "key" of size "sz".
+ */
+static int
+htab_eq(const struct htab *t, const void *ent, const char *key, size_t sz)
+{
+	const char	*k;
+	size_t		 ksz;
+
+	k = t->key(ent, &ksz);
+	return ksz == sz && (sz == 0 || memcmp(k, key, sz) == 0);
+}
+
+/*
+ * Look up the entry with key "key" of size "sz".
+ * Returns NULL if not found.
+ */
+void *
+htab_find(const struct htab *t, const char *key, size_t sz)
+{
+	void	*ent;
+	size_t	 h;
+
+	if (t->tab == NULL)
+		return NULL;
+
+	h = htab_hash(key, sz, t->tabsz);
+	while ((ent = t->tab[h]) != NULL) {
+		if (htab_eq(t, ent, key, sz))
+			return ent;
+		h = (h + 1) & (t->tabsz - 1);
+	}
+	return NULL;
+}
+
+/*
+ * Find the slot for key "key" of size "sz", growing the table as
+ * needed.  If the slot is empty, the caller must fill it with an entry
+ * having the key; otherwise, it holds the existing entry, which the
+ * caller may replace with another having the same key.
+ * Returns NULL on failure (memory), the slot on success.
+ */
+void **
+htab_slot(struct htab *t, const char *key, size_t sz)
+{
+	void		**tab, *ent;
+	const char	 *k;
+	size_t		  i, h, ksz, tabsz;
+
+	/* Keep the table at most half full. */
+
+	if ((t->count + 1) * 2 > t->tabsz) {
+		tabsz = t->tabsz == 0 ? 64 : t->tabsz * 2;
+		if ((tab = calloc(tabsz, sizeof(void *))) == NULL)
+			return NULL;
+		for (i = 0; i < t->tabsz; i++) {
+			if ((ent = t->tab[i]) == NULL)
+				continue;
+			k = t->key(ent, &ksz);
+			h = htab_hash(k, ksz, tabsz);
+			while (tab[h] != NULL)
+				h = (h + 1) & (tabsz - 1);
+			tab[h] = ent;
+		}
+		free(t->tab);
+		t->tab = tab;
+		t->tabsz = tabsz;
+	}
+
+	h = htab_hash(key, sz, t->tabsz);
+	while ((ent = t->tab[h]) != NULL) {
+		if (htab_eq(t, ent, key, sz))
+			return &t->tab[h];
+		h = (h + 1) & (t->tabsz - 1);
+	}
+	t->count++;
+	return &t->tab[h];
+}
+
+/*
+ * Free the table (not its entries), leaving it empty.
+ */
+void
+htab_free(struct htab *t)
+{
+
+	free(t->tab);
+	t->tab = NULL;
+	t->tabsz = t->count = 0;
+}
+
+/*
+ * Convert the "$Date$" string to a simple ISO date in "buf" of size
+ * "sz", which should be at least 32 bytes.
  * Returns NULL if the string is malformed at all or the date otherwise.
  */
 char *
-rcsdate2str(const char *v)
+rcsdate2str(const char *v, char *buf, size_t sz)
 {
 	unsigned int	y, m, d, h, min, s;
 	int		rc;
-	static char	buf[32];
 
 	if (v == NULL || strlen(v) < 12)
 		return NULL;
@@ -74,20 +181,19 @@ rcsdate2str(const char *v)
 			return NULL;
 	}
 
-	snprintf(buf, sizeof(buf), "%u-%.2u-%.2u", y, m, d);
+	snprintf(buf, sz, "%u-%.2u-%.2u", y, m, d);
 	return buf;
 }
 
 /*
- * Convert the "$Author$" string to just the author in a static
- * buffer of a fixed length.
+ * Convert the "$Author$" string to just the author in "buf" of size
+ * "bufsz".
  * Returns NULL if the string is malformed (too long, too short, etc.)
  * at all or the author name otherwise.
  */
 char *
-rcsauthor2str(const char *v)
+rcsauthor2str(const char *v, char *buf, size_t bufsz)
 {
-	static char	buf[1024];
 	size_t		sz;
 
 	if (v == NULL || strlen(v) < 12)
@@ -100,7 +206,7 @@ rcsauthor2str(const char *v)
 
 	if (strncmp(v, "$Author: ", 9))
 		return NULL;
-	if ((sz = strlcpy(buf, v + 9, sizeof(buf))) >= sizeof(buf))
+	if ((sz = strlcpy(buf, v + 9, bufsz)) >= bufsz)
 		return NULL;
 
 	/* Strip end (with LaTeX). */
@@ -117,15 +223,15 @@ rcsauthor2str(const char *v)
 }
 
 /*
- * Convert an ISO date (y/m/d or y-m-d) to a canonical form.
+ * Convert an ISO date (y/m/d or y-m-d) to a canonical form in "buf" of
+ * size "sz", which should be at least 32 bytes.
  * Returns NULL if the string is malformed at all or the date otherwise.
  */
 char *
-date2str(const char *v)
+date2str(const char *v, char *buf, size_t sz)
 {
 	unsigned int	y, m, d;
 	int		rc;
-	static char	buf[32];
 
 	if (NULL == v)
 		return(NULL);
@@ -137,7 +243,7 @@ date2str(const char *v)
 			return(NULL);
 	}
 
-	snprintf(buf, sizeof(buf), "%u-%.2u-%.2u", y, m, d);
+	snprintf(buf, sz, "%u-%.2u-%.2u", y, m, d);
 	return(buf);
 }
 